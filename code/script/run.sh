@@ -2,6 +2,9 @@
 
 # shellcheck disable=SC2086
 
+# The TSPLIB instances in ../data/euc2d_tsplib to run after the grid cases
+instances=(berlin52.tsp eil51.tsp eil76.tsp eil101.tsp lin105.tsp pr76.tsp pr107.tsp pr124.tsp pr136.tsp pr144.tsp pr152.tsp)
+
 for time in "-time 1000" "-time 5000" "-time 10000" "-time 60000"  "-time 120000"
 #for time in "-time 1000"
 do
@@ -24,21 +27,29 @@ do
 	done
 done
 
+# Preprocess each instance once into a binary instance cache, so that the runs below do not recompute
+# the candidate edges and dominated edges every time.
+mkdir -p ../data/cache
+for inst in "${instances[@]}"
+do
+    ./src/programs/tsp-preprocess -dominated-edges ../data/euc2d_tsplib/$inst ../data/cache/$inst.hcbin || exit 1
+done
+
 for time in "-time 1000" "-time 5000" "-time 10000" "-time 60000"  "-time 120000"
 #for time in "-time 1000"
 do
     for solutions in "-solutions 1 -assets 1 -threads 1" "-print-last true -solutions 0 -threads 2"
     do
-      for inst in berlin52.tsp eil52.tsp eil76.tsp eil101.tsp lin105 pr76.tsp pr107.tsp pr124.tsp pr136.tsp pr144.tsp pr152.tsp
+      for inst in "${instances[@]}"
 	    do
         for config in "-domination-propagation false"  "-domination-propagation true" "-warnsdorff-domination-2-propagation true"  "-christofides-propagation true"  "-one-tree-propagation true"
         do
             for nogoods in "-use-all-nogoods false"  "-use-all-nogoods true"
             do
                 echo
-                echo "Solutions ${solutions} case -file ../data/euc2d_tsplib/${inst} time ${time} config ${config} nogoods ${nogoods}"
-                echo ./src/programs/tsp-main  -branching-val min-length $time $solutions -file ../data/euc2d_tsplib/$inst $config $nogoods
-                ./src/programs/tsp-main -branching-val min-length $time $solutions -file ../data/euc2d_tsplib/$inst $config $nogoods
+                echo "Solutions ${solutions} case -file ../data/cache/${inst}.hcbin time ${time} config ${config} nogoods ${nogoods}"
+                echo ./src/programs/tsp-main  -branching-val min-length $time $solutions -file ../data/cache/$inst.hcbin $config $nogoods
+                ./src/programs/tsp-main -branching-val min-length $time $solutions -file ../data/cache/$inst.hcbin $config $nogoods
             done
         done
 	    done
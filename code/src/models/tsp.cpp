@@ -34,7 +34,10 @@ namespace hc {
               use_warnsdorff_dominated_edges2_propagation_(options.use_warnsdorff_dominated_edges2_propagation()),
               use_dominated_edges_propagation_(options.use_dominated_edges_propagation()),
               use_christofides_propagation_(options.use_christofides_propagation()),
+              christofides_local_search_(options.christofides_local_search()),
+              christofides_candidate_density_(options.christofides_candidate_density()),
               use_one_tree_propagation_(options.use_one_tree_propagation()),
+              held_karp_options_(options.held_karp_options()),
               uses_half_checking_propagators_(false),
               use_all_nogoods_(options.use_all_nogoods()),
               warnsdorff_start_(0),
@@ -46,12 +49,17 @@ namespace hc {
         for (int s = 0; s < instance_->locations(); ++s) {
             for (int e = 0; e < instance_->locations(); ++e) {
                 const int pos = s * instance_->locations() + e;
-                costs[pos] = instance_->line(s, e).length();
+                costs[pos] = instance_->length(s, e);
             }
         }
         // Then post the actual constraint
         circuit(*this, costs, succ_, edge_costs_, tour_cost_, options.ipl());
 
+        // Start from the heuristic tour as bound, not strict so that the tour itself is still a solution
+        if (options.heuristic_bound().has_value()) {
+            rel(*this, tour_cost_, IRT_LQ, options.heuristic_bound().value());
+        }
+
         // Connect the successors with the previous pointers
         channel(*this, succ_, prev_, options.ipl());
 
@@ -91,12 +99,13 @@ namespace hc {
 
             if (use_christofides_propagation_) {
                 set_uses_half_checking_propagators();
-                hc::christofides(*this, instance_, succ_, tour_cost_);
+                hc::christofides(*this, instance_, succ_, tour_cost_, christofides_local_search_,
+                                 christofides_candidate_density_);
             }
 
             if (use_one_tree_propagation_) {
                 set_uses_half_checking_propagators();
-                hc::hk_1tree(*this, instance_, succ_, prev_, tour_cost_);
+                hc::hk_1tree(*this, instance_, succ_, prev_, tour_cost_, held_karp_options_);
             }
         }
 
@@ -148,7 +157,7 @@ namespace hc {
                             rnd,
                             variable,
                             [&](int value) -> double {
-                                return instance->line(position, value).length();
+                                return instance->length(position, value);
                             });
                 };
                 val_branch = INT_VAL(biased_value_min_length);
@@ -162,7 +171,7 @@ namespace hc {
                             rnd,
                             variable,
                             [&](int value) -> double {
-                                return -instance->line(position, value).length();
+                                return -instance->length(position, value);
                             });
                 };
                 val_branch = INT_VAL(biased_value_max_length);
@@ -178,7 +187,7 @@ namespace hc {
                             variable,
                             [&](int value) -> pair<double, double> {
                                 auto out_degree = succ[value].size();
-                                auto length = instance->line(position, value).length();
+                                auto length = instance->length(position, value);
                                 return make_pair(out_degree, length);
                             });
                 };
@@ -195,7 +204,7 @@ namespace hc {
                             variable,
                             [&](int value) -> pair<double, double> {
                                 auto out_degree = succ[value].size();
-                                auto length = instance->line(position, value).length();
+                                auto length = instance->length(position, value);
                                 return make_pair(out_degree, -length);
                             });
                 };
@@ -304,7 +313,10 @@ namespace hc {
             use_warnsdorff_dominated_edges2_propagation_(s.use_warnsdorff_dominated_edges2_propagation_),
             use_dominated_edges_propagation_(s.use_dominated_edges_propagation_),
             use_christofides_propagation_(s.use_christofides_propagation_),
+            christofides_local_search_(s.christofides_local_search_),
+            christofides_candidate_density_(s.christofides_candidate_density_),
             use_one_tree_propagation_(s.use_one_tree_propagation_),
+            held_karp_options_(s.held_karp_options_),
             uses_half_checking_propagators_(s.uses_half_checking_propagators_),
             use_all_nogoods_(s.use_all_nogoods_),
             warnsdorff_start_(s.warnsdorff_start_),
@@ -49,8 +49,14 @@ namespace hc {
         const bool use_dominated_edges_propagation_;
         /// When true, use christofides bounds
         const bool use_christofides_propagation_;
+        /// Limits for the local search improving the christofides tour
+        const LocalSearchOptions christofides_local_search_;
+        /// Fraction of all edges in the domains above which the christofides tree uses the candidate graph
+        const double christofides_candidate_density_;
         /// When true, use one tree propagation in one asset
         const bool use_one_tree_propagation_;
+        /// Parameters for the Held-Karp bound in the one tree propagation
+        const HeldKarpOptions held_karp_options_;
         /// When true, this instance is known to use half-checking propagators.
         /// Starts out as false, but when set it remains true
         bool uses_half_checking_propagators_;
@@ -7,6 +7,7 @@
 #pragma ide diagnostic ignored "OCSimplifyInspection"
 
 #include "tsp_common.h"
+#include "propagators/propagators.h"
 
 #include <iostream>
 #include <gecode/driver.hh>
@@ -22,29 +23,68 @@ namespace hc {
             : Options("TSP"),
               branching_val_("branching-val", "The value ordering to use for branching"),
               tsp_grid_size_("tsp-grid", "When given a positive integer, create a grid of this size as instance", 0),
-              tsp_data_file_("file", "The TSPLib data file to read", ""),
+              tsp_data_file_("file", "The TSPLib data file or binary instance cache (see tsp-preprocess) to read", ""),
               use_dominated_edges_propagation_("domination-propagation", "When true, propagate dominated edges",
                                                false),
+              lazy_dominated_edges_("domination-lazy", "When true, compute the dominated edges of each edge when it is first assigned instead of all up front",
+                                    false),
               use_warnsdorff_dominated_edges_propagation_("warnsdorff-domination-propagation", "When true, propagate warnsdorff dominated edges",
                                                           false),
               use_warnsdorff_dominated_edges2_propagation_("warnsdorff-domination-2-propagation", "When true, propagate warnsdorff dominated edges v2",
                                                           false),
               use_one_tree_propagation_("one-tree-propagation", "When true, propagate using one tree analysis",
                                                false),
+              held_karp_iterations_("hk-iterations", "Number of Held-Karp subgradient iterations for the one tree bound, 0 uses the plain one tree",
+                                    HeldKarpOptions().iterations),
+              held_karp_warm_iterations_("hk-warm-iterations", "Number of Held-Karp subgradient iterations when starting from earlier potentials",
+                                         HeldKarpOptions().warm_iterations),
+              held_karp_step_("hk-step", "Initial step size factor for the Held-Karp subgradient optimisation",
+                              HeldKarpOptions().initial_step),
+              held_karp_step_decay_("hk-step-decay", "Factor the Held-Karp step size is multiplied by in each iteration",
+                                    HeldKarpOptions().step_decay),
               use_christofides_propagation_("christofides-propagation", "When true, propagate using christofides analysis",
                                             false),
+              christofides_moves_("christofides-moves", "Largest number of local search moves improving the christofides tour, 0 uses the plain tour",
+                                  LocalSearchOptions().max_moves),
+              christofides_time_("christofides-time", "Time limit in milliseconds for the local search improving the christofides tour, 0 for no limit",
+                                 LocalSearchOptions().time_limit),
+              christofides_candidate_density_("christofides-candidate-density", "Fraction of all edges in the domains above which the christofides tree is built from the candidate graph",
+                                              hc::christofides_candidate_density),
               use_all_nogoods_("use-all-nogoods", "When true, use all nogoods, even from half-checking propagators",
-                               false)
+                               false),
+              use_heuristic_bound_("heuristic-bound", "When true, bound the tour cost by a Lin-Kernighan tour computed before search",
+                                   false),
+              heuristic_kicks_("heuristic-kicks", "Number of kicks of the Lin-Kernighan local optimum for the heuristic bound",
+                               LinKernighanOptions().kicks),
+              heuristic_time_("heuristic-time", "Time limit in milliseconds for the heuristic bound, 0 for no limit",
+                              LinKernighanOptions().time_limit),
+              length_cache_("length-cache", "Number of entries in the shared cache of edge lengths, 0 computes all lengths on demand",
+                            0),
+              dense_lengths_limit_("dense-lengths-limit", "Largest number of cities for which a dense length matrix is stored",
+                                   DistanceOracle::default_dense_limit)
     {
         add(branching_val_);
         add(tsp_data_file_);
         add(tsp_grid_size_);
         add(use_dominated_edges_propagation_);
+        add(lazy_dominated_edges_);
         add(use_warnsdorff_dominated_edges_propagation_);
         add(use_warnsdorff_dominated_edges2_propagation_);
         add(use_one_tree_propagation_);
+        add(held_karp_iterations_);
+        add(held_karp_warm_iterations_);
+        add(held_karp_step_);
+        add(held_karp_step_decay_);
         add(use_christofides_propagation_);
+        add(christofides_moves_);
+        add(christofides_time_);
+        add(christofides_candidate_density_);
         add(use_all_nogoods_);
+        add(use_heuristic_bound_);
+        add(heuristic_kicks_);
+        add(heuristic_time_);
+        add(length_cache_);
+        add(dense_lengths_limit_);
 
         branching(static_cast<int>(VarBranching::InputOrder),
                   "input-order",
@@ -112,7 +152,6 @@ namespace hc {
             const int size = tsp_grid_size_.value();
             instance(make_grid(size));
             assert(tsp_instance_.value()->locations() > 0);
-            assert(!tsp_instance_.value()->lines().empty());
         } else if (std::strcmp(tsp_data_file_.value(), "") == 0) {
             std::cerr << "No data file specified." << std::endl;
             std::exit(EXIT_FAILURE);
@@ -129,9 +168,24 @@ namespace hc {
             instance(tsp_instance);
         }
 
-        if (use_dominated_edges_propagation_.value()) {
+        tsp_instance_.value()->store_dense_lengths(dense_lengths_limit_.value());
+        if (length_cache_.value() > 0) {
+            tsp_instance_.value()->cache_lengths(length_cache_.value());
+        }
+
+        if (use_dominated_edges_propagation_.value() && !lazy_dominated_edges_.value() &&
+            tsp_instance_.value()->has_embedding()) {
             tsp_instance_.value()->compute_dominated_edges();
         }
+
+        if (use_heuristic_bound_.value()) {
+            LinKernighanOptions options;
+            options.kicks = heuristic_kicks_.value();
+            options.time_limit = heuristic_time_.value();
+            const vector<int> tour = heuristic_tour(tsp_instance_.value(), options);
+            heuristic_bound_.emplace(tour_length(*tsp_instance_.value(), tour));
+            std::cout << "Heuristic tour length " << heuristic_bound_.value() << std::endl;
+        }
     }
 
     shared_ptr<const TSPInstance> TSPModelOptions::make_grid(const int size) {
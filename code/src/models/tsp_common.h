@@ -12,6 +12,8 @@
 #include <gecode/int.hh>
 
 #include "utilities/tsp.h"
+#include "utilities/graph.h"
+#include "utilities/lin_kernighan.h"
 
 namespace hc {
     enum class VarBranching {
@@ -35,12 +37,26 @@ namespace hc {
         Gecode::Driver::IntOption tsp_grid_size_;
         Gecode::Driver::StringValueOption tsp_data_file_;
         Gecode::Driver::BoolOption use_dominated_edges_propagation_;
+        Gecode::Driver::BoolOption lazy_dominated_edges_;
         Gecode::Driver::BoolOption use_warnsdorff_dominated_edges_propagation_;
         Gecode::Driver::BoolOption use_warnsdorff_dominated_edges2_propagation_;
         Gecode::Driver::BoolOption use_one_tree_propagation_;
+        Gecode::Driver::IntOption held_karp_iterations_;
+        Gecode::Driver::IntOption held_karp_warm_iterations_;
+        Gecode::Driver::DoubleOption held_karp_step_;
+        Gecode::Driver::DoubleOption held_karp_step_decay_;
         Gecode::Driver::BoolOption use_christofides_propagation_;
+        Gecode::Driver::IntOption christofides_moves_;
+        Gecode::Driver::DoubleOption christofides_time_;
+        Gecode::Driver::DoubleOption christofides_candidate_density_;
         Gecode::Driver::BoolOption use_all_nogoods_;
+        Gecode::Driver::BoolOption use_heuristic_bound_;
+        Gecode::Driver::IntOption heuristic_kicks_;
+        Gecode::Driver::DoubleOption heuristic_time_;
+        Gecode::Driver::IntOption length_cache_;
+        Gecode::Driver::IntOption dense_lengths_limit_;
         std::optional<const std::shared_ptr<const TSPInstance>> tsp_instance_;
+        std::optional<int> heuristic_bound_;
     public:
         TSPModelOptions();
 
@@ -70,14 +86,39 @@ namespace hc {
             return use_one_tree_propagation_.value();
         }
 
+        [[nodiscard]] HeldKarpOptions held_karp_options() const {
+            HeldKarpOptions result;
+            result.iterations = held_karp_iterations_.value();
+            result.warm_iterations = held_karp_warm_iterations_.value();
+            result.initial_step = held_karp_step_.value();
+            result.step_decay = held_karp_step_decay_.value();
+            return result;
+        }
+
         [[nodiscard]] bool use_christofides_propagation() const {
             return use_christofides_propagation_.value();
         }
 
+        [[nodiscard]] LocalSearchOptions christofides_local_search() const {
+            LocalSearchOptions result;
+            result.max_moves = christofides_moves_.value();
+            result.time_limit = christofides_time_.value();
+            return result;
+        }
+
+        [[nodiscard]] double christofides_candidate_density() const {
+            return christofides_candidate_density_.value();
+        }
+
         [[nodiscard]] bool use_all_nogoods() const {
             return use_all_nogoods_.value();
         }
 
+        /// The length of the heuristic tour computed when parsing, if enabled
+        [[nodiscard]] std::optional<int> heuristic_bound() const {
+            return heuristic_bound_;
+        }
+
         [[nodiscard]] std::shared_ptr<const TSPInstance> instance() const {
             return tsp_instance_.value();
         }
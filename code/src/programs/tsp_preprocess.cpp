@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "utilities/tsp.h"
+#include "utilities/instance_cache.h"
+
+/**
+ * Preprocess a TSPLib instance into a binary instance cache, that can be given instead of the TSPLib file
+ * to the other programs.
+ *
+ * Usage: tsp-preprocess [-dominated-edges] <input.tsp> <output.hcbin>
+ */
+int main(int argc, char **argv) {
+    // Clock function used.
+    auto now = [] { return std::chrono::steady_clock::now(); };
+
+    bool with_dominated_edges = false;
+    int argument = 1;
+    if (argument < argc && std::strcmp(argv[argument], "-dominated-edges") == 0) {
+        with_dominated_edges = true;
+        ++argument;
+    }
+    if (argc - argument != 2) {
+        std::cerr << "Usage: " << argv[0] << " [-dominated-edges] <input.tsp> <output.hcbin>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string input = argv[argument];
+    const std::string output = argv[argument + 1];
+
+    const auto start = now();
+
+    const auto &result = hc::TSPInstance::read_instance(input);
+    if (result.isErr()) {
+        std::cerr << "Could not read file \"" << input << "\"" << std::endl
+                  << "Error: " << result.unwrapErr().text << std::endl;
+        return EXIT_FAILURE;
+    }
+    const hc::TSPInstance &instance = result.unwrap();
+    if (with_dominated_edges && !instance.has_embedding()) {
+        std::cerr << "Dominated edges are only available for instances with planar coordinates, skipping them."
+                  << std::endl;
+        with_dominated_edges = false;
+    }
+
+    if (!hc::write_instance_cache(instance, output, with_dominated_edges)) {
+        std::cerr << "Could not write file \"" << output << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const auto end = now();
+    const std::chrono::duration<double, std::milli> duration = end - start;
+    std::cout << "Preprocessed " << instance.name() << " (" << instance.locations() << " locations) in "
+              << duration.count() << std::endl;
+
+    return EXIT_SUCCESS;
+}
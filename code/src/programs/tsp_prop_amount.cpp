@@ -82,6 +82,16 @@ int main(int argc, char **argv) {
     cout << "Ran model in; " << model_duration.count()
               << endl;
 
+    const auto report_timer = [](const char *name, const PathTimer &timer) {
+        cout << name << "; " << timer.calls() << "; " << timer.milliseconds() << endl;
+    };
+    cout << "Bound path; Calls; Time" << endl;
+    report_timer("HeldKarp", bound_timers().held_karp);
+    report_timer("OneTree", bound_timers().one_tree);
+    report_timer("ChristofidesCandidates", bound_timers().christofides_candidates);
+    report_timer("ChristofidesDomains", bound_timers().christofides_domains);
+    report_timer("ChristofidesLocalSearch", bound_timers().christofides_local_search);
+
     return EXIT_SUCCESS;
 }
 
@@ -169,14 +179,14 @@ void run_instance(const InspectorTSPModelOptions &opt) {
 
     {
         auto *cbp = dynamic_cast<TSPModel *>(root->clone(clone_statistics));
-        christofides(*cbp, opt.instance(), cbp->succ(), cbp->tour_cost());
+        christofides(*cbp, opt.instance(), cbp->succ(), cbp->tour_cost(), opt.christofides_local_search());
         cbp->status(status_statistics);
         variants.push_back(cbp);
     }
 
     {
         auto *hk1 = dynamic_cast<TSPModel *>(root->clone(clone_statistics));
-        hk_1tree(*hk1, opt.instance(), hk1->succ(), hk1->prev(), hk1->tour_cost());
+        hk_1tree(*hk1, opt.instance(), hk1->succ(), hk1->prev(), hk1->tour_cost(), opt.held_karp_options());
         hk1->status(status_statistics);
         variants.push_back(hk1);
     }
@@ -184,8 +194,8 @@ void run_instance(const InspectorTSPModelOptions &opt) {
     {
         auto *all = dynamic_cast<TSPModel *>(root->clone(clone_statistics));
         no_warnsdorff_dominated_edges2(*all, opt.instance(), all->warnsdorff_start(), all->succ());
-        christofides(*all, opt.instance(), all->succ(), all->tour_cost());
-        hk_1tree(*all, opt.instance(), all->succ(), all->prev(), all->tour_cost());
+        christofides(*all, opt.instance(), all->succ(), all->tour_cost(), opt.christofides_local_search());
+        hk_1tree(*all, opt.instance(), all->succ(), all->prev(), all->tour_cost(), opt.held_karp_options());
         all->status(status_statistics);
         variants.push_back(all);
     }
@@ -0,0 +1,81 @@
+#ifndef HC_ASSIGNED_NODES_H
+#define HC_ASSIGNED_NODES_H
+
+#include <gecode/int.hh>
+
+#include <algorithm>
+
+namespace hc {
+    /// Advisor for the successor view of one node, telling its propagator when the view is assigned
+    class AssignedAdvisor : public Gecode::ViewAdvisor<Gecode::Int::IntView> {
+        int node_;
+    public:
+        AssignedAdvisor(Gecode::Space &home, Gecode::Propagator &propagator,
+                        Gecode::Council<AssignedAdvisor> &council, Gecode::Int::IntView view, int node)
+                : ViewAdvisor(home, propagator, council, view), node_(node) {}
+
+        AssignedAdvisor(Gecode::Space &home, AssignedAdvisor &advisor)
+                : ViewAdvisor(home, advisor), node_(advisor.node_) {}
+
+        [[nodiscard]] int node() const {
+            return node_;
+        }
+    };
+
+    /**
+     * The nodes whose successors have been assigned, in the order they were assigned, found by one advisor per
+     * successor view.
+     *
+     * The advisor of a node is disposed when its view is assigned, so a propagator using this only pays for the
+     * changed views instead of looking through all of them in each propagation. The nodes are kept in space memory.
+     */
+    class AssignedNodes {
+        Gecode::Council<AssignedAdvisor> council_;
+        int *nodes_;
+        int count_;
+    public:
+        /// Advise \a propagator of the assignments to \a successors, with the already assigned views as the first nodes
+        AssignedNodes(Gecode::Space &home, Gecode::Propagator &propagator, Gecode::ViewArray<Gecode::Int::IntView> &successors)
+                : council_(home), nodes_(home.alloc<int>(successors.size())), count_(0) {
+            for (int i = 0; i < successors.size(); ++i) {
+                if (successors[i].assigned()) {
+                    nodes_[count_++] = i;
+                } else {
+                    (void) new(home) AssignedAdvisor(home, propagator, council_, successors[i], i);
+                }
+            }
+        }
+
+        /// Copy of \a other, for \a size successors
+        AssignedNodes(Gecode::Space &home, AssignedNodes &other, int size)
+                : council_(), nodes_(home.alloc<int>(size)), count_(other.count_) {
+            council_.update(home, other.council_);
+            std::copy(other.nodes_, other.nodes_ + other.count_, nodes_);
+        }
+
+        [[nodiscard]] int size() const {
+            return count_;
+        }
+
+        [[nodiscard]] int operator[](int i) const {
+            return nodes_[i];
+        }
+
+        /// Record the node of \a advisor if its view is assigned, to be called from the advise of the propagator
+        Gecode::ExecStatus advise(Gecode::Space &home, Gecode::Advisor &advisor) {
+            auto &assigned_advisor = static_cast<AssignedAdvisor &>(advisor);
+            if (!assigned_advisor.view().assigned()) {
+                return Gecode::ES_FIX;
+            }
+            nodes_[count_++] = assigned_advisor.node();
+            return home.ES_NOFIX_DISPOSE(council_, assigned_advisor);
+        }
+
+        /// Dispose the advisors, to be called from the dispose of the propagator
+        void dispose(Gecode::Space &home) {
+            council_.dispose(home);
+        }
+    };
+}
+
+#endif //HC_ASSIGNED_NODES_H
@@ -4,6 +4,7 @@
 #include <utility>
 #include "utilities/tsp.h"
 #include "utilities/graph.h"
+#include "propagators.h"
 
 using namespace hc;
 using namespace Gecode;
@@ -16,11 +17,32 @@ protected:
     using Base::x;
     using Base::y;
     shared_ptr<const TSPInstance> instance_;
+    LocalSearchOptions options_;
+    // Fraction of all edges in the domains above which the candidate graph is used
+    double candidate_density_;
+    // Spanning tree repaired between propagations, shared with copies until one of them changes it
+    shared_ptr<IncrementalMST> mst_;
+    // True if mst_ was last updated over the candidate graph instead of the domain edges
+    bool mst_over_candidates_;
+    // Buffers reused between propagations, not copied
+    std::vector<LineSegment> lines_;
+    EdgeSorter sorter_;
+    EulerCircuit euler_;
+    std::vector<int> tour_;
 public:
     // posting
-    ChristofidesBounds(Space &home, ViewArray<Int::IntView>& successors, Int::IntView cost, shared_ptr<const TSPInstance> instance)
+    ChristofidesBounds(Space &home, ViewArray<Int::IntView>& successors, Int::IntView cost, shared_ptr<const TSPInstance> instance,
+                       const LocalSearchOptions &options, double candidate_density)
             : Base(home, successors, cost),
-              instance_(std::move(instance)) {
+              instance_(std::move(instance)),
+              options_(options),
+              candidate_density_(candidate_density),
+              mst_(make_shared<IncrementalMST>()),
+              mst_over_candidates_(false),
+              lines_(),
+              sorter_(),
+              euler_(),
+              tour_() {
         home.notice(*this, AP_WEAKLY);
         home.notice(*this, AP_DISPOSE);
     }
@@ -28,8 +50,11 @@ public:
     static ExecStatus post(Space &home,
                            ViewArray<Int::IntView>& successors,
                            Int::IntView cost,
-                           shared_ptr<const TSPInstance> instance) {
-        auto *propagator = new(home) ChristofidesBounds(home, successors, cost, std::move(instance));
+                           shared_ptr<const TSPInstance> instance,
+                           const LocalSearchOptions &options,
+                           double candidate_density) {
+        auto *propagator = new(home) ChristofidesBounds(home, successors, cost, std::move(instance), options,
+                                                        candidate_density);
         return ES_OK;
     }
 
@@ -38,6 +63,11 @@ public:
         home.ignore(*this, AP_DISPOSE);
         home.ignore(*this, AP_WEAKLY);
         instance_.~shared_ptr();
+        mst_.~shared_ptr();
+        lines_.~vector();
+        sorter_.~EdgeSorter();
+        euler_.~EulerCircuit();
+        tour_.~vector();
         (void) Base::dispose(home);
         return sizeof(*this);
     }
@@ -45,13 +75,36 @@ public:
     // copying
     ChristofidesBounds(Space &home, ChristofidesBounds &p)
             : Base(home, p),
-              instance_(p.instance_) {
+              instance_(p.instance_),
+              options_(p.options_),
+              candidate_density_(p.candidate_density_),
+              mst_(p.mst_),
+              mst_over_candidates_(p.mst_over_candidates_),
+              lines_(),
+              sorter_(),
+              euler_(),
+              tour_() {
     }
 
     Propagator *copy(Space &home) override {
         return new(home) ChristofidesBounds(home, *this);
     }
 
+    // Repair the spanning tree over edges, rebuilding it when it was last updated over the other set of edges, since
+    // the kept tree edges need not be in a minimum spanning tree of the new set
+    const MST &update_mst(bool over_candidates,
+                          const vector<LineSegment> &mandatory,
+                          const vector<LineSegment> &edges,
+                          const function<bool(const LineSegment &)> &possible) {
+        if (over_candidates != mst_over_candidates_) {
+            mst_ = make_shared<IncrementalMST>();
+            mst_over_candidates_ = over_candidates;
+        } else if (mst_.use_count() > 1) {
+            mst_ = make_shared<IncrementalMST>(*mst_);
+        }
+        return mst_->update(x.size(), -1, mandatory, edges, possible);
+    }
+
     // cost computation
     [[nodiscard]] PropCost cost(const Space &, const ModEventDelta &) const override {
         return PropCost::crazy(PropCost::Mod::HI, x.size());
@@ -74,59 +127,66 @@ public:
             }
         }
 
+        // An edge is possible if it is possible in either direction
+        const auto possible = [&](const LineSegment &edge) {
+            // This is a O(n) operation in the worst case, but as long as most variables are ranges it is quick, since
+            // the n here is the number of ranges in the variable, not the domain size
+            return x[edge.start_id()].in(edge.end_id()) || x[edge.end_id()].in(edge.start_id());
+        };
+
         unsigned int dom_sum = 0;
         for (const auto &node : x) {
             dom_sum += node.size();
         }
-        // Magic number for when to use all edges vs collect current - value from tests using berlin52.tsp for hk_1tree.
-        vector<LineSegment> circuit;
-        if (dom_sum > 0.25 * (x.size() * x.size())) {
-            auto opt = christofides(instance_,
-                    x.size(),
-                    mandatory,
-                    instance_->lines_length_ordered(),
-                                   [&](const LineSegment &edge) {
-                                       // This is a O(n) operation in the worst case, but as long as most variables are ranges it is quick, since
-                                       // the n here is the number of ranges in the variable, not the domain size
-                                       return x[edge.start_id()].in(edge.end_id());
-                                   });
-            if (opt.has_value()) {
-                circuit = opt.value();
-            } else {
-                // Could not create circuit
-                return ES_FIX;
+        optional<vector<LineSegment>> opt;
+        if (dom_sum > candidate_density_ * x.size() * x.size()) {
+            PathTimer::Scope timer(bound_timers().christofides_candidates);
+            const vector<LineSegment> &candidates = instance_->candidate_graph().edges();
+            const MST &mst = update_mst(true, mandatory, candidates, possible);
+            if (mst.edges().size() + 1 == static_cast<size_t>(x.size())) {
+                opt = christofides_from_mst(instance_, x.size(), mst, candidates, euler_);
             }
-        } else {
-            std::vector<LineSegment> lines;
+            // Otherwise the possible candidate edges do not connect the nodes, and the domain edges are used instead
+        }
+        if (!opt.has_value()) {
+            PathTimer::Scope timer(bound_timers().christofides_domains);
+            lines_.clear();
             for (int start = 0; start < x.size(); ++start) {
                 if (!x[start].assigned()) {
                     Int::ViewValues iv(x[start]);
                     while (iv()) {
                         int end = iv.val();
-                        lines.emplace_back(instance_->line(start, end));
+                        lines_.emplace_back(instance_->line(start, end));
                         ++iv;
                     }
                 }
             }
-            std::sort(lines.begin(), lines.end(), [](LineSegment& a, LineSegment& b){
-                return a.length() < b.length();
-            });
-            auto opt = christofides(instance_,
-                                    x.size(),
-                                    mandatory,
-                                    lines,
-                                    [&](const LineSegment &edge) { return true; });
-            if (opt.has_value()) {
-                circuit = opt.value();
-            } else {
-                // Could not create circuit
-                return ES_FIX;
-            }
+            sorter_.sort_by_length(lines_);
+            // The domain edges are all the possible edges that are not mandatory, so they are enough for the tree
+            const MST &mst = update_mst(false, mandatory, lines_, possible);
+            opt = christofides_from_mst(instance_, x.size(), mst, lines_, euler_);
+        }
+        if (!opt.has_value()) {
+            // Could not create circuit
+            return ES_FIX;
         }
+        const vector<LineSegment> &circuit = opt.value();
 
         int cost = 0;
-        for (const auto &edge : circuit) {
-            cost += edge.length();
+        if (circuit.size() == static_cast<size_t>(x.size())) {
+            PathTimer::Scope timer(bound_timers().christofides_local_search);
+            tour_.clear();
+            for (const auto &edge : circuit) {
+                tour_.emplace_back(edge.start_id());
+            }
+            improve_tour(*instance_, tour_, [&](int a, int b) { return x[a].in(b) || x[b].in(a); }, options_);
+            for (int i = 0; i < x.size(); ++i) {
+                cost += instance_->length(tour_[i], tour_[(i + 1) % x.size()]);
+            }
+        } else {
+            for (const auto &edge : circuit) {
+                cost += edge.length();
+            }
         }
 
         GECODE_ME_CHECK(y.lq(home, cost));
@@ -136,12 +196,13 @@ public:
 };
 
 namespace hc {
-    void christofides(Home home, std::shared_ptr<const TSPInstance> instance, const IntVarArgs& successors_var,  const IntVar cost_var) {
+    void christofides(Home home, std::shared_ptr<const TSPInstance> instance, const IntVarArgs& successors_var,  const IntVar cost_var,
+                      const LocalSearchOptions& options, double candidate_density) {
         ViewArray<Int::IntView> successors(home, successors_var);
         Int::IntView cost(cost_var);
 
 
-        if (ChristofidesBounds::post(home, successors, cost, std::move(instance)) != ES_OK) {
+        if (ChristofidesBounds::post(home, successors, cost, std::move(instance), options, candidate_density) != ES_OK) {
             home.fail();
         }
     }
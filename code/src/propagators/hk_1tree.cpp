@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <memory>
 
 #include <gecode/int.hh>
@@ -5,42 +6,12 @@
 #include <utilities/tsp.h>
 
 #include "utilities/graph.h"
+#include "propagators.h"
 
 using namespace hc;
 using namespace Gecode;
 using namespace std;
 
-// From https://stackoverflow.com/a/17299623/33965
-template <typename T>
-std::vector<T> flatten(const std::vector<std::vector<T>>& v) {
-    std::size_t total_size = 0;
-    for (const auto& sub : v) {
-        total_size += sub.size();
-    }
-    std::vector<T> result;
-    result.reserve(total_size);
-    for (const auto& sub : v) {
-        result.insert(result.end(), sub.begin(), sub.end());
-    }
-    return result;
-}
-
-template <typename T>
-std::vector<T> flatten(const std::vector<std::optional<T>>& v) {
-    std::size_t total_size = 0;
-    for (const auto& opt : v) {
-        total_size += opt.has_value();
-    }
-    std::vector<T> result;
-    result.reserve(total_size);
-    for (const auto& opt : v) {
-        if (opt.has_value()) {
-            result.emplace_back(opt.value());
-        }
-    }
-    return result;
-}
-
 typedef MixNaryOnePropagator<Int::IntView, Int::PC_INT_DOM, Int::IntView, PC_GEN_NONE> Base;
 
 class HKOneTreePropagator : public Propagator {
@@ -49,26 +20,45 @@ protected:
     ViewArray<Int::IntView> pred_;
     Int::IntView cost_;
     shared_ptr<const TSPInstance> instance_;
-    vector<bool> assigned_collected_;
-    // Each sub-vector will eventually contain two line segments, the incoming (first) and the outgoing (last)
-    vector<optional<LineSegment>> assigned_out_;
-    vector<optional<LineSegment>> assigned_in_;
+    // The assigned successor and predecessor of each node seen so far, or -1 for none. These are in space memory, so
+    // that cloning does not touch the heap
+    int *assigned_succ_;
+    int *assigned_pred_;
+    HeldKarpOptions options_;
+    // Potentials giving the best Held-Karp bound so far, used as the starting point in later propagations. Shared
+    // with the copies of the space, and replaced rather than changed
+    shared_ptr<vector<double>> potentials_;
+    // Spanning tree over the nodes except the excluded node, repaired between propagations for the plain 1-tree.
+    // Shared with the copies of the space until one of them repairs it
+    shared_ptr<IncrementalMST> mst_;
+    int excluded_node_;
+    // Buffers reused between propagations, not copied
+    std::vector<LineSegment> lines_;
+    EdgeSorter sorter_;
 public:
     // posting
     HKOneTreePropagator(Space &home,
                         ViewArray<Int::IntView>& successors,
                         ViewArray<Int::IntView>& predecessors,
                         Int::IntView cost,
-                        shared_ptr<const TSPInstance> instance)
+                        shared_ptr<const TSPInstance> instance,
+                        const HeldKarpOptions &options)
             : Propagator(home),
               succ_(successors),
               pred_(predecessors),
               cost_(cost),
               instance_(std::move(instance)),
-              assigned_collected_(succ_.size(), false),
-              assigned_in_(succ_.size(), optional<LineSegment>()),
-              assigned_out_(succ_.size(), optional<LineSegment>())
+              assigned_succ_(home.alloc<int>(succ_.size())),
+              assigned_pred_(home.alloc<int>(succ_.size())),
+              options_(options),
+              potentials_(),
+              mst_(make_shared<IncrementalMST>()),
+              excluded_node_(-1),
+              lines_(),
+              sorter_()
     {
+        std::fill(assigned_succ_, assigned_succ_ + succ_.size(), -1);
+        std::fill(assigned_pred_, assigned_pred_ + succ_.size(), -1);
         home.notice(*this, AP_WEAKLY);
         home.notice(*this, AP_DISPOSE);
 
@@ -80,8 +70,9 @@ public:
                            ViewArray<Int::IntView>& successors,
                            ViewArray<Int::IntView>& predecessors,
                            Int::IntView cost,
-                           shared_ptr<const TSPInstance> instance) {
-        auto *propagator = new(home) HKOneTreePropagator(home, successors, predecessors, cost, std::move(instance));
+                           shared_ptr<const TSPInstance> instance,
+                           const HeldKarpOptions &options) {
+        auto *propagator = new(home) HKOneTreePropagator(home, successors, predecessors, cost, std::move(instance), options);
         return ES_OK;
     }
 
@@ -91,9 +82,10 @@ public:
         home.ignore(*this, AP_WEAKLY);
         succ_.cancel(home, *this, Int::PC_INT_DOM);
         instance_.~shared_ptr();
-        assigned_collected_.~vector();
-        assigned_in_.~vector();
-        assigned_out_.~vector();
+        potentials_.~shared_ptr();
+        mst_.~shared_ptr();
+        lines_.~vector();
+        sorter_.~EdgeSorter();
         (void) Propagator::dispose(home);
         return sizeof(*this);
     }
@@ -106,12 +98,19 @@ public:
     HKOneTreePropagator(Space &home, HKOneTreePropagator &p)
             : Propagator(home, p),
               instance_(p.instance_),
-              assigned_collected_(p.assigned_collected_),
-              assigned_in_(p.assigned_in_),
-              assigned_out_(p.assigned_out_) {
+              assigned_succ_(home.alloc<int>(p.succ_.size())),
+              assigned_pred_(home.alloc<int>(p.succ_.size())),
+              options_(p.options_),
+              potentials_(p.potentials_),
+              mst_(p.mst_),
+              excluded_node_(p.excluded_node_),
+              lines_(),
+              sorter_() {
         succ_.update(home, p.succ_);
         pred_.update(home, p.pred_);
         cost_.update(home, p.cost_);
+        std::copy(p.assigned_succ_, p.assigned_succ_ + p.succ_.size(), assigned_succ_);
+        std::copy(p.assigned_pred_, p.assigned_pred_ + p.succ_.size(), assigned_pred_);
     }
 
     Propagator *copy(Space &home) override {
@@ -123,21 +122,30 @@ public:
         return PropCost::crazy(PropCost::Mod::HI, succ_.size());
     }
 
-    void collect_assigned_lines() {
+    /// Record the newly assigned edges, and return all the assigned edges
+    vector<LineSegment> collect_assigned_lines() {
+        vector<LineSegment> assigned;
         for (int i = 0; i < succ_.size(); ++i) {
-            if (!assigned_collected_[i] && succ_[i].assigned()) {
-                assigned_collected_[i] = true;
-                const LineSegment &line = instance_->line(i, succ_[i].val());
-                assigned_out_[line.start_id()].emplace(line);
-                assigned_in_[line.end_id()].emplace(line);
+            if (assigned_succ_[i] == -1 && succ_[i].assigned()) {
+                assigned_succ_[i] = succ_[i].val();
+                assigned_pred_[succ_[i].val()] = i;
+            }
+            if (assigned_succ_[i] != -1) {
+                assigned.emplace_back(instance_->line(i, assigned_succ_[i]));
             }
         }
+        return assigned;
     }
 
     int choose_excluded_node() {
+        // Keep the node from the last propagation while possible, so that the spanning tree can be repaired
+        if (excluded_node_ != -1 && assigned_succ_[excluded_node_] == -1 && assigned_pred_[excluded_node_] == -1) {
+            return excluded_node_;
+        }
+
         // Just grabs the first available without any mandatory edges
         for (int i = 0; i < succ_.size(); ++i) {
-            if (!assigned_out_[i].has_value() && !assigned_in_[i].has_value()) {
+            if (assigned_succ_[i] == -1 && assigned_pred_[i] == -1) {
                 return i;
             }
         }
@@ -145,7 +153,7 @@ public:
         // If all nodes have some mandatory edge, then choose the first non-assigned
         for (int i = 0; i < succ_.size(); ++i) {
             if (!succ_[i].assigned()) {
-                assert(assigned_out_[i].has_value() != assigned_in_[i].has_value());
+                assert((assigned_succ_[i] == -1) != (assigned_pred_[i] == -1));
                 return i;
             }
         }
@@ -153,46 +161,104 @@ public:
         GECODE_NEVER;
     }
 
-    OneTree make_one_tree() {
-        const vector<LineSegment> &mandatory = flatten(assigned_out_);
+    /// Set lines_ to all the edges still possible for the non-assigned nodes.
+    void collect_domain_lines() {
+        lines_.clear();
+        for (int start = 0; start < succ_.size(); ++start) {
+            if (!succ_[start].assigned()) {
+                Int::ViewValues iv(succ_[start]);
+                while (iv()) {
+                    int end = iv.val();
+                    lines_.emplace_back(instance_->line(start, end));
+                    ++iv;
+                }
+            }
+        }
+    }
+
+    /**
+     * Lower bound for the tour cost, and the 1-tree it is based on, or nothing if there is no 1-tree.
+     *
+     * The 1-tree is a minimum 1-tree over the edges of the current domains, which are left in lines_.
+     */
+    std::optional<std::pair<int, OneTree>> make_one_tree(const vector<LineSegment> &mandatory) {
         const int excluded_node = choose_excluded_node();
+        excluded_node_ = excluded_node;
+
+        collect_domain_lines();
+
+        if (options_.iterations > 0) {
+            PathTimer::Scope timer(bound_timers().held_karp);
+            // The potentials are only valid as a bound for the edges they were computed with, so the actual domains
+            // are used instead of the candidate graph
+            const int iterations = potentials_ == nullptr ? options_.iterations : options_.warm_iterations;
+            vector<double> potentials;
+            if (potentials_ != nullptr) {
+                // Take the potentials over unless a copy of the space still shares them
+                potentials = potentials_.use_count() == 1 ? std::move(*potentials_) : *potentials_;
+            }
+            // Prim over the domain edges picks the dense or the heap variant from the number of edges
+            const AdjacencyGraph graph(succ_.size(), lines_);
+            auto held_karp = held_karp_1_tree(succ_.size(), excluded_node, mandatory, graph,
+                                              cost_.max(), std::move(potentials), iterations, options_);
+            if (!held_karp.has_value()) {
+                potentials_.reset();
+                return std::nullopt;
+            }
+            potentials_ = make_shared<vector<double>>(std::move(held_karp->potentials));
+            return std::make_pair(held_karp->bound, std::move(held_karp->one_tree));
+        }
 
-        unsigned int dom_sum = 0;
-        for (const auto &node : succ_) {
-            dom_sum += node.size();
+        PathTimer::Scope timer(bound_timers().one_tree);
+        // Only the domain edges are needed for repairing the tree, which is much less than all edges deep in the search
+        sorter_.sort_by_length(lines_);
+        // An edge is possible if it is possible in either direction
+        const auto possible = [&](const LineSegment &edge) {
+            // This is a O(n) operation in the worst case, but as long as most variables are ranges it is quick, since
+            // the n here is the number of ranges in the variable, not the domain size
+            return succ_[edge.start_id()].in(edge.end_id()) || succ_[edge.end_id()].in(edge.start_id());
+        };
+        if (mst_.use_count() > 1) {
+            mst_ = make_shared<IncrementalMST>(*mst_);
         }
-        // Magic number for when to use all edges vs collect current - value from tests using berlin52.tsp.
-        if (dom_sum > 0.25 * (succ_.size() * succ_.size())) {
-            return kruskal_1_tree(succ_.size(),
-                                  excluded_node,
-                                  mandatory,
-                                  instance_->lines_length_ordered(),
-                                  [&](const LineSegment &edge) {
-                                      // This is a O(n) operation in the worst case, but as long as most variables are ranges it is quick, since
-                                      // the n here is the number of ranges in the variable, not the domain size
-                                      return succ_[edge.start_id()].in(edge.end_id());
-                                  });
-        } else {
-            std::vector<LineSegment> lines;
-            for (int start = 0; start < succ_.size(); ++start) {
-                if (!succ_[start].assigned()) {
-                    Int::ViewValues iv(succ_[start]);
-                    while (iv()) {
-                        int end = iv.val();
-                        lines.emplace_back(instance_->line(start, end));
-                        ++iv;
-                    }
-                }
-            }
-            std::sort(lines.begin(), lines.end(), [](LineSegment& a, LineSegment& b){
-                return a.length() < b.length();
+        const MST &mst = mst_->update(succ_.size(), excluded_node, mandatory, lines_, possible);
+        if (mst.edges().size() + 2 < static_cast<size_t>(succ_.size())) {
+            // The possible edges do not connect the nodes
+            return std::nullopt;
+        }
+
+        // The mandatory edges at the excluded node, and then the shortest other edges
+        std::vector<LineSegment> extra_edges;
+        if (assigned_pred_[excluded_node] != -1) {
+            extra_edges.emplace_back(instance_->line(assigned_pred_[excluded_node], excluded_node));
+        }
+        if (assigned_succ_[excluded_node] != -1) {
+            extra_edges.emplace_back(instance_->line(excluded_node, assigned_succ_[excluded_node]));
+        }
+        const auto is_extra = [&](int other) {
+            return std::any_of(extra_edges.begin(), extra_edges.end(), [&](const LineSegment &edge) {
+                return edge.id_not(excluded_node) == other;
             });
-            return kruskal_1_tree(succ_.size(),
-                                  excluded_node,
-                                  mandatory,
-                                  instance_->lines_length_ordered(),
-                                  [&](const LineSegment &edge) { return true; });
+        };
+        std::vector<LineSegment> other_edges;
+        for (int other = 0; other < succ_.size(); ++other) {
+            if (other != excluded_node && !is_extra(other) &&
+                (succ_[excluded_node].in(other) || succ_[other].in(excluded_node))) {
+                other_edges.emplace_back(instance_->line(excluded_node, other));
+            }
         }
+        const size_t needed = 2 - std::min<size_t>(extra_edges.size(), 2);
+        if (other_edges.size() < needed) {
+            return std::nullopt;
+        }
+        std::partial_sort(other_edges.begin(), other_edges.begin() + needed, other_edges.end(),
+                          [](const LineSegment &a, const LineSegment &b) {
+                              return a.length() < b.length();
+                          });
+        extra_edges.insert(extra_edges.end(), other_edges.begin(), other_edges.begin() + needed);
+        OneTree one_tree(succ_.size(), excluded_node, std::make_pair(extra_edges[0], extra_edges[1]), mst.edges());
+        const int bound = one_tree.size();
+        return std::make_pair(bound, std::move(one_tree));
     }
 
 // propagation
@@ -203,10 +269,14 @@ public:
             return home.ES_SUBSUMED(*this);
         }
 
-        collect_assigned_lines();
-        OneTree one_tree = make_one_tree();
+        const vector<LineSegment> mandatory = collect_assigned_lines();
+        auto bound_and_tree = make_one_tree(mandatory);
+        if (!bound_and_tree.has_value()) {
+            return ES_FAILED;
+        }
+        const auto &[bound, one_tree] = bound_and_tree.value();
 
-        GECODE_ME_CHECK(cost_.gq(home, one_tree.size()));
+        GECODE_ME_CHECK(cost_.gq(home, bound));
 
         bool is_circuit = true;
         for (int i = 0; i < succ_.size(); ++i) {
@@ -234,6 +304,12 @@ public:
             return home.ES_SUBSUMED(*this);
         }
 
+        // Remove the edges that would make the 1-tree bound exceed the cost when forced into the 1-tree
+        for (const auto &edge : one_tree_excluded_edges(one_tree, potentials_ != nullptr ? *potentials_ : vector<double>(), mandatory, lines_, cost_.max())) {
+            GECODE_ME_CHECK(succ_[edge.start_id()].nq(home, edge.end_id()));
+            GECODE_ME_CHECK(pred_[edge.end_id()].nq(home, edge.start_id()));
+        }
+
         int degree = 2;
         int start_node = -1;
         int end_node = -1;
@@ -261,12 +337,12 @@ public:
 };
 
 namespace hc {
-    void hk_1tree(Home home, std::shared_ptr<const TSPInstance> instance, const IntVarArgs& successors_var,  const IntVarArgs& predecessors_var, const IntVar cost_var) {
+    void hk_1tree(Home home, std::shared_ptr<const TSPInstance> instance, const IntVarArgs& successors_var,  const IntVarArgs& predecessors_var, const IntVar cost_var, const HeldKarpOptions& options) {
         ViewArray<Int::IntView> successors(home, successors_var);
         ViewArray<Int::IntView> predecessors(home, predecessors_var);
         Int::IntView cost(cost_var);
 
-        if (HKOneTreePropagator::post(home, successors, predecessors, cost, std::move(instance)) != ES_OK) {
+        if (HKOneTreePropagator::post(home, successors, predecessors, cost, std::move(instance), options) != ES_OK) {
             home.fail();
         }
     }
@@ -4,21 +4,24 @@
 #include <utility>
 #include <utilities/tsp.h>
 
+#include "assigned_nodes.h"
+
 using namespace hc;
 using namespace Gecode;
 using namespace std;
 
-typedef NaryPropagator<Int::IntView, Int::PC_INT_VAL> NaryBase;
-
-class NoDominatedEdgePairs : public NaryBase {
+class NoDominatedEdgePairs : public Propagator {
 protected:
-    using NaryBase::x;
+    ViewArray<Int::IntView> x;
     shared_ptr<const TSPInstance> instance_;
-    vector<bool> propagated_;
+    /// The nodes with assigned successors, found by advisors so that only the changes are looked at
+    AssignedNodes assigned_;
+    /// The number of nodes in assigned_ whose dominated edges have been removed
+    int propagated_;
 public:
     // posting
     NoDominatedEdgePairs(Space &home, ViewArray<Int::IntView>& successors, shared_ptr<const TSPInstance> instance)
-            : NaryPropagator(home, successors), instance_(std::move(instance)), propagated_(x.size(), false) {
+            : Propagator(home), x(successors), instance_(std::move(instance)), assigned_(home, *this, x), propagated_(0) {
         home.notice(*this, AP_WEAKLY);
         home.notice(*this, AP_DISPOSE);
     }
@@ -27,11 +30,8 @@ public:
                            ViewArray<Int::IntView>& successors,
                            shared_ptr<const TSPInstance> instance) {
         auto *propagator = new(home) NoDominatedEdgePairs(home, successors, std::move(instance));
-        for (const auto &successor : successors) {
-            if (successor.assigned()) {
-                Int::IntView::schedule(home, *propagator, Int::ME_INT_VAL);
-                break;
-            }
+        if (propagator->assigned_.size() > 0) {
+            Int::IntView::schedule(home, *propagator, Int::ME_INT_VAL);
         }
         return ES_OK;
     }
@@ -40,15 +40,16 @@ public:
     size_t dispose(Space &home) override {
         home.ignore(*this, AP_DISPOSE);
         home.ignore(*this, AP_WEAKLY);
+        assigned_.dispose(home);
         instance_.~shared_ptr();
-        propagated_.~vector();
-        (void) NaryPropagator::dispose(home);
+        (void) Propagator::dispose(home);
         return sizeof(*this);
     }
 
     // copying
     NoDominatedEdgePairs(Space &home, NoDominatedEdgePairs &p)
-            : NaryBase(home, p), instance_(p.instance_), propagated_(p.propagated_) {
+            : Propagator(home, p), instance_(p.instance_), assigned_(home, p.assigned_, p.x.size()), propagated_(p.propagated_) {
+        x.update(home, p.x);
     }
 
     Propagator *copy(Space &home) override {
@@ -57,36 +58,43 @@ public:
 
     // cost computation
     [[nodiscard]] PropCost cost(const Space &, const ModEventDelta &) const override {
-        return PropCost::quadratic(PropCost::Mod::LO, x.size());
+        return PropCost::linear(PropCost::Mod::LO, assigned_.size() - propagated_);
     }
 
-    // // re-scheduling
-    //void reschedule(Space &home) override {
-    //}
+    // re-scheduling
+    void reschedule(Space &home) override {
+        if (propagated_ < assigned_.size()) {
+            Int::IntView::schedule(home, *this, Int::ME_INT_VAL);
+        }
+    }
+
+    // advising
+    ExecStatus advise(Space &home, Advisor &advisor, const Delta &) override {
+        return assigned_.advise(home, advisor);
+    }
 
     // propagation
     ExecStatus propagate(Space &home, const ModEventDelta &) override {
-        DominatedEdges &edges = instance_->dominated_edges();
-
-        for (int i = 0; i < x.size(); ++i) {
-            if (!propagated_[i]) {
-                if (x[i].assigned()) {
-                    const vector<Edge> &dominated_edges = edges.dominated(Edge(i, x[i].val()));
-                    for (const auto &dominated_edge : dominated_edges) {
-                        GECODE_ME_CHECK(x[dominated_edge.from()].nq(home, dominated_edge.to()));
-                    }
-
-                    propagated_[i] = true;
-                }
+        // Only the nodes assigned since the last propagation
+        for (; propagated_ < assigned_.size(); ++propagated_) {
+            const int i = assigned_[propagated_];
+            // Computed for this edge only, unless all dominated edges have been computed
+            const DominatedEdges::DirectedRange dominated_edges = instance_->dominated(Edge(i, x[i].val()));
+            for (const Edge dominated_edge : dominated_edges) {
+                GECODE_ME_CHECK(x[dominated_edge.from()].nq(home, dominated_edge.to()));
             }
         }
-        
+
         return ES_FIX;
     }
 };
 
 namespace hc {
     void no_dominated_edge_pairs(Home home, std::shared_ptr<const hc::TSPInstance> instance, const Gecode::IntVarArgs& args) {
+        if (!instance->has_embedding()) {
+            // Crossing edges are only meaningful for locations in the plane
+            return;
+        }
         ViewArray<Int::IntView> successors(home, args);
 
         if (NoDominatedEdgePairs::post(home, successors, std::move(instance)) != ES_OK) {
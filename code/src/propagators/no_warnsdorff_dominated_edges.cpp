@@ -1,32 +1,40 @@
 #include <memory>
+#include <optional>
 
 #include <gecode/int.hh>
 #include <utility>
 #include <utilities/tsp.h>
+#include <utilities/segment_grid.h>
+
+#include "assigned_nodes.h"
 
 using namespace hc;
 using namespace Gecode;
 using namespace std;
 
-typedef NaryPropagator<Int::IntView, Int::PC_INT_VAL> NaryBase;
-
-class NoWarnsdorffDominatedEdges2 : public NaryBase {
+class NoWarnsdorffDominatedEdges : public Propagator {
 protected:
-    using NaryBase::x;
+    ViewArray<Int::IntView> x;
     shared_ptr<const TSPInstance> instance_;
     int start_node_;
     int current_node_index_;
-    vector<bool> assigned_line_collected_;
-    vector<LineSegment> assigned_lines_;
+    /// The nodes with assigned successors, found by advisors so that only the changes are looked at
+    AssignedNodes assigned_;
+    /// Index of the assigned lines, built from assigned_ when first needed in each copy
+    std::optional<SegmentGrid> grid_;
+    /// The number of nodes in assigned_ whose lines are in grid_
+    int indexed_;
 public:
     // posting
-    NoWarnsdorffDominatedEdges2(Space &home, ViewArray<Int::IntView>& successors, int start_node, shared_ptr<const TSPInstance> instance)
-            : NaryPropagator(home, successors), 
+    NoWarnsdorffDominatedEdges(Space &home, ViewArray<Int::IntView>& successors, int start_node, shared_ptr<const TSPInstance> instance)
+            : Propagator(home),
+              x(successors),
               instance_(std::move(instance)), 
               start_node_(start_node), 
               current_node_index_(start_node), 
-              assigned_line_collected_(x.size(), false), 
-              assigned_lines_() {
+              assigned_(home, *this, x),
+              grid_(),
+              indexed_(0) {
         home.notice(*this, AP_WEAKLY);
         home.notice(*this, AP_DISPOSE);
     }
@@ -35,12 +43,9 @@ public:
                            ViewArray<Int::IntView>& successors,
                            int start_node,
                            shared_ptr<const TSPInstance> instance) {
-        auto *propagator = new(home) NoWarnsdorffDominatedEdges2(home, successors, start_node, std::move(instance));
-        for (const auto &successor : successors) {
-            if (successor.assigned()) {
-                Int::IntView::schedule(home, *propagator, Int::ME_INT_VAL);
-                break;
-            }
+        auto *propagator = new(home) NoWarnsdorffDominatedEdges(home, successors, start_node, std::move(instance));
+        if (propagator->assigned_.size() > 0) {
+            Int::IntView::schedule(home, *propagator, Int::ME_INT_VAL);
         }
         return ES_OK;
     }
@@ -49,25 +54,27 @@ public:
     size_t dispose(Space &home) override {
         home.ignore(*this, AP_DISPOSE);
         home.ignore(*this, AP_WEAKLY);
+        assigned_.dispose(home);
         instance_.~shared_ptr();
-        assigned_line_collected_.~vector();
-        assigned_lines_.~vector();
-        (void) NaryPropagator::dispose(home);
+        grid_.~optional();
+        (void) Propagator::dispose(home);
         return sizeof(*this);
     }
 
     // copying
-    NoWarnsdorffDominatedEdges2(Space &home, NoWarnsdorffDominatedEdges2 &p)
-            : NaryBase(home, p),
+    NoWarnsdorffDominatedEdges(Space &home, NoWarnsdorffDominatedEdges &p)
+            : Propagator(home, p),
               instance_(p.instance_),
               start_node_(p.start_node_),
               current_node_index_(p.current_node_index_),
-              assigned_line_collected_(p.assigned_line_collected_),
-              assigned_lines_(p.assigned_lines_) {
+              assigned_(home, p.assigned_, p.x.size()),
+              grid_(),
+              indexed_(0) {
+        x.update(home, p.x);
     }
 
     Propagator *copy(Space &home) override {
-        return new(home) NoWarnsdorffDominatedEdges2(home, *this);
+        return new(home) NoWarnsdorffDominatedEdges(home, *this);
     }
 
     // cost computation
@@ -75,12 +82,26 @@ public:
         return PropCost::crazy(PropCost::Mod::HI, x.size());
     }
 
-    void collect_assigned_lines() {
-        for (int i = 0; i < x.size(); ++i) {
-            if (!assigned_line_collected_[i] && x[i].assigned()) {
-                assigned_line_collected_[i] = true;
-                assigned_lines_.emplace_back(instance_->line(i, x[i].val()));
-            }
+    // re-scheduling
+    void reschedule(Space &home) override {
+        if (assigned_.size() > 0) {
+            Int::IntView::schedule(home, *this, Int::ME_INT_VAL);
+        }
+    }
+
+    // advising
+    ExecStatus advise(Space &home, Advisor &advisor, const Delta &) override {
+        return assigned_.advise(home, advisor);
+    }
+
+    void index_assigned_lines() {
+        if (!grid_.has_value()) {
+            grid_.emplace(instance_->bounds(), x.size());
+            indexed_ = 0;
+        }
+        for (; indexed_ < assigned_.size(); ++indexed_) {
+            const int node = assigned_[indexed_];
+            grid_->insert(node, instance_->line(node, x[node].val()).bounding_box());
         }
     }
 
@@ -95,12 +116,12 @@ public:
 
     // propagation
     ExecStatus propagate(Space &home, const ModEventDelta &) override {
-        if (x.assigned()) {
+        if (assigned_.size() == x.size()) {
             // No need to remove anything for assignments,
             // checking is handled by the circuit propagator
             return home.ES_SUBSUMED(*this);
         }
-        collect_assigned_lines();
+        index_assigned_lines();
         advance_current_node();
         Int::IntView &current_node = x[current_node_index_];
         if (current_node.assigned()) {
@@ -114,15 +135,16 @@ public:
         Int::ViewValues<Gecode::Int::IntView> iv(current_node);
         while (iv()) {
             const int next_node = iv.val();
-            LineSegment line = instance_->line(current_node_index_, next_node);
-            for (const auto & other_line : assigned_lines_) {
+            const LineSegment line = instance_->line(current_node_index_, next_node);
+            // Only the assigned lines with overlapping bounding boxes can cross the line
+            const bool crosses = grid_->any_of(line.bounding_box(), [&](int other_node) {
+                const LineSegment other_line = instance_->line(other_node, x[other_node].val());
                 const bool lines_not_connected = line.start_id() != other_line.end_id() &&
                                                  line.end_id() != other_line.start_id();
-                if (lines_not_connected &&
-                    intersects(line, other_line)) {
-                    to_remove[to_remove_count++] = next_node;
-                    break;
-                }
+                return lines_not_connected && intersects(line, other_line);
+            });
+            if (crosses) {
+                to_remove[to_remove_count++] = next_node;
             }
             ++iv;
         }
@@ -143,9 +165,13 @@ public:
 
 namespace hc {
     void no_warnsdorff_dominated_edges(Home home, std::shared_ptr<const hc::TSPInstance> instance, int start_node, const Gecode::IntVarArgs& args) {
+        if (!instance->has_embedding()) {
+            // Crossing edges are only meaningful for locations in the plane
+            return;
+        }
         ViewArray<Int::IntView> successors(home, args);
 
-        if (NoWarnsdorffDominatedEdges2::post(home, successors, start_node, std::move(instance)) != ES_OK) {
+        if (NoWarnsdorffDominatedEdges::post(home, successors, start_node, std::move(instance)) != ES_OK) {
             home.fail();
         }
     }
@@ -4,17 +4,70 @@
 #include <gecode/driver.hh>
 #include <gecode/int.hh>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <cassert>
 #include <optional>
 #include <utilities/tsp.h>
+#include <utilities/graph.h>
 
 namespace hc {
 
+    /// Number of calls and total time for one way of computing a bound, summed over all propagators and threads
+    class PathTimer {
+        std::atomic<long long> calls_{0};
+        std::atomic<long long> nanoseconds_{0};
+    public:
+        /// Adds the time from construction to destruction to the timer
+        class Scope {
+            PathTimer &timer_;
+            std::chrono::steady_clock::time_point start_;
+        public:
+            explicit Scope(PathTimer &timer) : timer_(timer), start_(std::chrono::steady_clock::now()) {}
+
+            ~Scope() {
+                const auto duration = std::chrono::steady_clock::now() - start_;
+                timer_.calls_ += 1;
+                timer_.nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            }
+        };
+
+        [[nodiscard]] long long calls() const {
+            return calls_;
+        }
+
+        [[nodiscard]] double milliseconds() const {
+            return static_cast<double>(nanoseconds_) / 1e6;
+        }
+    };
+
+    /// Timers for the ways the bounding propagators compute their bounds
+    struct BoundTimers {
+        /// Held-Karp bound over the domain edges in the one tree propagator
+        PathTimer held_karp;
+        /// Plain 1-tree from the repaired spanning tree in the one tree propagator
+        PathTimer one_tree;
+        /// Christofides with the candidate graph for matching, for large domains
+        PathTimer christofides_candidates;
+        /// Christofides with the domain edges for matching, for small domains
+        PathTimer christofides_domains;
+        /// Local search improving the Christofides tour
+        PathTimer christofides_local_search;
+    };
+
+    /// The timers shared by all bounding propagators
+    inline BoundTimers &bound_timers() {
+        static BoundTimers timers;
+        return timers;
+    }
+
     /**
      * Remove all edges that are dominated by another assigned edge.
      *
+     * Domination is based on crossing edges, so nothing is posted for instances without locations in the plane.
+     *
      * @param home Space to post in
      * @param instance The TSP instance to remove dominated edges
      * @param successors The variables representing the circuit
@@ -25,6 +78,8 @@ namespace hc {
      * Following the "Warnsdorff path" (i.e., the assgined path form a specified start-node), remove all edges from
      * the final node that crosses another assigned edge.
      *
+     * Nothing is posted for instances without locations in the plane.
+     *
      * @param home Space to post in
      * @param instance The TSP instance describing the problem
      * @param start_node The node to start the path from
@@ -36,6 +91,8 @@ namespace hc {
      * Following the "Warnsdorff path" (i.e., the assgined path form a specified start-node), remove all edges from
      * the final node that crosses another assigned edge.
      *
+     * Nothing is posted for instances without locations in the plane.
+     *
      * @param home Space to post in
      * @param instance The TSP instance describing the problem
      * @param start_node The node to start the path from
@@ -43,9 +100,40 @@ namespace hc {
      */
     void no_warnsdorff_dominated_edges2(Gecode::Home home, std::shared_ptr<const hc::TSPInstance> instance, int start_node, const Gecode::IntVarArgs& successors);
 
-    void hk_1tree(Gecode::Home home, std::shared_ptr<const TSPInstance> instance, const Gecode::IntVarArgs& successors, const Gecode::IntVarArgs& predeccesors, const Gecode::IntVar cost);
+    /**
+     * Bound the cost of the circuit using 1-trees, with node potentials from Held-Karp subgradient optimisation.
+     *
+     * The potentials giving the best bound are kept and used as the starting point in later propagations, including in
+     * copies. With zero iterations in \a options, the plain minimum 1-tree bound is used.
+     *
+     * Edges whose replacement cost in the 1-tree would take the bound above the maximum cost are removed.
+     *
+     * @param home Space to post in
+     * @param instance The TSP instance describing the problem
+     * @param successors The variables representing the circuit
+     * @param predeccesors The inverse of the successors
+     * @param cost The cost of the circuit
+     * @param options Parameters for the subgradient optimisation
+     */
+    void hk_1tree(Gecode::Home home, std::shared_ptr<const TSPInstance> instance, const Gecode::IntVarArgs& successors, const Gecode::IntVarArgs& predeccesors, const Gecode::IntVar cost, const HeldKarpOptions& options = HeldKarpOptions());
+
+    /// Default fraction of all edges in the domains above which the Christofides tree is built from the candidate graph
+    constexpr double christofides_candidate_density = 0.25;
 
-    void christofides(Gecode::Home home, std::shared_ptr<const TSPInstance> instance, const Gecode::IntVarArgs& successors, const Gecode::IntVar cost);
+    /**
+     * Bound the cost of the circuit from above by a Christofides tour, improved by local search using only edges in
+     * the domains of the successors.
+     *
+     * @param home Space to post in
+     * @param instance The TSP instance describing the problem
+     * @param successors The variables representing the circuit
+     * @param cost The cost of the circuit
+     * @param options Limits for the local search
+     * @param candidate_density Fraction of all edges in the domains above which the spanning tree and matching use the
+     *                          candidate graph, falling back to the domain edges when it is disconnected
+     */
+    void christofides(Gecode::Home home, std::shared_ptr<const TSPInstance> instance, const Gecode::IntVarArgs& successors, const Gecode::IntVar cost, const LocalSearchOptions& options = LocalSearchOptions(),
+                      double candidate_density = christofides_candidate_density);
 }
 
 #endif //HC_PROPAGATORS_LIB_H
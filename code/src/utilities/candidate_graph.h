@@ -0,0 +1,228 @@
+#ifndef HC_CANDIDATE_GRAPH_H
+#define HC_CANDIDATE_GRAPH_H
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "utilities/geometry.h"
+#include "utilities/distances.h"
+#include "utilities/kd_tree.h"
+
+namespace hc {
+    /**
+     * Sparse graph of candidate edges, using the k nearest neighbours and the nearest neighbours in each
+     * quadrant around every location.
+     *
+     * The graph is symmetric (if j is a candidate for i, then i is a candidate for j), and the neighbours of each
+     * location are ordered by length. The quadrant neighbours make sure that clustered instances still get edges
+     * between the clusters, so the candidate graph almost always contains a minimum spanning tree.
+     *
+     * Without an embedding in the plane, the same number of nearest neighbours by length is used instead.
+     */
+    class CandidateGraph {
+        /// The neighbours of node i are neighbours_[offsets_[i]] to neighbours_[offsets_[i + 1] - 1]
+        std::vector<int> offsets_;
+        std::vector<int> neighbours_;
+        /// All candidate edges in both directions, ordered by length
+        std::vector<LineSegment> edges_;
+        bool connected_;
+
+        static bool in_quadrant(int quadrant, long long dx, long long dy) {
+            switch (quadrant) {
+                case 0: return dx > 0 && dy >= 0;
+                case 1: return dx <= 0 && dy > 0;
+                case 2: return dx < 0 && dy <= 0;
+                default: return dx >= 0 && dy < 0;
+            }
+        }
+
+        static bool may_intersect_quadrant(int quadrant, int x, int y, int min_x, int min_y, int max_x, int max_y) {
+            switch (quadrant) {
+                case 0: return max_x > x && max_y >= y;
+                case 1: return min_x <= x && max_y > y;
+                case 2: return min_x < x && min_y <= y;
+                default: return max_x >= x && min_y < y;
+            }
+        }
+
+        static bool compute_connected(const std::vector<int> &offsets, const std::vector<int> &neighbours) {
+            const int nodes = static_cast<int>(offsets.size()) - 1;
+            if (nodes <= 1) {
+                return true;
+            }
+            std::vector<bool> seen(nodes, false);
+            std::vector<int> stack{0};
+            seen[0] = true;
+            int seen_count = 1;
+            while (!stack.empty()) {
+                const int node = stack.back();
+                stack.pop_back();
+                for (int i = offsets[node]; i < offsets[node + 1]; ++i) {
+                    const int neighbour = neighbours[i];
+                    if (!seen[neighbour]) {
+                        seen[neighbour] = true;
+                        ++seen_count;
+                        stack.emplace_back(neighbour);
+                    }
+                }
+            }
+            return seen_count == nodes;
+        }
+
+        /// Nearest and quadrant neighbours using the coordinates, the neighbour lists may contain duplicates
+        static std::vector<std::vector<int>> geometric_candidates(const DistanceOracle &distances,
+                                                                  int nearest, int quadrant_nearest) {
+            const std::vector<int> &xs = distances.xs();
+            const std::vector<int> &ys = distances.ys();
+            const KdTree tree(xs, ys);
+
+            std::vector<std::vector<int>> candidates(distances.size());
+            for (int node = 0; node < distances.size(); ++node) {
+                const int x = xs[node];
+                const int y = ys[node];
+                const auto add = [&](const std::vector<int> &found) {
+                    for (int neighbour : found) {
+                        candidates[node].emplace_back(neighbour);
+                        candidates[neighbour].emplace_back(node);
+                    }
+                };
+                add(tree.nearest(x, y, nearest, [&](int other) { return other != node; }));
+                for (int quadrant = 0; quadrant < 4; ++quadrant) {
+                    add(tree.nearest(x, y, quadrant_nearest,
+                                     [&](int other) {
+                                         return in_quadrant(quadrant,
+                                                            static_cast<long long>(xs[other]) - x,
+                                                            static_cast<long long>(ys[other]) - y);
+                                     },
+                                     [&](int min_x, int min_y, int max_x, int max_y) {
+                                         return may_intersect_quadrant(quadrant, x, y, min_x, min_y, max_x, max_y);
+                                     }));
+                }
+            }
+            return candidates;
+        }
+
+        /// Nearest neighbours by length without an embedding, scanning all lengths
+        static std::vector<std::vector<int>> nearest_candidates(const DistanceOracle &distances, int nearest) {
+            const int nodes = distances.size();
+            std::vector<std::vector<int>> candidates(nodes);
+            std::vector<std::pair<int, int>> row;
+            row.reserve(nodes);
+            for (int node = 0; node < nodes; ++node) {
+                row.clear();
+                for (int other = 0; other < nodes; ++other) {
+                    if (other != node) {
+                        row.emplace_back(distances.length(node, other), other);
+                    }
+                }
+                const std::size_t count = std::min<std::size_t>(nearest, row.size());
+                std::nth_element(row.begin(), row.begin() + count, row.end());
+                for (std::size_t i = 0; i < count; ++i) {
+                    candidates[node].emplace_back(row[i].second);
+                    candidates[row[i].second].emplace_back(node);
+                }
+            }
+            return candidates;
+        }
+
+    public:
+        /// The default number of nearest neighbours per location
+        static constexpr int default_nearest = 10;
+        /// The default number of nearest neighbours per quadrant and location
+        static constexpr int default_quadrant_nearest = 2;
+
+        /**
+         * @param distances The distances to use
+         * @param nearest The number of nearest neighbours to use for each location
+         * @param quadrant_nearest The number of nearest neighbours to use in each quadrant around each location
+         */
+        explicit CandidateGraph(const DistanceOracle &distances,
+                                int nearest = default_nearest,
+                                int quadrant_nearest = default_quadrant_nearest)
+                : offsets_(), neighbours_(), edges_(), connected_(false) {
+            const int nodes = distances.size();
+            std::vector<std::vector<int>> candidates = distances.has_embedding()
+                    ? geometric_candidates(distances, nearest, quadrant_nearest)
+                    : nearest_candidates(distances, nearest + 4 * quadrant_nearest);
+
+            offsets_.reserve(nodes + 1);
+            offsets_.emplace_back(0);
+            for (int node = 0; node < nodes; ++node) {
+                auto &node_candidates = candidates[node];
+                std::sort(node_candidates.begin(), node_candidates.end());
+                node_candidates.erase(std::unique(node_candidates.begin(), node_candidates.end()),
+                                      node_candidates.end());
+                std::sort(node_candidates.begin(), node_candidates.end(), [&](int a, int b) {
+                    const int length_a = distances.length(node, a);
+                    const int length_b = distances.length(node, b);
+                    return length_a < length_b || (length_a == length_b && a < b);
+                });
+                neighbours_.insert(neighbours_.end(), node_candidates.begin(), node_candidates.end());
+                offsets_.emplace_back(neighbours_.size());
+                std::vector<int>().swap(node_candidates);
+            }
+
+            edges_.reserve(neighbours_.size());
+            for (int node = 0; node < nodes; ++node) {
+                for (int i = offsets_[node]; i < offsets_[node + 1]; ++i) {
+                    edges_.emplace_back(distances.line(node, neighbours_[i]));
+                }
+            }
+            std::stable_sort(edges_.begin(), edges_.end(), [](const LineSegment &a, const LineSegment &b) {
+                return a.length() < b.length();
+            });
+
+            connected_ = compute_connected(offsets_, neighbours_);
+        }
+
+        /**
+         * Candidate graph from previously computed neighbours, for example when loaded from a file.
+         *
+         * @param offsets The neighbours of node i are neighbours[offsets[i]] to neighbours[offsets[i + 1] - 1]
+         * @param neighbours The neighbours of each node, ordered by length
+         * @param edges The start and end of all the candidate edges in both directions, ordered by length
+         */
+        CandidateGraph(const DistanceOracle &distances,
+                       std::vector<int> offsets,
+                       std::vector<int> neighbours,
+                       const std::vector<std::pair<int, int>> &edges)
+                : offsets_(std::move(offsets)), neighbours_(std::move(neighbours)), edges_(), connected_(false) {
+            assert(offsets_.size() == static_cast<std::size_t>(distances.size()) + 1);
+            assert(edges.size() == neighbours_.size());
+            edges_.reserve(edges.size());
+            for (const auto &[start, end] : edges) {
+                edges_.emplace_back(distances.line(start, end));
+            }
+            connected_ = compute_connected(offsets_, neighbours_);
+        }
+
+        [[nodiscard]] int size() const {
+            return static_cast<int>(offsets_.size()) - 1;
+        }
+
+        /// The candidate neighbours of \a node, ordered by length, as a pair of pointers [begin, end)
+        [[nodiscard]] std::pair<const int *, const int *> neighbours(int node) const {
+            assert(0 <= node && node < size());
+            return std::make_pair(neighbours_.data() + offsets_[node], neighbours_.data() + offsets_[node + 1]);
+        }
+
+        /// The number of candidate neighbours of \a node
+        [[nodiscard]] int degree(int node) const {
+            return offsets_[node + 1] - offsets_[node];
+        }
+
+        /// All candidate edges, with both directions of each edge, ordered by length
+        [[nodiscard]] const std::vector<LineSegment> &edges() const {
+            return edges_;
+        }
+
+        /// True iff the candidate graph is connected (it may still become disconnected when edges are filtered)
+        [[nodiscard]] bool connected() const {
+            return connected_;
+        }
+    };
+}
+
+#endif //HC_CANDIDATE_GRAPH_H
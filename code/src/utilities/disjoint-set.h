@@ -49,17 +49,17 @@ namespace hc {
             set_count_ -= 1;
         }
 
-        /// Find set−head with path−compression
+        /// Find set−head with path−halving, making every other node on the path point to its grandparent
         [[nodiscard]] int find(int x) {
-            if (sets_[x] < 0) {
-                // Found a root
-                return x;
-            } else {
-                int x_root = find(sets_[x]);
-                // Compress path
-                sets_[x] = x_root;
-                return x_root;
+            while (sets_[x] >= 0) {
+                const int parent = sets_[x];
+                if (sets_[parent] < 0) {
+                    return parent;
+                }
+                sets_[x] = sets_[parent];
+                x = sets_[parent];
             }
+            return x;
         }
 
         /// The number of sets
@@ -72,7 +72,91 @@ namespace hc {
             return -sets_[find(x)];
         }
 
+        /// Make every one of the n elements a set of its own again, keeping the allocated memory
+        void reset(int n) {
+            sets_.assign(n, -1);
+            set_count_ = n;
+        }
+    };
+
+
+    /**
+     * Disjoint sets where joins can be undone, using union by size and no path compression so that finding a set
+     * takes O(log n) time.
+     *
+     * Each join is recorded in a log, and rolling back to an earlier size of the log undoes the joins since then in
+     * reverse order.
+     */
+    class RollbackUnionFind {
+        /// As in UnionFind, negative sizes for roots and parent pointers for other elements
+        std::vector<int> sets_;
+        /// The root that was joined into another root by each join, in order, and its negated size at the time
+        std::vector<std::pair<int, int>> log_;
+
+        int set_count_;
+    public:
+        /// Create RollbackUnionFind-structure for n elements
+        explicit RollbackUnionFind(int n)
+                : set_count_(n) {
+            sets_.assign(n, -1);
+        }
+
+        /// Find set-head
+        [[nodiscard]] int find(int x) const {
+            while (sets_[x] >= 0) {
+                x = sets_[x];
+            }
+            return x;
+        }
+
+        /// True iff a and b are in the same set
+        [[nodiscard]] bool same_set(int a, int b) const {
+            return find(a) == find(b);
+        }
+
+        /// Join the sets for a and b, returns false if they already were the same set
+        bool join(int a, int b) {
+            int root_a = find(a);
+            int root_b = find(b);
+            if (root_a == root_b) {
+                return false;
+            }
+            if (sets_[root_a] > sets_[root_b]) {
+                // Swap so that root_a is the larger set
+                std::swap(root_a, root_b);
+            }
+            log_.emplace_back(root_b, sets_[root_b]);
+            sets_[root_a] += sets_[root_b];
+            sets_[root_b] = root_a;
+            set_count_ -= 1;
+            return true;
+        }
+
+        /// A point to roll back to, the number of joins made so far
+        [[nodiscard]] int checkpoint() const {
+            return static_cast<int>(log_.size());
+        }
+
+        /// Undo the joins made after \a checkpoint
+        void rollback(int checkpoint) {
+            while (static_cast<int>(log_.size()) > checkpoint) {
+                const auto [root_b, size_b] = log_.back();
+                log_.pop_back();
+                sets_[sets_[root_b]] -= size_b;
+                sets_[root_b] = size_b;
+                set_count_ += 1;
+            }
+        }
+
+        /// The number of sets
+        [[nodiscard]] int set_count() const {
+            return set_count_;
+        }
 
+        /// The size of a set
+        [[nodiscard]] int set_size(int x) const {
+            return -sets_[find(x)];
+        }
     };
 
 }
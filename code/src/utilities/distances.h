@@ -0,0 +1,463 @@
+#ifndef HC_DISTANCES_H
+#define HC_DISTANCES_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "utilities/geometry.h"
+
+namespace hc {
+    /**
+     * A bounded, direct-mapped cache of symmetric lengths between nodes.
+     *
+     * Each slot holds a single 64-bit word packing the key and the length, so that lookups and updates are
+     * lock-free and safe to share between threads. A colliding entry simply replaces the old one.
+     *
+     * The keys are permuted, and the high bits of the permuted key choose the slot while the low bits are kept in
+     * the slot, so that the whole key is compared. There are at least enough slots for the low bits to fit in 31 bits.
+     */
+    class LengthCache {
+        std::unique_ptr<std::atomic<std::uint64_t>[]> slots_;
+        /// The number of bits of the keys, and of the part of them kept in the slots
+        unsigned int key_bits_;
+        unsigned int tag_bits_;
+
+        /// Key for the unordered pair a, b with a != b, using the position in the lower triangular matrix.
+        static std::uint64_t key(int a, int b) {
+            const std::uint64_t hi = std::max(a, b);
+            const std::uint64_t lo = std::min(a, b);
+            return hi * (hi - 1) / 2 + lo;
+        }
+
+        /// Permutation of the keys below 2^key_bits_, spreading consecutive keys over the slots
+        [[nodiscard]] std::uint64_t permute(std::uint64_t key) const {
+            // Multiplying by an odd number is invertible modulo a power of two (Fibonacci hashing)
+            return (key * 11400714819323198485ULL) & ((std::uint64_t(1) << key_bits_) - 1);
+        }
+
+        [[nodiscard]] std::atomic<std::uint64_t> &slot(std::uint64_t permuted) const {
+            return slots_[permuted >> tag_bits_];
+        }
+
+        /// The upper half of the slot word for \a permuted, 0 is left for empty slots
+        [[nodiscard]] std::uint64_t tag(std::uint64_t permuted) const {
+            return (permuted & ((std::uint64_t(1) << tag_bits_) - 1)) + 1;
+        }
+    public:
+        /**
+         * Create a cache with at least \a capacity slots (rounded up to a power of two) for lengths between \a nodes
+         * nodes, with more slots if needed to keep the whole keys.
+         */
+        LengthCache(std::size_t capacity, int nodes) : key_bits_(1), tag_bits_(0) {
+            const std::uint64_t max_key = nodes < 2 ? 0 : key(nodes - 1, nodes - 2);
+            while ((max_key >> key_bits_) != 0) {
+                ++key_bits_;
+            }
+            unsigned int slot_bits = 0;
+            while ((std::size_t(1) << slot_bits) < capacity) {
+                ++slot_bits;
+            }
+            slot_bits = std::max(slot_bits, key_bits_ - std::min(key_bits_, 31U));
+            key_bits_ = std::max(key_bits_, slot_bits);
+            tag_bits_ = key_bits_ - slot_bits;
+
+            const std::size_t size = std::size_t(1) << slot_bits;
+            slots_ = std::make_unique<std::atomic<std::uint64_t>[]>(size);
+            for (std::size_t i = 0; i < size; ++i) {
+                slots_[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        /// The cached length between \a a and \a b, or -1 if it is not in the cache
+        [[nodiscard]] int find(int a, int b) const {
+            const std::uint64_t permuted = permute(key(a, b));
+            const std::uint64_t entry = slot(permuted).load(std::memory_order_relaxed);
+            if ((entry >> 32U) == tag(permuted)) {
+                return static_cast<int>(entry & 0xFFFFFFFFU);
+            }
+            return -1;
+        }
+
+        void insert(int a, int b, int length) {
+            const std::uint64_t permuted = permute(key(a, b));
+            slot(permuted).store((tag(permuted) << 32U) | static_cast<std::uint32_t>(length),
+                                 std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Dense, row-major matrix of lengths, using the narrowest integer width that fits the longest length.
+     *
+     * Each row is padded so that it starts on a cache line, and only the lengths are stored, so a row of
+     * 16-bit lengths is about 14 times smaller than the corresponding row of line segments.
+     */
+    class DistanceMatrix {
+        static constexpr std::size_t alignment = 64;
+
+        struct FreeDeleter {
+            void operator()(void *data) const {
+                std::free(data);
+            }
+        };
+
+        int size_;
+        std::size_t stride_;
+        bool narrow_;
+        std::unique_ptr<void, FreeDeleter> data_;
+
+        template<typename T, typename F>
+        void fill(const F &length) {
+            T *data = static_cast<T *>(data_.get());
+            for (int i = 0; i < size_; ++i) {
+                T *row = data + i * stride_;
+                for (int j = 0; j < size_; ++j) {
+                    row[j] = static_cast<T>(length(i, j));
+                }
+            }
+        }
+    public:
+        /**
+         * @param size The number of nodes
+         * @param max_length The longest length that will be stored, used to choose the width
+         * @param length Function giving the length between two nodes
+         */
+        template<typename F>
+        DistanceMatrix(int size, int max_length, const F &length)
+                : size_(size),
+                  stride_(0),
+                  narrow_(max_length <= std::numeric_limits<std::uint16_t>::max()) {
+            const std::size_t width = narrow_ ? sizeof(std::uint16_t) : sizeof(std::uint32_t);
+            const std::size_t per_line = alignment / width;
+            stride_ = ((static_cast<std::size_t>(size) + per_line - 1) / per_line) * per_line;
+            const std::size_t bytes = std::max<std::size_t>(alignment, stride_ * size * width);
+            data_.reset(std::aligned_alloc(alignment, bytes));
+            if (data_ == nullptr) {
+                throw std::bad_alloc();
+            }
+            if (narrow_) {
+                fill<std::uint16_t>(length);
+            } else {
+                fill<std::uint32_t>(length);
+            }
+        }
+
+        [[nodiscard]] int size() const {
+            return size_;
+        }
+
+        /// True iff lengths are stored using 16 bits, otherwise 32 bits are used
+        [[nodiscard]] bool narrow() const {
+            return narrow_;
+        }
+
+        /// Memory used for the lengths in bytes
+        [[nodiscard]] std::size_t bytes() const {
+            return stride_ * size_ * (narrow_ ? sizeof(std::uint16_t) : sizeof(std::uint32_t));
+        }
+
+        /// The row of lengths from node \a i, where T must match the width of the matrix (see \a narrow)
+        template<typename T>
+        [[nodiscard]] const T *row(int i) const {
+            assert((sizeof(T) == sizeof(std::uint16_t)) == narrow_);
+            return static_cast<const T *>(data_.get()) + i * stride_;
+        }
+
+        [[nodiscard]] int length(int i, int j) const {
+            if (narrow_) {
+                return row<std::uint16_t>(i)[j];
+            } else {
+                return static_cast<int>(row<std::uint32_t>(i)[j]);
+            }
+        }
+    };
+
+    /// The TSPLib edge weight types that are supported
+    enum class EdgeWeightType {
+        /// Euclidean distance, approximated using two fixed decimals (see \a compute_approximate_distance)
+        Euc2D,
+        /// Euclidean distance rounded up to the nearest integer
+        Ceil2D,
+        /// Pseudo-Euclidean distance as used for the att instances
+        Att,
+        /// Geographical distance in kilometers on an idealized sphere, coordinates are DDD.MM degrees
+        Geo,
+        /// Lengths are given explicitly as a matrix
+        Explicit,
+    };
+
+    /**
+     * Distance oracle computing line segments and lengths between locations on demand.
+     *
+     * The coordinates are stored once, in separate x and y arrays. By default no pairwise data is stored, so
+     * the memory used scales linearly with the number of locations. For smaller instances a dense matrix of
+     * lengths can be stored instead, and for larger ones a bounded cache of lengths can be enabled. Both are
+     * shared between copies of the oracle.
+     *
+     * The length function is given by the edge weight type. For explicit lengths the matrix is always stored,
+     * and the coordinates are only used for display (they are all zero if there is no display data).
+     */
+    class DistanceOracle {
+        EdgeWeightType type_;
+        std::vector<int> xs_;
+        std::vector<int> ys_;
+        /// The factor the coordinates have been scaled by compared to the original coordinates
+        int coordinate_scale_;
+        /// Latitudes and longitudes in radians, only used for geographical distances
+        std::vector<double> latitudes_;
+        std::vector<double> longitudes_;
+        mutable std::shared_ptr<LengthCache> cache_;
+        mutable std::shared_ptr<const DistanceMatrix> matrix_;
+
+        [[nodiscard]] double scaled_distance(int i, int j) const {
+            const double x_diff = (static_cast<double>(xs_[i]) - xs_[j]) / coordinate_scale_;
+            const double y_diff = (static_cast<double>(ys_[i]) - ys_[j]) / coordinate_scale_;
+            return std::sqrt(x_diff * x_diff + y_diff * y_diff);
+        }
+
+        [[nodiscard]] int compute_length(int i, int j) const {
+            switch (type_) {
+                case EdgeWeightType::Euc2D:
+                    return compute_approximate_distance(xs_[i], ys_[i], xs_[j], ys_[j]);
+                case EdgeWeightType::Ceil2D:
+                    return static_cast<int>(std::ceil(scaled_distance(i, j)));
+                case EdgeWeightType::Att: {
+                    const double distance = scaled_distance(i, j) / std::sqrt(10.0);
+                    const int rounded = static_cast<int>(distance + 0.5);
+                    return rounded < distance ? rounded + 1 : rounded;
+                }
+                case EdgeWeightType::Geo: {
+                    if (i == j) {
+                        return 0;
+                    }
+                    constexpr double radius = 6378.388;
+                    const double q1 = std::cos(longitudes_[i] - longitudes_[j]);
+                    const double q2 = std::cos(latitudes_[i] - latitudes_[j]);
+                    const double q3 = std::cos(latitudes_[i] + latitudes_[j]);
+                    return static_cast<int>(radius * std::acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0);
+                }
+                case EdgeWeightType::Explicit:
+                    return matrix_->length(i, j);
+            }
+            assert(false && "Unknown edge weight type");
+            return 0;
+        }
+
+        /// Convert a TSPLib DDD.MM coordinate to radians
+        static double geo_radians(double coordinate) {
+            constexpr double pi = 3.141592;
+            const double degrees = std::trunc(coordinate);
+            const double minutes = coordinate - degrees;
+            return pi * (degrees + 5.0 * minutes / 3.0) / 180.0;
+        }
+    public:
+        /// The default largest number of locations for which a dense length matrix is stored
+        static constexpr int default_dense_limit = 5000;
+
+        DistanceOracle(std::vector<int> xs, std::vector<int> ys)
+                : DistanceOracle(EdgeWeightType::Euc2D, std::move(xs), std::move(ys)) {}
+
+        /**
+         * Oracle for an edge weight type computed from planar coordinates (EUC_2D, CEIL_2D, or ATT).
+         *
+         * @param coordinate_scale The factor the coordinates have been scaled by when read
+         */
+        DistanceOracle(EdgeWeightType type, std::vector<int> xs, std::vector<int> ys, int coordinate_scale = 1)
+                : type_(type), xs_(std::move(xs)), ys_(std::move(ys)), coordinate_scale_(coordinate_scale) {
+            assert(xs_.size() == ys_.size());
+            assert(type_ != EdgeWeightType::Geo && type_ != EdgeWeightType::Explicit);
+            assert(coordinate_scale_ > 0);
+        }
+
+        explicit DistanceOracle(const std::vector<Point> &locations)
+                : type_(EdgeWeightType::Euc2D), coordinate_scale_(1) {
+            xs_.reserve(locations.size());
+            ys_.reserve(locations.size());
+            for (const auto &location : locations) {
+                xs_.emplace_back(location.x());
+                ys_.emplace_back(location.y());
+            }
+        }
+
+        /**
+         * Oracle for geographical distances.
+         *
+         * @param latitudes The TSPLib x coordinates, in DDD.MM format
+         * @param longitudes The TSPLib y coordinates, in DDD.MM format
+         * @param xs Coordinates used for display
+         * @param ys Coordinates used for display
+         */
+        static DistanceOracle make_geo(const std::vector<double> &latitudes, const std::vector<double> &longitudes,
+                                       std::vector<int> xs, std::vector<int> ys) {
+            assert(latitudes.size() == longitudes.size());
+            std::vector<double> latitude_radians;
+            std::vector<double> longitude_radians;
+            latitude_radians.reserve(latitudes.size());
+            longitude_radians.reserve(longitudes.size());
+            for (std::size_t i = 0; i < latitudes.size(); ++i) {
+                latitude_radians.emplace_back(geo_radians(latitudes[i]));
+                longitude_radians.emplace_back(geo_radians(longitudes[i]));
+            }
+            return make_geo_from_radians(std::move(latitude_radians), std::move(longitude_radians),
+                                         std::move(xs), std::move(ys));
+        }
+
+        /// Oracle for geographical distances, with latitudes and longitudes already converted to radians
+        static DistanceOracle make_geo_from_radians(std::vector<double> latitudes, std::vector<double> longitudes,
+                                                    std::vector<int> xs, std::vector<int> ys) {
+            assert(latitudes.size() == longitudes.size() && latitudes.size() == xs.size());
+            DistanceOracle result(EdgeWeightType::Euc2D, std::move(xs), std::move(ys));
+            result.type_ = EdgeWeightType::Geo;
+            result.latitudes_ = std::move(latitudes);
+            result.longitudes_ = std::move(longitudes);
+            return result;
+        }
+
+        /**
+         * Oracle for explicitly given lengths.
+         *
+         * @param lengths The lengths, must be symmetric with zeros on the diagonal
+         * @param xs Coordinates used for display, or empty if there are none
+         * @param ys Coordinates used for display, or empty if there are none
+         */
+        static DistanceOracle make_explicit(std::shared_ptr<const DistanceMatrix> lengths,
+                                            std::vector<int> xs, std::vector<int> ys) {
+            if (xs.empty()) {
+                xs.assign(lengths->size(), 0);
+                ys.assign(lengths->size(), 0);
+            }
+            assert(xs.size() == static_cast<std::size_t>(lengths->size()) && xs.size() == ys.size());
+            DistanceOracle result(EdgeWeightType::Euc2D, std::move(xs), std::move(ys));
+            result.type_ = EdgeWeightType::Explicit;
+            result.matrix_ = std::move(lengths);
+            return result;
+        }
+
+        [[nodiscard]] EdgeWeightType type() const {
+            return type_;
+        }
+
+        /// The factor the coordinates have been scaled by when read
+        [[nodiscard]] int coordinate_scale() const {
+            return coordinate_scale_;
+        }
+
+        /// Latitudes in radians for geographical distances, otherwise empty
+        [[nodiscard]] const std::vector<double> &latitudes() const {
+            return latitudes_;
+        }
+
+        /// Longitudes in radians for geographical distances, otherwise empty
+        [[nodiscard]] const std::vector<double> &longitudes() const {
+            return longitudes_;
+        }
+
+        /**
+         * True iff the lengths are given by a monotone function of the Euclidean distance between the
+         * coordinates, so that geometric reasoning (such as about crossing edges) is meaningful.
+         */
+        [[nodiscard]] bool has_embedding() const {
+            return type_ == EdgeWeightType::Euc2D || type_ == EdgeWeightType::Ceil2D || type_ == EdgeWeightType::Att;
+        }
+
+        /**
+         * Enable a length cache with (at least) \a capacity entries, or disable caching when \a capacity is 0.
+         *
+         * Caching does not change any results, but this should be called before the oracle is shared between threads.
+         */
+        void cache_lengths(std::size_t capacity) const {
+            if (capacity == 0) {
+                cache_.reset();
+            } else {
+                cache_ = std::make_shared<LengthCache>(capacity, size());
+            }
+        }
+
+        /**
+         * Store a dense length matrix iff there are at most \a limit locations, otherwise drop any stored matrix.
+         * Explicit lengths are always kept.
+         *
+         * As for \a cache_lengths, this does not change any results, but should be called before sharing the oracle.
+         *
+         * @param limit The largest number of locations to store a dense matrix for
+         * @param max_length The longest length between any two locations
+         */
+        void store_dense_lengths(int limit, int max_length) const {
+            if (type_ == EdgeWeightType::Explicit) {
+                // The explicit lengths are the only source of lengths
+                return;
+            }
+            if (size() > limit) {
+                matrix_.reset();
+            } else if (!matrix_) {
+                matrix_ = std::make_shared<const DistanceMatrix>(size(), max_length, [&](int i, int j) {
+                    return compute_length(i, j);
+                });
+            }
+        }
+
+        /// The dense length matrix, or nullptr if lengths are computed on demand
+        [[nodiscard]] const DistanceMatrix *dense_lengths() const {
+            return matrix_.get();
+        }
+
+        [[nodiscard]] int size() const {
+            return xs_.size();
+        }
+
+        [[nodiscard]] const std::vector<int> &xs() const {
+            return xs_;
+        }
+
+        [[nodiscard]] const std::vector<int> &ys() const {
+            return ys_;
+        }
+
+        /// The location of node \a i, with the TSPLib 1-based identifier i+1
+        [[nodiscard]] Point location(int i) const {
+            return Point(i + 1, xs_[i], ys_[i]);
+        }
+
+        [[nodiscard]] BoundingBox bounds() const {
+            assert(!xs_.empty());
+            const auto [min_x, max_x] = std::minmax_element(xs_.begin(), xs_.end());
+            const auto [min_y, max_y] = std::minmax_element(ys_.begin(), ys_.end());
+            return BoundingBox(*min_x, *min_y, *max_x, *max_y);
+        }
+
+        /// The length of the edge between \a i and \a j
+        [[nodiscard]] int length(int i, int j) const {
+            if (matrix_) {
+                return matrix_->length(i, j);
+            }
+            if (i == j) {
+                return 0;
+            }
+            if (cache_) {
+                const int cached = cache_->find(i, j);
+                if (cached >= 0) {
+                    return cached;
+                }
+                const int length = compute_length(i, j);
+                cache_->insert(i, j, length);
+                return length;
+            }
+            return compute_length(i, j);
+        }
+
+        /// The line segment from \a i to \a j
+        [[nodiscard]] LineSegment line(int i, int j) const {
+            return LineSegment(location(i), location(j), length(i, j));
+        }
+    };
+}
+
+#endif //HC_DISTANCES_H
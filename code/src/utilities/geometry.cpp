@@ -0,0 +1,157 @@
+#include "geometry.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HC_GEOMETRY_AVX2
+#include <immintrin.h>
+#endif
+
+
+using namespace std;
+
+namespace hc {
+
+    namespace {
+        void intersects_many_scalar(const LineSegment &segment, const SegmentArrays &segments, int from,
+                                    vector<char> &result) {
+            for (int i = from; i < segments.size(); ++i) {
+                result[i] = intersects(segment, segments[i]);
+            }
+        }
+
+        void orientations_scalar(const Point &p1, const Point &p2, const vector<int> &xs, const vector<int> &ys,
+                                 int from, vector<Orientation> &result) {
+            for (int i = from; i < static_cast<int>(xs.size()); ++i) {
+                result[i] = orientation(p1, p2, Point(xs[i], ys[i]));
+            }
+        }
+
+#ifdef HC_GEOMETRY_AVX2
+        bool has_avx2() {
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            return avx2;
+        }
+
+        /// The products of the four 32-bit values in \a a and \a b, as 64-bit values
+        __attribute__((target("avx2")))
+        inline __m256i multiply(__m128i a, __m128i b) {
+            return _mm256_mul_epi32(_mm256_cvtepi32_epi64(a), _mm256_cvtepi32_epi64(b));
+        }
+
+        /// orientation_value for four triangles, with the differences between the coordinates given
+        __attribute__((target("avx2")))
+        inline __m256i orientation_values(__m128i dy12, __m128i dx23, __m128i dy23, __m128i dx12) {
+            return _mm256_sub_epi64(multiply(dy12, dx23), multiply(dy23, dx12));
+        }
+
+        /// One bit per 64-bit value, set iff its sign bit is set
+        __attribute__((target("avx2")))
+        inline int sign_bits(__m256i values) {
+            return _mm256_movemask_pd(_mm256_castsi256_pd(values));
+        }
+
+        /// One bit per 64-bit value, set iff it is zero
+        __attribute__((target("avx2")))
+        inline int zero_bits(__m256i values) {
+            return sign_bits(_mm256_cmpeq_epi64(values, _mm256_setzero_si256()));
+        }
+
+        /// The number of segments tested, the rest are left for the scalar version
+        __attribute__((target("avx2")))
+        int intersects_many_avx2(const LineSegment &segment, const SegmentArrays &segments, vector<char> &result) {
+            const __m128i s1x = _mm_set1_epi32(segment.start().x());
+            const __m128i s1y = _mm_set1_epi32(segment.start().y());
+            const __m128i e1x = _mm_set1_epi32(segment.end().x());
+            const __m128i e1y = _mm_set1_epi32(segment.end().y());
+            const __m128i d1x = _mm_sub_epi32(e1x, s1x);
+            const __m128i d1y = _mm_sub_epi32(e1y, s1y);
+
+            int i = 0;
+            for (; i + 4 <= segments.size(); i += 4) {
+                const auto load = [i](const int *values) {
+                    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+                };
+                const __m128i s2x = load(segments.start_x());
+                const __m128i s2y = load(segments.start_y());
+                const __m128i e2x = load(segments.end_x());
+                const __m128i e2y = load(segments.end_y());
+                const __m128i d2x = _mm_sub_epi32(e2x, s2x);
+                const __m128i d2y = _mm_sub_epi32(e2y, s2y);
+
+                // The same four orientations as in intersects
+                const __m256i o_s1_e1_s2 = orientation_values(d1y, _mm_sub_epi32(s2x, e1x),
+                                                              _mm_sub_epi32(s2y, e1y), d1x);
+                const __m256i o_s1_e1_e2 = orientation_values(d1y, _mm_sub_epi32(e2x, e1x),
+                                                              _mm_sub_epi32(e2y, e1y), d1x);
+                const __m256i o_s2_e2_s1 = orientation_values(d2y, _mm_sub_epi32(s1x, e2x),
+                                                              _mm_sub_epi32(s1y, e2y), d2x);
+                const __m256i o_s2_e2_e1 = orientation_values(d2y, _mm_sub_epi32(e1x, e2x),
+                                                              _mm_sub_epi32(e1y, e2y), d2x);
+
+                // Without colinear triangles, the segments intersect iff both pairs have opposite signs
+                const int opposite = sign_bits(_mm256_and_si256(_mm256_xor_si256(o_s1_e1_s2, o_s1_e1_e2),
+                                                                _mm256_xor_si256(o_s2_e2_s1, o_s2_e2_e1)));
+                const int colinear = zero_bits(o_s1_e1_s2) | zero_bits(o_s1_e1_e2) |
+                                     zero_bits(o_s2_e2_s1) | zero_bits(o_s2_e2_e1);
+                for (int lane = 0; lane < 4; ++lane) {
+                    if ((colinear >> lane) & 1) {
+                        result[i + lane] = intersects(segment, segments[i + lane]);
+                    } else {
+                        result[i + lane] = (opposite >> lane) & 1;
+                    }
+                }
+            }
+            return i;
+        }
+
+        /// The number of points done, the rest are left for the scalar version
+        __attribute__((target("avx2")))
+        int orientations_avx2(const Point &p1, const Point &p2, const vector<int> &xs, const vector<int> &ys,
+                              vector<Orientation> &result) {
+            const __m128i x2 = _mm_set1_epi32(p2.x());
+            const __m128i y2 = _mm_set1_epi32(p2.y());
+            const __m128i dx12 = _mm_set1_epi32(p2.x() - p1.x());
+            const __m128i dy12 = _mm_set1_epi32(p2.y() - p1.y());
+
+            const int size = static_cast<int>(xs.size());
+            int i = 0;
+            for (; i + 4 <= size; i += 4) {
+                const __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(xs.data() + i));
+                const __m128i y3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ys.data() + i));
+                const __m256i values = orientation_values(dy12, _mm_sub_epi32(x3, x2), _mm_sub_epi32(y3, y2), dx12);
+                const int negative = sign_bits(values);
+                const int zero = zero_bits(values);
+                for (int lane = 0; lane < 4; ++lane) {
+                    result[i + lane] = (zero >> lane) & 1 ? Orientation::Colinear
+                                     : (negative >> lane) & 1 ? Orientation::CounterClockwise
+                                     : Orientation::Clockwise;
+                }
+            }
+            return i;
+        }
+#endif
+    }
+
+    void intersects_many(const LineSegment &segment, const SegmentArrays &segments, vector<char> &result) {
+        result.resize(segments.size());
+        int done = 0;
+#ifdef HC_GEOMETRY_AVX2
+        if (has_avx2()) {
+            done = intersects_many_avx2(segment, segments, result);
+        }
+#endif
+        intersects_many_scalar(segment, segments, done, result);
+    }
+
+    void orientations(const Point &p1, const Point &p2, const vector<int> &xs, const vector<int> &ys,
+                      vector<Orientation> &result) {
+        assert(xs.size() == ys.size());
+        result.resize(xs.size());
+        int done = 0;
+#ifdef HC_GEOMETRY_AVX2
+        if (has_avx2()) {
+            done = orientations_avx2(p1, p2, xs, ys, result);
+        }
+#endif
+        orientations_scalar(p1, p2, xs, ys, done, result);
+    }
+}
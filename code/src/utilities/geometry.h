@@ -5,6 +5,8 @@
 #ifndef HC_GEOMETRY_H
 #define HC_GEOMETRY_H
 
+#include <algorithm>
+#include <numeric>
 #include <ostream>
 #include <vector>
 #include <cmath>
@@ -140,7 +142,7 @@ namespace hc {
 
             int min_x = boxes[0].min_x();
             int max_x = boxes[0].max_x();
-            int min_y = boxes[0].min_x();
+            int min_y = boxes[0].min_y();
             int max_y = boxes[0].max_y();
 
             for (size_t i = 1; i < boxes.size(); ++i) {
@@ -259,14 +261,19 @@ namespace hc {
      * @param end
      * @return The approximate distance between the two points.
      */
-    inline int compute_approximate_distance(const Point start, const Point end) {
-        const double x_diff = end.x() - start.x();
-        const double y_diff = end.y() - start.y();
+    inline int compute_approximate_distance(const int start_x, const int start_y, const int end_x, const int end_y) {
+        const double x_diff = static_cast<double>(end_x) - start_x;
+        const double y_diff = static_cast<double>(end_y) - start_y;
         const double distance = std::sqrt(x_diff * x_diff + y_diff * y_diff);
         int approximate_distance = approximate_as_int(distance);
         return approximate_distance;
     }
 
+    /// See \a compute_approximate_distance on coordinates
+    inline int compute_approximate_distance(const Point start, const Point end) {
+        return compute_approximate_distance(start.x(), start.y(), end.x(), end.y());
+    }
+
     /**
      * Class representing a line segment between two points inclusive.
      *
@@ -281,6 +288,10 @@ namespace hc {
                 : start_(start), end_(end),
                   length_(compute_approximate_distance(start_, end_)) {}
 
+        /// Create a line segment with an already known length
+        LineSegment(const Point &start, const Point &end, int length)
+                : start_(start), end_(end), length_(length) {}
+
         LineSegment(const LineSegment&) = default;
         LineSegment(LineSegment&&) = default;
         LineSegment& operator=(const LineSegment&) = default;
@@ -393,21 +404,32 @@ namespace hc {
     };
 
     /**
+     * Twice the signed area of the triangle (p1, p2, p3), positive when it is clockwise.
      *
-     * @param p1
-     * @param p2
-     * @param p3
-     * @return The orientation of the triangle formed by (p1, p2, p3)
+     * The products are computed with 64 bits, which is exact as long as the differences between coordinates fit in
+     * an int. With 32 bits, the result overflowed for differences over about 32000, such as in usa13509.
      */
-    inline Orientation orientation(const Point& p1, const Point& p2, const Point& p3)
+    inline long long orientation_value(const Point& p1, const Point& p2, const Point& p3)
     {
         // The base idea is to check the comparison
         // y_diff_1_2 / x_diff_1_2 <=> y_diff_2_3 / x_diff_2_3
         // i.e., the difference in slopes of the first two lines in the triangle
         // However, the x_diff can be 0, so this is a bad idea.
         // This is a closed form comparison formula instead that avoids the issues of division by 0
-        const int orientation = (p2.y() - p1.y()) * (p3.x() - p2.x()) -
-                                (p3.y() - p2.y()) * (p2.x() - p1.x());
+        return static_cast<long long>(p2.y() - p1.y()) * (p3.x() - p2.x()) -
+               static_cast<long long>(p3.y() - p2.y()) * (p2.x() - p1.x());
+    }
+
+    /**
+     *
+     * @param p1
+     * @param p2
+     * @param p3
+     * @return The orientation of the triangle formed by (p1, p2, p3)
+     */
+    inline Orientation orientation(const Point& p1, const Point& p2, const Point& p3)
+    {
+        const long long orientation = orientation_value(p1, p2, p3);
 
         if (orientation == 0) {
             return Orientation::Colinear;
@@ -458,6 +480,123 @@ namespace hc {
         // No intersection
         return false;
     }
+
+    /// Line segments stored as separate arrays of coordinates, for testing one segment against many at once
+    class SegmentArrays {
+        std::vector<int> start_x_;
+        std::vector<int> start_y_;
+        std::vector<int> end_x_;
+        std::vector<int> end_y_;
+    public:
+        void clear() {
+            start_x_.clear();
+            start_y_.clear();
+            end_x_.clear();
+            end_y_.clear();
+        }
+
+        void push_back(const LineSegment &segment) {
+            start_x_.emplace_back(segment.start().x());
+            start_y_.emplace_back(segment.start().y());
+            end_x_.emplace_back(segment.end().x());
+            end_y_.emplace_back(segment.end().y());
+        }
+
+        [[nodiscard]] int size() const {
+            return static_cast<int>(start_x_.size());
+        }
+
+        [[nodiscard]] bool empty() const {
+            return start_x_.empty();
+        }
+
+        [[nodiscard]] const int *start_x() const {
+            return start_x_.data();
+        }
+
+        [[nodiscard]] const int *start_y() const {
+            return start_y_.data();
+        }
+
+        [[nodiscard]] const int *end_x() const {
+            return end_x_.data();
+        }
+
+        [[nodiscard]] const int *end_y() const {
+            return end_y_.data();
+        }
+
+        /// Segment \a i, without identifiers
+        [[nodiscard]] LineSegment operator[](int i) const {
+            return LineSegment(Point(start_x_[i], start_y_[i]), Point(end_x_[i], end_y_[i]), 0);
+        }
+    };
+
+    /**
+     * Test \a segment against each of \a segments, giving the same result as intersects.
+     *
+     * Segments in general position are tested several at a time with AVX2 when the processor has it. The segments
+     * where some orientation is colinear are tested one at a time.
+     *
+     * @param result Set to one entry per segment, 1 iff it intersects \a segment
+     */
+    void intersects_many(const LineSegment &segment, const SegmentArrays &segments, std::vector<char> &result);
+
+    /**
+     * The orientation of each triangle (p1, p2, (xs[i], ys[i])), the same as orientation for each point.
+     *
+     * @param result Set to one orientation per point
+     */
+    void orientations(const Point &p1, const Point &p2, const std::vector<int> &xs, const std::vector<int> &ys,
+                      std::vector<Orientation> &result);
+
+    /**
+     * The convex hull of a set of points, using Andrew's monotone chain algorithm.
+     *
+     * @param xs The x coordinates of the points
+     * @param ys The y coordinates of the points
+     * @return The indices of the corners of the hull in counter-clockwise order. Colinear points on the
+     *         boundary are not included, and duplicates are only included once.
+     */
+    inline std::vector<int> convex_hull(const std::vector<int> &xs, const std::vector<int> &ys) {
+        assert(xs.size() == ys.size());
+        std::vector<int> order(xs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            return xs[a] < xs[b] || (xs[a] == xs[b] && ys[a] < ys[b]);
+        });
+        order.erase(std::unique(order.begin(), order.end(), [&](int a, int b) {
+            return xs[a] == xs[b] && ys[a] == ys[b];
+        }), order.end());
+        if (order.size() < 3) {
+            return order;
+        }
+
+        const auto cross = [&](int o, int a, int b) {
+            return (static_cast<long long>(xs[a]) - xs[o]) * (static_cast<long long>(ys[b]) - ys[o]) -
+                   (static_cast<long long>(ys[a]) - ys[o]) * (static_cast<long long>(xs[b]) - xs[o]);
+        };
+        std::vector<int> hull(2 * order.size());
+        std::size_t size = 0;
+        // Lower hull
+        for (int index : order) {
+            while (size >= 2 && cross(hull[size - 2], hull[size - 1], index) <= 0) {
+                --size;
+            }
+            hull[size++] = index;
+        }
+        // Upper hull
+        const std::size_t lower_size = size + 1;
+        for (auto it = order.rbegin() + 1; it != order.rend(); ++it) {
+            while (size >= lower_size && cross(hull[size - 2], hull[size - 1], *it) <= 0) {
+                --size;
+            }
+            hull[size++] = *it;
+        }
+        // The first point is added again last
+        hull.resize(size - 1);
+        return hull;
+    }
 }
 
 #endif //HC_GEOMETRY_H
@@ -1,7 +1,12 @@
 #include "graph.h"
 
-#include <unordered_set>
-#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <set>
 
 
 using namespace std;
@@ -46,11 +51,12 @@ namespace hc {
     }
 
 
-    OneTree kruskal_1_tree(int nodes,
-                           int excluded_node,
-                           const vector<LineSegment> &mandatory_edges,
-                           const vector<LineSegment> &edges,
-                           const function<bool(const LineSegment &)> &filter)
+    /// Minimum 1-tree using \a edges, or nothing if the accepted edges do not make up a 1-tree.
+    optional<OneTree> try_kruskal_1_tree(int nodes,
+                                         int excluded_node,
+                                         const vector<LineSegment> &mandatory_edges,
+                                         const vector<LineSegment> &edges,
+                                         const function<bool(const LineSegment &)> &filter)
     {
         assert(0 <= excluded_node && excluded_node < nodes && "The excluded node must be one of the nodes");
 
@@ -68,13 +74,20 @@ namespace hc {
             }
         }
 
+        // Both directions of an edge may be given, but each neighbour of the excluded node can only be used once,
+        // and the edge from the excluded node to itself not at all
+        const auto new_extra_edge = [&](const LineSegment &edge) {
+            return extra_edges.size() < 2 && edge.start_id() != edge.end_id() &&
+                   (extra_edges.empty() || extra_edges[0].id_not(excluded_node) != edge.id_not(excluded_node));
+        };
+
         //for (const auto &edge : edges) {
         int edge_index = 0;
         for (; edge_index < edges.size(); ++edge_index) {
             const auto &edge = edges[edge_index];
             if (filter(edge)) {
                 if (connected(edge, excluded_node)) {
-                    if (extra_edges.size() < 2) {
+                    if (new_extra_edge(edge)) {
                         // Since the edges are iterated over in order, this will
                         extra_edges.emplace_back(edge);
                     }
@@ -95,7 +108,7 @@ namespace hc {
         for (; extra_edges.size() < 2 && edge_index < edges.size(); ++edge_index) {
             const auto &edge = edges[edge_index];
             if (connected(edge, excluded_node)) {
-                if (filter(edge)) {
+                if (filter(edge) && new_extra_edge(edge)) {
                     // Since the edges are iterated over in order, this will
                     extra_edges.emplace_back(edge);
                 }
@@ -104,141 +117,737 @@ namespace hc {
 
         assert(sets.set_size(excluded_node) == 1 && "Excluded node should be excluded in result");
 
-        assert(extra_edges.size() == 2 &&
+        if (extra_edges.size() != 2 || sets.set_count() > 2) {
+            return optional<OneTree>();
+        }
+
+        return OneTree(nodes, excluded_node, make_pair(extra_edges[0], extra_edges[1]), edges_used);
+    }
+
+
+    OneTree kruskal_1_tree(int nodes,
+                           int excluded_node,
+                           const vector<LineSegment> &mandatory_edges,
+                           const vector<LineSegment> &edges,
+                           const function<bool(const LineSegment &)> &filter)
+    {
+        auto result = try_kruskal_1_tree(nodes, excluded_node, mandatory_edges, edges, filter);
+
+        assert(result.has_value() &&
                "No node should have more than two mandatory edges, no node should have less than 2 possible edges, "
                "so extra node must get exactly two edges.");
 
-        const auto &result = OneTree(nodes, excluded_node, make_pair(extra_edges[0], extra_edges[1]), edges_used);
+        return move(result.value());
+    }
+
+
+    MST kruskal(const TSPInstance &instance,
+                const vector<LineSegment> &mandatory_edges,
+                const function<bool(const LineSegment &)> &filter)
+    {
+        const int nodes = instance.locations();
+        MST result = kruskal(nodes, mandatory_edges, instance.candidate_graph().edges(), filter);
+        if (result.edges().size() + 1 < static_cast<size_t>(nodes)) {
+            // The candidate graph is disconnected by the filter, use all edges instead
+            return kruskal(nodes, mandatory_edges, instance.lines_length_ordered(), filter);
+        }
 
         return result;
     }
 
 
-    /**
-     *
-     * @param nodes Number of total nodes
-     * @param odd the nodes to match
-     * @param odd_set Set of the nodes to match
-     * @param edges Edges to use
-     * @return A pair of matched segments, and the unmatched nodes
-     */
-    pair<vector<LineSegment>, unordered_set<int>> match(int nodes,
-                                                        const vector<int> &odd,
-                                                        const unordered_set<int> &odd_set,
-                                                        const vector<LineSegment> &edges) {
-        unordered_set<int> remaining(odd_set);
-        vector<LineSegment> matches;
-
-        vector<pair<int, vector<LineSegment>>> grouped;
-        grouped.reserve(nodes);
-        for (int i = 0; i < nodes; ++i) {
-            grouped.emplace_back(make_pair(i, vector<LineSegment>()));
+    OneTree kruskal_1_tree(const TSPInstance &instance,
+                           int excluded_node,
+                           const vector<LineSegment> &mandatory_edges,
+                           const function<bool(const LineSegment &)> &filter)
+    {
+        const int nodes = instance.locations();
+        auto result = try_kruskal_1_tree(nodes, excluded_node, mandatory_edges,
+                                         instance.candidate_graph().edges(), filter);
+        if (!result.has_value()) {
+            // The candidate graph is disconnected by the filter, use all edges instead
+            return kruskal_1_tree(nodes, excluded_node, mandatory_edges, instance.lines_length_ordered(), filter);
         }
+
+        return move(result.value());
+    }
+
+
+    /// Add edges accepted by \a filter in the order of \a edges, joining separate sets until \a target_sets remain.
+    void join_until(UnionFind &sets,
+                    vector<LineSegment> &edges_used,
+                    const vector<LineSegment> &edges,
+                    const function<bool(const LineSegment &)> &filter,
+                    int target_sets)
+    {
         for (const auto &edge : edges) {
-            grouped[edge.start_id()].second.emplace_back(edge);
-            grouped[edge.end_id()].second.emplace_back(edge);
-        }
-        sort(grouped.begin(), grouped.end(), [](const auto &a, const auto &b) {
-            return a.second.size() > b.second.size();
-        });
-        for (int i = 0; i < nodes && !remaining.empty(); ++i) {
-            int node_a = grouped[i].first;
-            if (remaining.count(node_a) == 1) {
-                auto &candidates = grouped[i].second;
-                sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+            if (sets.set_count() <= target_sets) {
+                break;
+            }
+            if (filter(edge) && !sets.same_set(edge.start_id(), edge.end_id())) {
+                sets.join(edge.start_id(), edge.end_id());
+                edges_used.emplace_back(edge);
+            }
+        }
+    }
+
+
+    void EdgeSorter::sort_by_length(vector<LineSegment> &edges) {
+        // Keys with the length in the high half and the position in the low half, sorted on the length only
+        keys_.clear();
+        int max_length = 0;
+        for (size_t i = 0; i < edges.size(); ++i) {
+            assert(edges[i].length() >= 0 && "Lengths must be non-negative");
+            max_length = max(max_length, edges[i].length());
+            keys_.emplace_back((static_cast<uint64_t>(edges[i].length()) << 32U) | i);
+        }
+
+        // Least significant digit first, with 16 bit digits, skipping the high digit when all lengths are small
+        constexpr int digit_bits = 16;
+        constexpr uint64_t digit_mask = (1U << digit_bits) - 1;
+        scratch_.resize(keys_.size());
+        vector<size_t> counts(digit_mask + 2);
+        for (int shift = 32; shift < 64 && (static_cast<uint64_t>(max_length) >> (shift - 32)) != 0; shift += digit_bits) {
+            fill(counts.begin(), counts.end(), 0);
+            for (const uint64_t key : keys_) {
+                ++counts[((key >> shift) & digit_mask) + 1];
+            }
+            partial_sum(counts.begin(), counts.end(), counts.begin());
+            for (const uint64_t key : keys_) {
+                scratch_[counts[(key >> shift) & digit_mask]++] = key;
+            }
+            keys_.swap(scratch_);
+        }
+
+        sorted_.clear();
+        sorted_.reserve(edges.size());
+        for (const uint64_t key : keys_) {
+            sorted_.emplace_back(edges[key & 0xFFFFFFFFU]);
+        }
+        edges.swap(sorted_);
+    }
+
+
+    const MST &IncrementalMST::update(int nodes,
+                                      int excluded_node,
+                                      const vector<LineSegment> &mandatory_edges,
+                                      const vector<LineSegment> &edges,
+                                      const function<bool(const LineSegment &)> &filter)
+    {
+        const auto key = [](const LineSegment &edge) {
+            return make_pair(min(edge.start_id(), edge.end_id()), max(edge.start_id(), edge.end_id()));
+        };
+        const auto accepted = [&](const LineSegment &edge) {
+            return !connected(edge, excluded_node) && edge.start_id() != edge.end_id() && filter(edge);
+        };
+        // The excluded node stays a set of its own
+        const int target_sets = excluded_node == -1 ? 1 : 2;
+
+        vector<LineSegment> mandatory;
+        for (const auto &edge : mandatory_edges) {
+            if (!connected(edge, excluded_node)) {
+                mandatory.emplace_back(edge);
+            }
+        }
+
+        if (!mst_.has_value() || nodes != nodes_ || excluded_node != excluded_node_) {
+            nodes_ = nodes;
+            excluded_node_ = excluded_node;
+            UnionFind &sets = sets_;
+            sets.reset(nodes);
+            vector<LineSegment> edges_used;
+            edges_used.reserve(nodes);
+            join_until(sets, edges_used, mandatory, [](const LineSegment &) { return true; }, 0);
+            join_until(sets, edges_used, edges, accepted, target_sets);
+            mst_.emplace(move(edges_used));
+            return mst_.value();
+        }
+
+        const auto in_tree = [&](const LineSegment &edge) {
+            const auto &at_start = mst_->edges_at(edge.start_id());
+            return any_of(at_start.begin(), at_start.end(), [&](const LineSegment &tree_edge) {
+                return tree_edge.id_not(edge.start_id()) == edge.end_id();
+            });
+        };
+        const bool forced = !all_of(mandatory.begin(), mandatory.end(), in_tree);
+
+        vector<LineSegment> kept;
+        kept.reserve(nodes);
+        int shortest_removed = numeric_limits<int>::max();
+        for (const auto &edge : mst_->edges()) {
+            if (accepted(edge) || any_of(mandatory.begin(), mandatory.end(), [&](const LineSegment &other) {
+                    return key(other) == key(edge);
+                })) {
+                kept.emplace_back(edge);
+            } else {
+                shortest_removed = min(shortest_removed, edge.length());
+            }
+        }
+        const bool removed = kept.size() != mst_->edges().size();
+        if (!removed && !forced) {
+            return mst_.value();
+        }
+
+        if (removed) {
+            // The remaining tree edges are in a minimum spanning tree of the remaining edges, so only the components
+            // they leave need to be reconnected. An edge shorter than a removed tree edge that crossed its cut would
+            // have been in the tree instead, so the search can start at the shortest removed length.
+            UnionFind &sets = sets_;
+            sets.reset(nodes);
+            for (const auto &edge : kept) {
+                sets.join(edge.start_id(), edge.end_id());
+            }
+            const auto first = lower_bound(edges.begin(), edges.end(), shortest_removed,
+                                           [](const LineSegment &edge, int length) {
+                                               return edge.length() < length;
+                                           });
+            for (auto edge = first; edge != edges.end() && sets.set_count() > target_sets; ++edge) {
+                if (accepted(*edge) && !sets.same_set(edge->start_id(), edge->end_id())) {
+                    sets.join(edge->start_id(), edge->end_id());
+                    kept.emplace_back(*edge);
+                }
+            }
+        }
+
+        if (forced) {
+            // Kruskal over the mandatory edges and the tree drops the longest non-mandatory edge on each cycle
+            // closed by a new mandatory edge
+            sort(kept.begin(), kept.end(), [](const LineSegment &a, const LineSegment &b) {
+                return a.length() < b.length();
+            });
+            UnionFind &sets = sets_;
+            sets.reset(nodes);
+            vector<LineSegment> edges_used;
+            edges_used.reserve(nodes);
+            join_until(sets, edges_used, mandatory, [](const LineSegment &) { return true; }, 0);
+            join_until(sets, edges_used, kept, [](const LineSegment &) { return true; }, target_sets);
+            kept = move(edges_used);
+        }
+
+        mst_.emplace(move(kept));
+        return mst_.value();
+    }
+
+
+    namespace {
+        /**
+         * Maximum weight matching in a general graph using Edmonds' blossom algorithm with dual variables,
+         * O(n^3) time. Nodes are numbered from 1, blossoms get the numbers after the nodes.
+         */
+        class WeightedBlossom {
+            struct Edge {
+                int u = 0;
+                int v = 0;
+                long long w = 0;
+            };
+
+            int n_;
+            int n_x_;
+            int stamp_;
+            /// Edges between nodes and blossoms, a weight of 0 means no edge
+            vector<vector<Edge>> g_;
+            vector<long long> lab_;
+            vector<int> match_, slack_, st_, pa_, s_, vis_;
+            /// flo_from_[b][x] is the child of blossom b containing node x
+            vector<vector<int>> flo_from_;
+            vector<vector<int>> flo_;
+            queue<int> q_;
+
+            [[nodiscard]] long long e_delta(const Edge &e) const {
+                return lab_[e.u] + lab_[e.v] - g_[e.u][e.v].w * 2;
+            }
+
+            void update_slack(int u, int x) {
+                if (slack_[x] == 0 || e_delta(g_[u][x]) < e_delta(g_[slack_[x]][x])) {
+                    slack_[x] = u;
+                }
+            }
+
+            void set_slack(int x) {
+                slack_[x] = 0;
+                for (int u = 1; u <= n_; ++u) {
+                    if (g_[u][x].w > 0 && st_[u] != x && s_[st_[u]] == 0) {
+                        update_slack(u, x);
+                    }
+                }
+            }
+
+            void q_push(int x) {
+                if (x <= n_) {
+                    q_.push(x);
+                } else {
+                    for (int child : flo_[x]) {
+                        q_push(child);
+                    }
+                }
+            }
+
+            void set_st(int x, int b) {
+                st_[x] = b;
+                if (x > n_) {
+                    for (int child : flo_[x]) {
+                        set_st(child, b);
+                    }
+                }
+            }
+
+            int get_pr(int b, int xr) {
+                int pr = static_cast<int>(find(flo_[b].begin(), flo_[b].end(), xr) - flo_[b].begin());
+                if (pr % 2 == 1) {
+                    reverse(flo_[b].begin() + 1, flo_[b].end());
+                    return static_cast<int>(flo_[b].size()) - pr;
+                }
+                return pr;
+            }
+
+            void set_match(int u, int v) {
+                match_[u] = g_[u][v].v;
+                if (u <= n_) {
+                    return;
+                }
+                Edge e = g_[u][v];
+                int xr = flo_from_[u][e.u];
+                int pr = get_pr(u, xr);
+                for (int i = 0; i < pr; ++i) {
+                    set_match(flo_[u][i], flo_[u][i ^ 1]);
+                }
+                set_match(xr, v);
+                rotate(flo_[u].begin(), flo_[u].begin() + pr, flo_[u].end());
+            }
+
+            void augment(int u, int v) {
+                while (true) {
+                    int xnv = st_[match_[u]];
+                    set_match(u, v);
+                    if (xnv == 0) {
+                        return;
+                    }
+                    set_match(xnv, st_[pa_[xnv]]);
+                    u = st_[pa_[xnv]];
+                    v = xnv;
+                }
+            }
+
+            int get_lca(int u, int v) {
+                for (++stamp_; u != 0 || v != 0; swap(u, v)) {
+                    if (u == 0) {
+                        continue;
+                    }
+                    if (vis_[u] == stamp_) {
+                        return u;
+                    }
+                    vis_[u] = stamp_;
+                    u = st_[match_[u]];
+                    if (u != 0) {
+                        u = st_[pa_[u]];
+                    }
+                }
+                return 0;
+            }
+
+            void add_blossom(int u, int lca, int v) {
+                int b = n_ + 1;
+                while (b <= n_x_ && st_[b] != 0) {
+                    ++b;
+                }
+                if (b > n_x_) {
+                    ++n_x_;
+                }
+                lab_[b] = 0;
+                s_[b] = 0;
+                match_[b] = match_[lca];
+                flo_[b].clear();
+                flo_[b].push_back(lca);
+                for (int x = u, y; x != lca; x = st_[pa_[y]]) {
+                    flo_[b].push_back(x);
+                    flo_[b].push_back(y = st_[match_[x]]);
+                    q_push(y);
+                }
+                reverse(flo_[b].begin() + 1, flo_[b].end());
+                for (int x = v, y; x != lca; x = st_[pa_[y]]) {
+                    flo_[b].push_back(x);
+                    flo_[b].push_back(y = st_[match_[x]]);
+                    q_push(y);
+                }
+                set_st(b, b);
+                for (int x = 1; x <= n_x_; ++x) {
+                    g_[b][x].w = 0;
+                    g_[x][b].w = 0;
+                }
+                fill(flo_from_[b].begin(), flo_from_[b].end(), 0);
+                for (int xs : flo_[b]) {
+                    for (int x = 1; x <= n_x_; ++x) {
+                        if (g_[b][x].w == 0 || e_delta(g_[xs][x]) < e_delta(g_[b][x])) {
+                            g_[b][x] = g_[xs][x];
+                            g_[x][b] = g_[x][xs];
+                        }
+                    }
+                    for (int x = 1; x <= n_; ++x) {
+                        if (flo_from_[xs][x] != 0) {
+                            flo_from_[b][x] = xs;
+                        }
+                    }
+                }
+                set_slack(b);
+            }
+
+            void expand_blossom(int b) {
+                for (int child : flo_[b]) {
+                    set_st(child, child);
+                }
+                int xr = flo_from_[b][g_[b][pa_[b]].u];
+                int pr = get_pr(b, xr);
+                for (int i = 0; i < pr; i += 2) {
+                    int xs = flo_[b][i];
+                    int xns = flo_[b][i + 1];
+                    pa_[xs] = g_[xns][xs].u;
+                    s_[xs] = 1;
+                    s_[xns] = 0;
+                    slack_[xs] = 0;
+                    set_slack(xns);
+                    q_push(xns);
+                }
+                s_[xr] = 1;
+                pa_[xr] = pa_[b];
+                for (size_t i = pr + 1; i < flo_[b].size(); ++i) {
+                    int xs = flo_[b][i];
+                    s_[xs] = -1;
+                    set_slack(xs);
+                }
+                st_[b] = 0;
+            }
+
+            bool on_found_edge(const Edge &e) {
+                int u = st_[e.u];
+                int v = st_[e.v];
+                if (s_[v] == -1) {
+                    pa_[v] = e.u;
+                    s_[v] = 1;
+                    int nu = st_[match_[v]];
+                    slack_[v] = 0;
+                    slack_[nu] = 0;
+                    s_[nu] = 0;
+                    q_push(nu);
+                } else if (s_[v] == 0) {
+                    int lca = get_lca(u, v);
+                    if (lca == 0) {
+                        augment(u, v);
+                        augment(v, u);
+                        return true;
+                    }
+                    add_blossom(u, lca, v);
+                }
+                return false;
+            }
+
+            /// One augmentation, false if the matching is of maximum weight
+            bool augmenting_path() {
+                fill(s_.begin() + 1, s_.begin() + n_x_ + 1, -1);
+                fill(slack_.begin() + 1, slack_.begin() + n_x_ + 1, 0);
+                q_ = queue<int>();
+                for (int x = 1; x <= n_x_; ++x) {
+                    if (st_[x] == x && match_[x] == 0) {
+                        pa_[x] = 0;
+                        s_[x] = 0;
+                        q_push(x);
+                    }
+                }
+                if (q_.empty()) {
+                    return false;
+                }
+                while (true) {
+                    while (!q_.empty()) {
+                        int u = q_.front();
+                        q_.pop();
+                        if (s_[st_[u]] == 1) {
+                            continue;
+                        }
+                        for (int v = 1; v <= n_; ++v) {
+                            if (g_[u][v].w > 0 && st_[u] != st_[v]) {
+                                if (e_delta(g_[u][v]) == 0) {
+                                    if (on_found_edge(g_[u][v])) {
+                                        return true;
+                                    }
+                                } else {
+                                    update_slack(u, st_[v]);
+                                }
+                            }
+                        }
+                    }
+                    long long d = numeric_limits<long long>::max();
+                    for (int b = n_ + 1; b <= n_x_; ++b) {
+                        if (st_[b] == b && s_[b] == 1) {
+                            d = min(d, lab_[b] / 2);
+                        }
+                    }
+                    for (int x = 1; x <= n_x_; ++x) {
+                        if (st_[x] == x && slack_[x] != 0) {
+                            if (s_[x] == -1) {
+                                d = min(d, e_delta(g_[slack_[x]][x]));
+                            } else if (s_[x] == 0) {
+                                d = min(d, e_delta(g_[slack_[x]][x]) / 2);
+                            }
+                        }
+                    }
+                    for (int u = 1; u <= n_; ++u) {
+                        if (s_[st_[u]] == 0) {
+                            if (lab_[u] <= d) {
+                                return false;
+                            }
+                            lab_[u] -= d;
+                        } else if (s_[st_[u]] == 1) {
+                            lab_[u] += d;
+                        }
+                    }
+                    for (int b = n_ + 1; b <= n_x_; ++b) {
+                        if (st_[b] == b) {
+                            if (s_[b] == 0) {
+                                lab_[b] += d * 2;
+                            } else if (s_[b] == 1) {
+                                lab_[b] -= d * 2;
+                            }
+                        }
+                    }
+                    q_ = queue<int>();
+                    for (int x = 1; x <= n_x_; ++x) {
+                        if (st_[x] == x && slack_[x] != 0 && st_[slack_[x]] != x &&
+                            e_delta(g_[slack_[x]][x]) == 0) {
+                            if (on_found_edge(g_[slack_[x]][x])) {
+                                return true;
+                            }
+                        }
+                    }
+                    for (int b = n_ + 1; b <= n_x_; ++b) {
+                        if (st_[b] == b && s_[b] == 1 && lab_[b] == 0) {
+                            expand_blossom(b);
+                        }
+                    }
+                }
+            }
+
+        public:
+            explicit WeightedBlossom(int n)
+                    : n_(n), n_x_(n), stamp_(0),
+                      g_(2 * n + 1, vector<Edge>(2 * n + 1)),
+                      lab_(2 * n + 1, 0),
+                      match_(2 * n + 1, 0), slack_(2 * n + 1, 0), st_(2 * n + 1, 0), pa_(2 * n + 1, 0),
+                      s_(2 * n + 1, 0), vis_(2 * n + 1, 0),
+                      flo_from_(2 * n + 1, vector<int>(n + 1, 0)),
+                      flo_(2 * n + 1) {
+                for (int u = 1; u <= n_; ++u) {
+                    for (int v = 1; v <= n_; ++v) {
+                        g_[u][v].u = u;
+                        g_[u][v].v = v;
+                    }
+                }
+            }
+
+            /// Set the weight of the edge between \a u and \a v, which must be positive
+            void set_weight(int u, int v, long long w) {
+                g_[u][v].w = w;
+                g_[v][u].w = w;
+            }
+
+            /// Maximum weight matching, with mate[u] the node matched to u or 0 if none
+            vector<int> solve() {
+                n_x_ = n_;
+                long long w_max = 0;
+                for (int u = 0; u <= n_; ++u) {
+                    st_[u] = u;
+                    flo_[u].clear();
+                }
+                for (int u = 1; u <= n_; ++u) {
+                    for (int v = 1; v <= n_; ++v) {
+                        flo_from_[u][v] = u == v ? u : 0;
+                        w_max = max(w_max, g_[u][v].w);
+                    }
+                }
+                for (int u = 1; u <= n_; ++u) {
+                    lab_[u] = w_max;
+                }
+                while (augmenting_path()) {
+                }
+                return vector<int>(match_.begin(), match_.begin() + n_ + 1);
+            }
+        };
+
+
+        /// Minimum perfect matching of \a nodes over all edges between them
+        vector<LineSegment> exact_matching(const TSPInstance &instance, const vector<int> &nodes) {
+            const int size = static_cast<int>(nodes.size());
+            long long longest = 0;
+            for (int i = 0; i < size; ++i) {
+                for (int j = i + 1; j < size; ++j) {
+                    longest = max(longest, static_cast<long long>(instance.line(nodes[i], nodes[j]).length()));
+                }
+            }
+            // Weights longest + 1 - length are all positive, so the maximum weight matching of the complete
+            // graph is perfect, and among perfect matchings it is the shortest
+            WeightedBlossom blossom(size);
+            for (int i = 0; i < size; ++i) {
+                for (int j = i + 1; j < size; ++j) {
+                    blossom.set_weight(i + 1, j + 1, longest + 1 - instance.line(nodes[i], nodes[j]).length());
+                }
+            }
+            const vector<int> mate = blossom.solve();
+            vector<LineSegment> matches;
+            matches.reserve(size / 2);
+            for (int i = 1; i <= size; ++i) {
+                assert(mate[i] != 0);
+                if (i < mate[i]) {
+                    matches.emplace_back(instance.line(nodes[i - 1], nodes[mate[i] - 1]));
+                }
+            }
+            return matches;
+        }
+
+
+        /// Greedy matching of \a nodes over \a edges, completed over all edges and improved by 2-opt moves
+        vector<LineSegment> greedy_matching(const TSPInstance &instance,
+                                            const vector<int> &nodes,
+                                            const vector<LineSegment> &edges) {
+            const int locations = instance.locations();
+            vector<int> mate(locations, -1);
+            vector<char> to_match(locations, 0);
+            for (int node : nodes) {
+                to_match[node] = 1;
+            }
+
+            AdjacencyGraph graph(locations, edges);
+            for (const auto &edge : graph.edges()) {
+                const int a = edge.start_id();
+                const int b = edge.end_id();
+                if (to_match[a] && to_match[b] && mate[a] == -1 && mate[b] == -1) {
+                    mate[a] = b;
+                    mate[b] = a;
+                }
+            }
+
+            vector<int> remaining;
+            for (int node : nodes) {
+                if (mate[node] == -1) {
+                    remaining.push_back(node);
+                }
+            }
+            if (!remaining.empty()) {
+                // All edges between the remaining nodes exist, so greedy matching over them leaves none out
+                vector<LineSegment> extra_lines;
+                extra_lines.reserve(remaining.size() * (remaining.size() - 1) / 2);
+                for (size_t i = 0; i < remaining.size(); ++i) {
+                    for (size_t j = i + 1; j < remaining.size(); ++j) {
+                        extra_lines.emplace_back(instance.line(remaining[i], remaining[j]));
+                    }
+                }
+                sort(extra_lines.begin(), extra_lines.end(), [](const auto &a, const auto &b) {
                     return a.length() < b.length();
                 });
-                for (const auto &candidate : candidates) {
-                    int node_b = candidate.id_not(node_a);
-                    if (remaining.count(node_b) == 1) {
-                        remaining.erase(node_a);
-                        remaining.erase(node_b);
-                        matches.emplace_back(candidate);
-                        break;
+                for (const auto &line : extra_lines) {
+                    const int a = line.start_id();
+                    const int b = line.end_id();
+                    if (mate[a] == -1 && mate[b] == -1) {
+                        mate[a] = b;
+                        mate[b] = a;
                     }
                 }
             }
+
+            // 2-opt: replace the matched edges a-b and c-d by a-c and b-d when shorter, for the neighbours c of
+            // a in the edges. Every move shortens the matching, so this terminates.
+            const auto length = [&](int a, int b) { return instance.line(a, b).length(); };
+            vector<int> queue(nodes.begin(), nodes.end());
+            vector<char> queued(locations, 0);
+            for (int node : nodes) {
+                queued[node] = 1;
+            }
+            while (!queue.empty()) {
+                const int a = queue.back();
+                queue.pop_back();
+                queued[a] = 0;
+                const auto [begin, end] = graph.incident(a);
+                for (const int *it = begin; it != end; ++it) {
+                    const int b = mate[a];
+                    const int c = graph.edges()[*it].id_not(a);
+                    if (!to_match[c] || c == b) {
+                        continue;
+                    }
+                    const int d = mate[c];
+                    if (length(a, c) + length(b, d) < length(a, b) + length(c, d)) {
+                        mate[a] = c;
+                        mate[c] = a;
+                        mate[b] = d;
+                        mate[d] = b;
+                        for (int changed : {b, c, d}) {
+                            if (!queued[changed]) {
+                                queued[changed] = 1;
+                                queue.push_back(changed);
+                            }
+                        }
+                    }
+                }
+            }
+
+            vector<LineSegment> matches;
+            matches.reserve(nodes.size() / 2);
+            for (int node : nodes) {
+                if (node < mate[node]) {
+                    matches.emplace_back(instance.line(node, mate[node]));
+                }
+            }
+            return matches;
         }
+    }
 
-        return make_pair(move(matches), move(remaining));
+
+    vector<LineSegment> min_perfect_matching(const TSPInstance &instance,
+                                             const vector<int> &nodes,
+                                             const vector<LineSegment> &edges,
+                                             int exact_limit) {
+        assert((nodes.size() & 1U) == 0);
+        if (nodes.empty()) {
+            return {};
+        }
+        if (static_cast<int>(nodes.size()) <= exact_limit) {
+            return exact_matching(instance, nodes);
+        }
+        return greedy_matching(instance, nodes, edges);
     }
 
 
-    optional<vector<LineSegment>> christofides(
-            shared_ptr<const TSPInstance> instance,
-            int nodes, 
-            const vector<LineSegment> &mandatory_edges, 
+    optional<vector<LineSegment>> christofides_from_mst(
+            const shared_ptr<const TSPInstance> &instance,
+            int nodes,
+            const MST &mst,
             const vector<LineSegment> &edges,
-            const function<bool(const LineSegment &)> &filter) 
+            EulerCircuit &euler)
     {
-        MST mst = kruskal(nodes, mandatory_edges, edges, filter);
-
         vector<int> odd;
-        unordered_set<int> odd_set;
+        vector<char> is_odd(nodes, 0);
         odd.reserve(nodes);
         for (int i = 0; i < nodes; ++i) {
             if ((mst.edges_at(i).size() & 1U) == 1) {
                 odd.emplace_back(i);
-                odd_set.emplace(i);
+                is_odd[i] = 1;
             }
         }
         assert((odd.size() & 1U) == 0);
 
         vector<LineSegment> candidate_edges;
-        candidate_edges.reserve(odd.size() * odd.size());
-        for (const auto &edge : edges) {
-            if (edge.start_id() != edge.end_id())
-            {
-                if (odd_set.count(edge.start_id()) == 1 && odd_set.count(edge.end_id()) == 1) {
+        if (static_cast<int>(odd.size()) > exact_matching_limit) {
+            candidate_edges.reserve(min(odd.size() * odd.size(), edges.size()));
+            for (const auto &edge : edges) {
+                if (edge.start_id() != edge.end_id() && is_odd[edge.start_id()] && is_odd[edge.end_id()]) {
                     candidate_edges.emplace_back(edge);
                 }
             }
         }
-        pair<vector<LineSegment>, unordered_set<int>> match_and_remaining = match(nodes, odd, odd_set,
-                                                                     candidate_edges);
-        auto& matches = match_and_remaining.first;
-        auto& remaining = match_and_remaining.second;
-
-        if (!remaining.empty()) {
-            vector<LineSegment> extra_lines;
-            for (int n1 : remaining) {
-                for (int n2 : remaining) {
-                    if (n1 < n2) {
-                        extra_lines.emplace_back(instance->line(n1, n2));
-                    }
-                }
-            }
-            sort(extra_lines.begin(), extra_lines.end(), [](const auto& a, const auto& b){
-                return a.length() < b.length();
-            });
-            int pos = 0;
-            while (pos < extra_lines.size() && remaining.size() > 1) {
-                const auto& line = extra_lines[pos];
-                if (remaining.count(line.start_id()) == 1 &&
-                    remaining.count(line.end_id()) == 1) {
-                    matches.emplace_back(line);
-                    remaining.erase(line.start_id());
-                    remaining.erase(line.end_id());
-                }
-                ++pos;
-            }
-            if (!remaining.empty()) {
-                std::cerr << "Some nodes not matched at all..." << std::endl;
-                return optional<vector<LineSegment>>();
-            }
-            //matches.insert(matches.end(), extra_lines.begin(), extra_lines.end());
-//            if (matches.size() +1 != nodes) {
-//                std::cerr << "Wrong number of edges" << std::endl;
-//                return optional<vector<LineSegment>>();
-//            }
-        }
+        const vector<LineSegment> matches = min_perfect_matching(*instance, odd, candidate_edges);
 
         vector<LineSegment> christofides_edges;
         christofides_edges.reserve(mst.edges().size() + matches.size());
         christofides_edges.insert(christofides_edges.end(), mst.edges().begin(), mst.edges().end());
         christofides_edges.insert(christofides_edges.end(), matches.begin(), matches.end());
 
-        vector<int> euler_circuit = hierholzer_path(nodes, christofides_edges);
+        const vector<int> &euler_circuit = euler.circuit(nodes, christofides_edges);
         vector<bool> visited(nodes, false);
         int last = euler_circuit[0];
         visited[last] = true;
@@ -259,6 +868,32 @@ namespace hc {
         return optional(circuit);
     }
 
+
+    optional<vector<LineSegment>> christofides(
+            shared_ptr<const TSPInstance> instance,
+            int nodes, 
+            const vector<LineSegment> &mandatory_edges, 
+            const vector<LineSegment> &edges,
+            const function<bool(const LineSegment &)> &filter) 
+    {
+        MST mst = kruskal(nodes, mandatory_edges, edges, filter);
+        EulerCircuit euler;
+
+        return christofides_from_mst(instance, nodes, mst, edges, euler);
+    }
+
+
+    optional<vector<LineSegment>> christofides(
+            shared_ptr<const TSPInstance> instance,
+            const vector<LineSegment> &mandatory_edges,
+            const function<bool(const LineSegment &)> &filter)
+    {
+        MST mst = kruskal(*instance, mandatory_edges, filter);
+        EulerCircuit euler;
+
+        return christofides_from_mst(instance, instance->locations(), mst, instance->candidate_graph().edges(), euler);
+    }
+
     /*
 stack St;
 put start vertex in St;
@@ -272,47 +907,650 @@ until St is empty
     remove it from the graph;
     put the second end of this edge in St;
      */
-    vector<int> hierholzer_path(int nodes, const vector<LineSegment>& edges) {
-        vector<vector<LineSegment>> graph(nodes, vector<LineSegment>());
-        typedef map<pair<int, int>, LineSegment> emap;
-        emap edge_map;
+    const vector<int> &EulerCircuit::circuit(int nodes, const vector<LineSegment> &edges, int start) {
+        // The edges at each node as indices into edges, in compressed rows
+        offsets_.assign(nodes + 1, 0);
         for (const auto &edge : edges) {
-            int n1 = edge.start_id();
-            int n2 = edge.end_id();
-            graph[n1].emplace_back(edge);
-            graph[n2].emplace_back(edge);
-            edge_map.insert(emap::value_type(make_pair(min(n1, n2), max(n1, n2)), edge));
-        }
-        vector<int> result;
-        vector<int> stack;
-        stack.emplace_back(0);
-        while (!stack.empty()) {
-            int top = *stack.rbegin();
-            if (graph[top].empty()) {
-                result.emplace_back(top);
-                stack.pop_back();
+            ++offsets_[edge.start_id() + 1];
+            ++offsets_[edge.end_id() + 1];
+        }
+        partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+        cursor_.assign(offsets_.begin(), offsets_.end() - 1);
+        incident_.resize(offsets_[nodes]);
+        for (int i = 0; i < static_cast<int>(edges.size()); ++i) {
+            incident_[cursor_[edges[i].start_id()]++] = i;
+            incident_[cursor_[edges[i].end_id()]++] = i;
+        }
+        cursor_.assign(offsets_.begin(), offsets_.end() - 1);
+        used_.assign(edges.size(), 0);
+
+        result_.clear();
+        stack_.clear();
+        stack_.emplace_back(start);
+        while (!stack_.empty()) {
+            const int top = stack_.back();
+            int &cursor = cursor_[top];
+            while (cursor < offsets_[top + 1] && used_[incident_[cursor]]) {
+                ++cursor;
+            }
+            if (cursor == offsets_[top + 1]) {
+                result_.emplace_back(top);
+                stack_.pop_back();
             } else {
-                auto &edge = *graph[top].rbegin();
-                graph[top].pop_back();
-                int next = edge.id_not(top);
-                vector<LineSegment> &next_edges = graph[next];
-                next_edges.erase(find(next_edges.begin(), next_edges.end(), edge));
-                stack.emplace_back(next);
+                const int edge = incident_[cursor++];
+                used_[edge] = 1;
+                stack_.emplace_back(edges[edge].id_not(top));
             }
         }
 
-        return result;
+        return result_;
+    }
+
+
+    vector<int> hierholzer_path(int nodes, const vector<LineSegment>& edges) {
+        EulerCircuit euler;
+        return euler.circuit(nodes, edges);
+    }
+
+
+    namespace {
+        /// A tour as an array of nodes, with the position of each node in the array
+        class ArrayTour {
+            vector<int> &tour_;
+            vector<int> position_;
+
+            void update_positions() {
+                for (int i = 0; i < size(); ++i) {
+                    position_[tour_[i]] = i;
+                }
+            }
+
+        public:
+            explicit ArrayTour(vector<int> &tour) : tour_(tour), position_(tour.size()) {
+                update_positions();
+            }
+
+            [[nodiscard]] int size() const {
+                return static_cast<int>(tour_.size());
+            }
+
+            [[nodiscard]] int next(int node) const {
+                const int position = position_[node] + 1;
+                return tour_[position == size() ? 0 : position];
+            }
+
+            [[nodiscard]] int prev(int node) const {
+                const int position = position_[node];
+                return tour_[position == 0 ? size() - 1 : position - 1];
+            }
+
+            /// Replace the edges a-next(a) and c-next(c) by a-c and next(a)-next(c), reversing the shorter side
+            void two_opt(int a, int c) {
+                const int n = size();
+                int i = position_[next(a)];
+                int j = position_[c];
+                int length = (j - i + n) % n + 1;
+                if (2 * length > n) {
+                    i = position_[next(c)];
+                    j = position_[a];
+                    length = n - length;
+                }
+                for (int k = 0; k < length / 2; ++k) {
+                    swap(tour_[i], tour_[j]);
+                    position_[tour_[i]] = i;
+                    position_[tour_[j]] = j;
+                    i = i + 1 == n ? 0 : i + 1;
+                    j = j == 0 ? n - 1 : j - 1;
+                }
+            }
+
+            /// Move the path from \a first to \a last to between \a after and next(after), reversed if \a reversed
+            void move_segment(int first, int last, int after, bool reversed) {
+                vector<int> segment;
+                for (int node = first; ; node = next(node)) {
+                    segment.emplace_back(node);
+                    if (node == last) {
+                        break;
+                    }
+                }
+                if (reversed) {
+                    reverse(segment.begin(), segment.end());
+                }
+                vector<int> result;
+                result.reserve(size());
+                for (int node = next(last); node != first; node = next(node)) {
+                    result.emplace_back(node);
+                    if (node == after) {
+                        result.insert(result.end(), segment.begin(), segment.end());
+                    }
+                }
+                tour_ = move(result);
+                update_positions();
+            }
+        };
+    }
+
+
+    int improve_tour(const TSPInstance &instance,
+                     vector<int> &tour,
+                     const function<bool(int, int)> &allowed,
+                     const LocalSearchOptions &options) {
+        const int n = static_cast<int>(tour.size());
+        if (n < 8 || options.max_moves <= 0) {
+            return 0;
+        }
+        const CandidateGraph &candidates = instance.candidate_graph();
+        const auto start = chrono::steady_clock::now();
+        const auto out_of_time = [&] {
+            const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+            return options.time_limit > 0 && elapsed.count() > options.time_limit;
+        };
+        const auto length = [&](int a, int b) { return instance.length(a, b); };
+
+        ArrayTour array(tour);
+        // Nodes without their don't-look bit set, processed last in first out
+        vector<int> active(tour.rbegin(), tour.rend());
+        vector<char> is_active(instance.locations(), 0);
+        for (int node : tour) {
+            is_active[node] = 1;
+        }
+        const auto activate = [&](int node) {
+            if (!is_active[node]) {
+                is_active[node] = 1;
+                active.emplace_back(node);
+            }
+        };
+
+        int moves = 0;
+        int steps = 0;
+        while (!active.empty() && moves < options.max_moves) {
+            if ((++steps & 63) == 0 && out_of_time()) {
+                break;
+            }
+            const int a = active.back();
+            active.pop_back();
+            is_active[a] = 0;
+            const auto [neighbours_begin, neighbours_end] = candidates.neighbours(a);
+
+            // 2-opt, replacing a-b and c-e by a-c and b-e, with b and e both after or both before a and c
+            bool improved = false;
+            for (const bool forward : {true, false}) {
+                const int b = forward ? array.next(a) : array.prev(a);
+                const int ab = length(a, b);
+                for (const int *it = neighbours_begin; it != neighbours_end && !improved; ++it) {
+                    const int c = *it;
+                    const int ac = length(a, c);
+                    if (ac >= ab) {
+                        break;
+                    }
+                    const int e = forward ? array.next(c) : array.prev(c);
+                    if (c == b || e == a) {
+                        continue;
+                    }
+                    if (ac + length(b, e) < ab + length(c, e) && allowed(a, c) && allowed(b, e)) {
+                        if (forward) {
+                            array.two_opt(a, c);
+                        } else {
+                            array.two_opt(b, e);
+                        }
+                        improved = true;
+                        for (int node : {a, b, c, e}) {
+                            activate(node);
+                        }
+                    }
+                }
+                if (improved) {
+                    break;
+                }
+            }
 
-//        vector<LineSegment> result_edges;
-//        for (int i = 0; i < result.size(); ++i) {
-//            int n1 = result[i];
-//            int n2 = result[(i+1) % result.size()];
-//            auto key = make_pair(min(n1, n2), max(n1, n2));
-//            result_edges.emplace_back(edge_map.find(key)->second);
-//        }
-//
-//        return result_edges;
+            // Or-opt, moving the path of up to three nodes starting at a to between two other nodes
+            int last = a;
+            for (int segment_length = 1; segment_length <= 3 && !improved; ++segment_length) {
+                if (segment_length > 1) {
+                    last = array.next(last);
+                }
+                const int before = array.prev(a);
+                const int after = array.next(last);
+                if (before == last || after == before) {
+                    break;
+                }
+                const int gain = length(before, a) + length(last, after) - length(before, after);
+                if (gain <= 0) {
+                    continue;
+                }
+                const auto in_segment = [&](int node) {
+                    for (int member = a; ; member = array.next(member)) {
+                        if (member == node) {
+                            return true;
+                        }
+                        if (member == last) {
+                            return false;
+                        }
+                    }
+                };
+                for (const int end : {a, last}) {
+                    const auto [begin, finish] = candidates.neighbours(end);
+                    for (const int *it = begin; it != finish && !improved; ++it) {
+                        const int c = *it;
+                        if (length(end, c) >= gain) {
+                            break;
+                        }
+                        if (in_segment(c)) {
+                            continue;
+                        }
+                        for (const int u : {c, array.prev(c)}) {
+                            const int w = array.next(u);
+                            if (in_segment(u) || in_segment(w)) {
+                                continue;
+                            }
+                            const int forward = length(u, a) + length(last, w) - length(u, w);
+                            const int backward = length(u, last) + length(a, w) - length(u, w);
+                            const bool reversed = backward < forward;
+                            if (min(forward, backward) < gain && allowed(before, after) &&
+                                (reversed ? allowed(u, last) && allowed(a, w) : allowed(u, a) && allowed(last, w))) {
+                                array.move_segment(a, last, u, reversed);
+                                improved = true;
+                                for (int node : {a, last, before, after, u, w}) {
+                                    activate(node);
+                                }
+                                break;
+                            }
+                        }
+                    }
+                    if (improved) {
+                        break;
+                    }
+                }
+            }
+
+            if (improved) {
+                ++moves;
+            }
+        }
+
+        return moves;
     }
 
 
+
+    AdjacencyGraph::AdjacencyGraph(int nodes, vector<LineSegment> edges)
+            : edges_(move(edges)), offsets_(nodes + 1, 0), incident_()
+    {
+        edges_.erase(remove_if(edges_.begin(), edges_.end(), [](const LineSegment &edge) {
+            return edge.start_id() == edge.end_id();
+        }), edges_.end());
+
+        // Counting sort of the edge ends by node
+        for (const auto &edge : edges_) {
+            ++offsets_[edge.start_id() + 1];
+            ++offsets_[edge.end_id() + 1];
+        }
+        for (int node = 0; node < nodes; ++node) {
+            offsets_[node + 1] += offsets_[node];
+        }
+        incident_.resize(offsets_[nodes]);
+        vector<int> position(offsets_.begin(), offsets_.end() - 1);
+        for (int i = 0; i < static_cast<int>(edges_.size()); ++i) {
+            incident_[position[edges_[i].start_id()]++] = i;
+            incident_[position[edges_[i].end_id()]++] = i;
+        }
+    }
+
+
+    optional<OneTree> prim_1_tree(const AdjacencyGraph &graph,
+                                  int excluded_node,
+                                  const vector<LineSegment> &mandatory_edges,
+                                  const vector<double> &potentials,
+                                  PrimVariant variant)
+    {
+        const int nodes = graph.size();
+        const auto &edges = graph.edges();
+        assert(0 <= excluded_node && excluded_node < nodes && "The excluded node must be one of the nodes");
+        const auto penalised = [&](const LineSegment &edge) {
+            return potentials.empty()
+                   ? static_cast<double>(edge.length())
+                   : edge.length() + potentials[edge.start_id()] + potentials[edge.end_id()];
+        };
+
+        if (variant == PrimVariant::Automatic) {
+            // The heap costs about log n per edge, while the dense variant costs n per node
+            int log_nodes = 1;
+            while ((1 << log_nodes) < nodes) {
+                ++log_nodes;
+            }
+            variant = static_cast<double>(graph.edges().size()) * log_nodes > static_cast<double>(nodes) * nodes
+                      ? PrimVariant::Dense
+                      : PrimVariant::Heap;
+        }
+
+        // The mandatory edges at each node, at most two per node in a tour
+        vector<int> mandatory_at(2 * nodes, -1);
+        for (int i = 0; i < static_cast<int>(mandatory_edges.size()); ++i) {
+            for (const int node : {mandatory_edges[i].start_id(), mandatory_edges[i].end_id()}) {
+                if (mandatory_at[2 * node] == -1) {
+                    mandatory_at[2 * node] = i;
+                } else if (mandatory_at[2 * node + 1] == -1) {
+                    mandatory_at[2 * node + 1] = i;
+                } else {
+                    // More than two mandatory edges at a node
+                    return optional<OneTree>();
+                }
+            }
+        }
+
+        // The tree edge to each node, either an index in edges, or -2 - index in mandatory_edges
+        constexpr int no_edge = -1;
+        const auto tree_edge = [&](int index) -> const LineSegment & {
+            return index >= 0 ? edges[index] : mandatory_edges[-2 - index];
+        };
+        vector<double> key(nodes, numeric_limits<double>::infinity());
+        vector<int> parent(nodes, no_edge);
+        vector<bool> in_tree(nodes, false);
+        in_tree[excluded_node] = true;
+
+        // Mandatory edges get the lowest possible key, so the tree is the minimum tree containing them
+        const auto relax = [&](int node, const auto &update) {
+            for (int slot = 2 * node; slot < 2 * node + 2 && mandatory_at[slot] != -1; ++slot) {
+                const int other = mandatory_edges[mandatory_at[slot]].id_not(node);
+                if (!in_tree[other]) {
+                    update(other, -numeric_limits<double>::infinity(), -2 - mandatory_at[slot]);
+                }
+            }
+            const auto [begin, end] = graph.incident(node);
+            for (const int *index = begin; index != end; ++index) {
+                const int other = edges[*index].id_not(node);
+                if (!in_tree[other]) {
+                    update(other, penalised(edges[*index]), *index);
+                }
+            }
+        };
+
+        vector<LineSegment> mst_edges;
+        mst_edges.reserve(nodes);
+        const int root = excluded_node == 0 ? 1 % nodes : 0;
+        key[root] = -numeric_limits<double>::infinity();
+        if (variant == PrimVariant::Dense) {
+            const auto update = [&](int other, double weight, int index) {
+                if (weight < key[other]) {
+                    key[other] = weight;
+                    parent[other] = index;
+                }
+            };
+            for (int added = 1; added < nodes; ++added) {
+                int next = -1;
+                for (int node = 0; node < nodes; ++node) {
+                    if (!in_tree[node] && (next == -1 || key[node] < key[next])) {
+                        next = node;
+                    }
+                }
+                if (next == -1 || key[next] == numeric_limits<double>::infinity()) {
+                    return optional<OneTree>();
+                }
+                in_tree[next] = true;
+                if (parent[next] != no_edge) {
+                    mst_edges.emplace_back(tree_edge(parent[next]));
+                }
+                relax(next, update);
+            }
+        } else {
+            priority_queue<pair<double, int>, vector<pair<double, int>>, greater<>> queue;
+            const auto update = [&](int other, double weight, int index) {
+                if (weight < key[other]) {
+                    key[other] = weight;
+                    parent[other] = index;
+                    queue.emplace(weight, other);
+                }
+            };
+            queue.emplace(key[root], root);
+            int added = 1;
+            while (!queue.empty()) {
+                const auto [weight, next] = queue.top();
+                queue.pop();
+                if (in_tree[next] || weight > key[next]) {
+                    // Stale entry
+                    continue;
+                }
+                in_tree[next] = true;
+                ++added;
+                if (parent[next] != no_edge) {
+                    mst_edges.emplace_back(tree_edge(parent[next]));
+                }
+                relax(next, update);
+            }
+            if (added < nodes) {
+                return optional<OneTree>();
+            }
+        }
+
+        // The mandatory edges at the excluded node, and then the shortest other edges to different nodes
+        vector<LineSegment> extra_edges;
+        for (int slot = 2 * excluded_node; slot < 2 * excluded_node + 2 && mandatory_at[slot] != -1; ++slot) {
+            extra_edges.emplace_back(mandatory_edges[mandatory_at[slot]]);
+        }
+        const auto [begin, end] = graph.incident(excluded_node);
+        while (extra_edges.size() < 2) {
+            int best = -1;
+            for (const int *index = begin; index != end; ++index) {
+                const int other = edges[*index].id_not(excluded_node);
+                const bool used = any_of(extra_edges.begin(), extra_edges.end(), [&](const LineSegment &extra) {
+                    return extra.id_not(excluded_node) == other;
+                });
+                if (!used && (best == -1 || penalised(edges[*index]) < penalised(edges[best]))) {
+                    best = *index;
+                }
+            }
+            if (best == -1) {
+                return optional<OneTree>();
+            }
+            extra_edges.emplace_back(edges[best]);
+        }
+
+        return OneTree(nodes, excluded_node, make_pair(extra_edges[0], extra_edges[1]), move(mst_edges));
+    }
+
+
+    optional<HeldKarpBound> held_karp_1_tree(int nodes,
+                                             int excluded_node,
+                                             const vector<LineSegment> &mandatory_edges,
+                                             const AdjacencyGraph &graph,
+                                             int upper_bound,
+                                             vector<double> potentials,
+                                             int iterations,
+                                             const HeldKarpOptions &options)
+    {
+        if (potentials.size() != static_cast<size_t>(nodes)) {
+            potentials.assign(nodes, 0.0);
+        }
+
+        optional<HeldKarpBound> best;
+        double best_bound = -numeric_limits<double>::infinity();
+        double step = options.initial_step;
+        vector<double> subgradient(nodes);
+        for (int iteration = 0; iteration < max(iterations, 1); ++iteration) {
+            // Prim uses the changed lengths directly, so the edges need not be sorted again for each iteration
+            auto one_tree = prim_1_tree(graph, excluded_node, mandatory_edges, potentials);
+            if (!one_tree.has_value()) {
+                return optional<HeldKarpBound>();
+            }
+
+            // The subgradient of the bound is the degree of each node minus 2
+            double bound = one_tree->size();
+            double norm = 0;
+            for (int i = 0; i < nodes; ++i) {
+                subgradient[i] = static_cast<double>(one_tree->edges_at(i).size()) - 2;
+                bound += subgradient[i] * potentials[i];
+                norm += subgradient[i] * subgradient[i];
+            }
+
+            if (bound > best_bound) {
+                best_bound = bound;
+                // Tour lengths are integers, the small tolerance guards against rounding errors in the potentials
+                best.emplace(HeldKarpBound{static_cast<int>(ceil(bound - 1e-6)), potentials, move(one_tree.value())});
+            }
+
+            if (norm == 0 || best_bound > upper_bound) {
+                // Either the 1-tree is a tour, or the bound is already enough for failing
+                break;
+            }
+
+            const double gap = min(static_cast<double>(upper_bound) - bound, options.max_gap * max(abs(bound), 1.0));
+            const double size = step * max(gap, 1.0) / norm;
+            for (int i = 0; i < nodes; ++i) {
+                // Nodes with a high degree get a higher penalty, and leaves get a lower penalty
+                potentials[i] += size * subgradient[i];
+            }
+            step *= options.step_decay;
+        }
+
+        return best;
+    }
+
+
+    PathMaxima::PathMaxima(int nodes, const vector<LineSegment> &edges, const vector<double> &weights)
+            : depth_(nodes, -1)
+    {
+        vector<vector<pair<int, double>>> adjacent(nodes);
+        for (size_t i = 0; i < edges.size(); ++i) {
+            adjacent[edges[i].start_id()].emplace_back(edges[i].end_id(), weights[i]);
+            adjacent[edges[i].end_id()].emplace_back(edges[i].start_id(), weights[i]);
+        }
+
+        int levels = 1;
+        while ((1 << levels) < nodes) {
+            ++levels;
+        }
+        up_.assign(levels, vector<int>(nodes, -1));
+        max_.assign(levels, vector<double>(nodes, -numeric_limits<double>::infinity()));
+
+        // Breadth first from each unvisited node, so parents are set before their children
+        vector<int> queue;
+        queue.reserve(nodes);
+        for (int root = 0; root < nodes; ++root) {
+            if (depth_[root] != -1) {
+                continue;
+            }
+            depth_[root] = 0;
+            queue.clear();
+            queue.emplace_back(root);
+            for (size_t head = 0; head < queue.size(); ++head) {
+                const int node = queue[head];
+                for (const auto &[next, weight] : adjacent[node]) {
+                    if (depth_[next] == -1) {
+                        depth_[next] = depth_[node] + 1;
+                        up_[0][next] = node;
+                        max_[0][next] = weight;
+                        queue.emplace_back(next);
+                    }
+                }
+            }
+        }
+
+        for (int level = 1; level < levels; ++level) {
+            for (int node = 0; node < nodes; ++node) {
+                const int half = up_[level - 1][node];
+                if (half != -1) {
+                    up_[level][node] = up_[level - 1][half];
+                    max_[level][node] = max(max_[level - 1][node], max_[level - 1][half]);
+                }
+            }
+        }
+    }
+
+
+    optional<double> PathMaxima::max_on_path(int a, int b) const {
+        double result = -numeric_limits<double>::infinity();
+        if (depth_[a] < depth_[b]) {
+            swap(a, b);
+        }
+        for (int level = static_cast<int>(up_.size()) - 1; level >= 0; --level) {
+            if (depth_[a] - (1 << level) >= depth_[b]) {
+                result = max(result, max_[level][a]);
+                a = up_[level][a];
+            }
+        }
+        if (a == b) {
+            return result;
+        }
+        for (int level = static_cast<int>(up_.size()) - 1; level >= 0; --level) {
+            if (up_[level][a] != up_[level][b]) {
+                result = max({result, max_[level][a], max_[level][b]});
+                a = up_[level][a];
+                b = up_[level][b];
+            }
+        }
+        if (up_[0][a] == -1 || up_[0][a] != up_[0][b]) {
+            // Different trees in the forest
+            return optional<double>();
+        }
+        return max({result, max_[0][a], max_[0][b]});
+    }
+
+
+    vector<LineSegment> one_tree_excluded_edges(const OneTree &one_tree,
+                                                const vector<double> &potentials,
+                                                const vector<LineSegment> &mandatory_edges,
+                                                const vector<LineSegment> &edges,
+                                                int upper_bound)
+    {
+        const auto potential = [&](int node) {
+            return potentials.empty() ? 0.0 : potentials[node];
+        };
+        const auto penalised = [&](const LineSegment &edge) {
+            return edge.length() + potential(edge.start_id()) + potential(edge.end_id());
+        };
+        const auto key = [](const LineSegment &edge) {
+            return make_pair(min(edge.start_id(), edge.end_id()), max(edge.start_id(), edge.end_id()));
+        };
+        set<pair<int, int>> mandatory;
+        for (const auto &edge : mandatory_edges) {
+            mandatory.emplace(key(edge));
+        }
+
+        // The bound of the 1-tree with the changed lengths
+        const int nodes = one_tree.nodes();
+        double bound = one_tree.size();
+        for (int i = 0; i < nodes; ++i) {
+            bound += (static_cast<double>(one_tree.edges_at(i).size()) - 2) * potential(i);
+        }
+
+        // Mandatory edges can not be replaced, so they never count as the longest edge
+        const auto replaceable_weight = [&](const LineSegment &edge) {
+            return mandatory.count(key(edge)) == 1 ? -numeric_limits<double>::infinity() : penalised(edge);
+        };
+        const auto &mst_edges = one_tree.mst().edges();
+        vector<double> weights;
+        weights.reserve(mst_edges.size());
+        for (const auto &edge : mst_edges) {
+            weights.emplace_back(replaceable_weight(edge));
+        }
+        const PathMaxima path_maxima(nodes, mst_edges, weights);
+        const int excluded_node = one_tree.extra_node();
+        const double longest_extra = max(replaceable_weight(one_tree.extra_edges().first),
+                                         replaceable_weight(one_tree.extra_edges().second));
+
+        vector<LineSegment> result;
+        for (const auto &edge : edges) {
+            if (mandatory.count(key(edge)) == 1) {
+                continue;
+            }
+            double replaced;
+            if (connected(edge, excluded_node)) {
+                replaced = longest_extra;
+            } else {
+                const auto path_max = path_maxima.max_on_path(edge.start_id(), edge.end_id());
+                if (!path_max.has_value()) {
+                    continue;
+                }
+                replaced = path_max.value();
+            }
+            // Tour lengths are integers, the small tolerance guards against rounding errors in the potentials
+            const double forced_bound = bound + penalised(edge) - replaced;
+            if (ceil(forced_bound - 1e-6) > upper_bound) {
+                result.emplace_back(edge);
+            }
+        }
+
+        return result;
+    }
 }
\ No newline at end of file
@@ -5,6 +5,10 @@
 #include "disjoint-set.h"
 #include "tsp.h"
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -42,7 +46,9 @@ namespace hc {
         }
 
         [[nodiscard]] const std::vector<LineSegment> &edges_at(int node) const {
-            return edges_by_node_.at(node);
+            static const std::vector<LineSegment> no_edges;
+            // Nodes after the last node with an edge are not stored
+            return node < static_cast<int>(edges_by_node_.size()) ? edges_by_node_[node] : no_edges;
         }
 
         [[nodiscard]] int size() const {
@@ -75,6 +81,10 @@ namespace hc {
             edges_by_node_[extra_edges_.second.end_id()].emplace_back(extra_edges_.second);
         }
 
+        [[nodiscard]] int nodes() const {
+            return nodes_;
+        }
+
         [[nodiscard]] int extra_node() const {
             return extra_node_;
         }
@@ -110,13 +120,315 @@ namespace hc {
                            const std::function<bool(const LineSegment &)> &filter);
 
 
+    /// Largest number of nodes matched exactly by \a min_perfect_matching
+    constexpr int exact_matching_limit = 96;
+
+    /**
+     * Perfect matching of \a nodes with a small total length.
+     *
+     * Up to \a exact_limit nodes a minimum perfect matching over all edges between the nodes is found using
+     * Edmonds' blossom algorithm. Larger sets are matched greedily over \a edges, the nodes left over greedily
+     * over all edges between them, and the result is improved by exchanging the ends of two matched edges
+     * while that makes the matching shorter.
+     *
+     * @param nodes The nodes to match, an even number of distinct nodes
+     * @param edges Edges between \a nodes to prefer for large sets, ordered by length
+     */
+    std::vector<LineSegment> min_perfect_matching(const TSPInstance &instance,
+                                                  const std::vector<int> &nodes,
+                                                  const std::vector<LineSegment> &edges,
+                                                  int exact_limit = exact_matching_limit);
+
+
+    /**
+     * Euler circuits using Hierholzer's algorithm, over adjacency arrays with a used flag per edge and a cursor per
+     * node, so each edge is looked at twice. The buffers are kept between calls.
+     */
+    class EulerCircuit {
+        /// The edges at node i are incident_[offsets_[i]] to incident_[offsets_[i + 1] - 1]
+        std::vector<int> offsets_;
+        std::vector<int> incident_;
+        /// The next position in incident_ to look at for each node
+        std::vector<int> cursor_;
+        std::vector<char> used_;
+        std::vector<int> stack_;
+        std::vector<int> result_;
+    public:
+        /**
+         * Euler circuit using all of \a edges, starting and ending in \a start.
+         *
+         * Every node must have an even number of edges, and all edges must be reachable from \a start.
+         *
+         * @return The nodes in the order visited, with \a start first and last, valid until the next call
+         */
+        const std::vector<int> &circuit(int nodes, const std::vector<LineSegment> &edges, int start = 0);
+    };
+
+    /// Euler circuit using all of \a edges starting and ending in node 0, see \a EulerCircuit
+    std::vector<int> hierholzer_path(int nodes, const std::vector<LineSegment>& edges);
+
+
+    /**
+     * Christofides heuristic starting from a spanning tree.
+     *
+     * @param mst The spanning tree to use
+     * @param edges The edges to use for matching odd nodes, ordered by length
+     * @param euler Buffers for the Euler circuit, which can be reused between calls
+     */
+    std::optional<std::vector<LineSegment>> christofides_from_mst(const std::shared_ptr<const TSPInstance> &instance,
+                                                                  int nodes,
+                                                                  const MST &mst,
+                                                                  const std::vector<LineSegment> &edges,
+                                                                  EulerCircuit &euler);
+
+
     std::optional<std::vector<LineSegment>> christofides(std::shared_ptr<const TSPInstance> instance,
                                           int nodes,
                                           const std::vector<LineSegment> &mandatory_edges,
                                           const std::vector<LineSegment> &edges,
                                           const std::function<bool(const LineSegment &)> &filter);
 
-    std::vector<int> hierholzer_path(int nodes, const std::vector<LineSegment>& vector);
+
+    /**
+     * Minimum spanning tree over the candidate graph of \a instance.
+     *
+     * Falls back to all edges of the instance when the candidate edges accepted by \a filter do not connect all
+     * the nodes, so the result is the same as for \a kruskal with all edges unless the candidate graph misses
+     * an edge of every minimum spanning tree.
+     */
+    MST kruskal(const TSPInstance &instance,
+                const std::vector<LineSegment> &mandatory_edges,
+                const std::function<bool(const LineSegment &)> &filter);
+
+
+    /**
+     * Minimum 1-tree over the candidate graph of \a instance, falling back to all edges of the instance when
+     * the candidate edges accepted by \a filter do not make up a 1-tree.
+     */
+    OneTree kruskal_1_tree(const TSPInstance &instance,
+                           int excluded_node,
+                           const std::vector<LineSegment> &mandatory_edges,
+                           const std::function<bool(const LineSegment &)> &filter);
+
+
+    /**
+     * Christofides heuristic using the candidate graph of \a instance for the spanning tree and the matching.
+     */
+    std::optional<std::vector<LineSegment>> christofides(std::shared_ptr<const TSPInstance> instance,
+                                                         const std::vector<LineSegment> &mandatory_edges,
+                                                         const std::function<bool(const LineSegment &)> &filter);
+
+
+    /// Limits for the local search improving a tour
+    struct LocalSearchOptions {
+        /// Largest number of improving moves, 0 disables the local search
+        int max_moves = 1000;
+        /// Time limit in milliseconds, 0 for no limit
+        double time_limit = 1.0;
+    };
+
+    /**
+     * Improve \a tour using 2-opt and Or-opt moves, with the candidate graph of \a instance as neighbour lists and
+     * don't-look bits for the nodes where no improving move was found.
+     *
+     * Only moves where all the added edges are accepted by \a allowed are made, edges already in the tour are kept
+     * even when not allowed.
+     *
+     * @param tour The nodes in the order visited, the last node is followed by the first
+     * @param allowed True if the edge between the two nodes may be added to the tour
+     * @return The number of moves made
+     */
+    int improve_tour(const TSPInstance &instance,
+                     std::vector<int> &tour,
+                     const std::function<bool(int, int)> &allowed,
+                     const LocalSearchOptions &options = LocalSearchOptions());
+
+
+    /**
+     * Sorting of edges by length using a radix sort on the lengths, keeping the buffers between calls.
+     *
+     * Equal lengths keep their order, as for a stable sort.
+     */
+    class EdgeSorter {
+        std::vector<std::uint64_t> keys_;
+        std::vector<std::uint64_t> scratch_;
+        std::vector<LineSegment> sorted_;
+    public:
+        void sort_by_length(std::vector<LineSegment> &edges);
+    };
+
+
+    /**
+     * Minimum spanning tree that is repaired instead of recomputed when the allowed edges change.
+     *
+     * Between calls to \a update, the edges accepted by the filter may only be removed and mandatory edges may only be
+     * added, as for the domains of a propagator during search. Tree edges that are still allowed stay in a minimum
+     * spanning tree, so only the components left by removed tree edges are reconnected. Each new mandatory edge then
+     * replaces the longest non-mandatory edge on the cycle it closes.
+     *
+     * Copying is cheap compared to recomputing the tree, so the structure can be stored in propagators.
+     */
+    class IncrementalMST {
+        int nodes_ = -1;
+        int excluded_node_ = -1;
+        std::optional<MST> mst_;
+        /// Sets reused between updates
+        UnionFind sets_ = UnionFind(0);
+    public:
+        /**
+         * Update the tree to a minimum spanning tree containing \a mandatory_edges over the edges accepted by \a filter.
+         *
+         * The tree is rebuilt from scratch on the first call, or when \a nodes or \a excluded_node changes.
+         *
+         * @param excluded_node Node that is not part of the tree (as in a 1-tree), or -1 for none
+         * @param edges All edges that may be accepted, ordered by length
+         * @return The tree, which is a forest if the accepted edges do not connect the nodes
+         */
+        const MST &update(int nodes,
+                          int excluded_node,
+                          const std::vector<LineSegment> &mandatory_edges,
+                          const std::vector<LineSegment> &edges,
+                          const std::function<bool(const LineSegment &)> &filter);
+    };
+
+
+    /**
+     * Undirected graph over a set of edges, as adjacency lists in compressed sparse row form.
+     *
+     * An edge given in both directions is stored as two edges.
+     */
+    class AdjacencyGraph {
+        std::vector<LineSegment> edges_;
+        /// The edges at node i are edges_[incident_[j]] for j from offsets_[i] to offsets_[i + 1] - 1
+        std::vector<int> offsets_;
+        std::vector<int> incident_;
+    public:
+        /// Graph over \a edges, edges from a node to itself are left out
+        AdjacencyGraph(int nodes, std::vector<LineSegment> edges);
+
+        [[nodiscard]] int size() const {
+            return static_cast<int>(offsets_.size()) - 1;
+        }
+
+        [[nodiscard]] const std::vector<LineSegment> &edges() const {
+            return edges_;
+        }
+
+        /// The indices in \a edges of the edges at \a node, as a pair of pointers [begin, end)
+        [[nodiscard]] std::pair<const int *, const int *> incident(int node) const {
+            return std::make_pair(incident_.data() + offsets_[node], incident_.data() + offsets_[node + 1]);
+        }
+    };
+
+
+    /// Variants of Prim's algorithm
+    enum class PrimVariant {
+        /// Choose the variant from the number of edges
+        Automatic,
+        /// Scan all nodes for the next node to add, O(n^2 + m) time
+        Dense,
+        /// Binary heap of the edges to the tree, O(m log n) time
+        Heap,
+    };
+
+    /**
+     * Minimum 1-tree using Prim's algorithm, with the length of an edge i-j changed to
+     * length + potentials[i] + potentials[j].
+     *
+     * Unlike \a kruskal_1_tree, the edges need not be ordered by length.
+     *
+     * @param mandatory_edges Edges that must be used, which need not be part of \a graph
+     * @param potentials Potentials for the nodes, all zero if empty
+     * @return The minimum 1-tree with the original lengths, or nothing if the edges do not make up a 1-tree
+     */
+    std::optional<OneTree> prim_1_tree(const AdjacencyGraph &graph,
+                                       int excluded_node,
+                                       const std::vector<LineSegment> &mandatory_edges,
+                                       const std::vector<double> &potentials,
+                                       PrimVariant variant = PrimVariant::Automatic);
+
+
+    /// Parameters for the Held-Karp subgradient optimisation of node potentials
+    struct HeldKarpOptions {
+        /// Number of subgradient iterations when starting from zero potentials
+        int iterations = 50;
+        /// Number of subgradient iterations when starting from earlier potentials
+        int warm_iterations = 5;
+        /// Initial step size factor, the step is this times the gap to the upper bound over the squared subgradient
+        double initial_step = 1.0;
+        /// Factor the step size factor is multiplied by after each iteration
+        double step_decay = 0.95;
+        /// The gap used for the step size is at most this fraction of the current bound
+        double max_gap = 0.05;
+    };
+
+    /// Result of the Held-Karp subgradient optimisation
+    struct HeldKarpBound {
+        /// Lower bound on the length of any tour that uses the mandatory edges and otherwise only the given edges
+        int bound;
+        /// The potentials giving the best bound
+        std::vector<double> potentials;
+        /// The minimum 1-tree for the best potentials, with the original lengths
+        OneTree one_tree;
+    };
+
+    /**
+     * Held-Karp lower bound, maximising the 1-tree bound over node potentials using subgradient optimisation.
+     *
+     * The length of an edge i-j is changed to length + potentials[i] + potentials[j], and the bound for the
+     * minimum 1-tree with the changed lengths is its length minus twice the sum of the potentials. Potentials are
+     * moved in the direction of the degree of each node minus 2, with a step size based on the gap to
+     * \a upper_bound.
+     *
+     * @param graph The edges that may be used
+     * @param upper_bound Upper bound for the tour length, used for the step size
+     * @param potentials Potentials to start from, all zero if empty
+     * @param iterations Maximum number of iterations
+     * @return The best bound found, or nothing if the edges do not make up a 1-tree
+     */
+    std::optional<HeldKarpBound> held_karp_1_tree(int nodes,
+                                                  int excluded_node,
+                                                  const std::vector<LineSegment> &mandatory_edges,
+                                                  const AdjacencyGraph &graph,
+                                                  int upper_bound,
+                                                  std::vector<double> potentials,
+                                                  int iterations,
+                                                  const HeldKarpOptions &options);
+
+
+    /**
+     * Maximum edge weight on the path between two nodes in a forest, using binary lifting.
+     *
+     * Construction takes O(n log n) time and each query O(log n) time.
+     */
+    class PathMaxima {
+        std::vector<int> depth_;
+        /// Ancestor 2^k steps up for each level k and node, -1 above the root
+        std::vector<std::vector<int>> up_;
+        /// Maximum edge weight on the 2^k steps up for each level k and node
+        std::vector<std::vector<double>> max_;
+    public:
+        PathMaxima(int nodes, const std::vector<LineSegment> &edges, const std::vector<double> &weights);
+
+        /// The maximum weight on the path between \a a and \a b, or nothing if they are not connected
+        [[nodiscard]] std::optional<double> max_on_path(int a, int b) const;
+    };
+
+    /**
+     * Edges that can not be part of any tour of length at most \a upper_bound.
+     *
+     * Uses the replacement cost of forcing each edge into \a one_tree, which must be a minimum 1-tree for the lengths
+     * changed by \a potentials (all zero if empty) over the mandatory edges and \a edges. An edge not at the excluded
+     * node replaces the longest non-mandatory edge on the tree path between its end points, and an edge at the
+     * excluded node replaces the longest non-mandatory extra edge.
+     *
+     * @param edges The edges to check, mandatory edges and edges in the 1-tree are never returned
+     */
+    std::vector<LineSegment> one_tree_excluded_edges(const OneTree &one_tree,
+                                                     const std::vector<double> &potentials,
+                                                     const std::vector<LineSegment> &mandatory_edges,
+                                                     const std::vector<LineSegment> &edges,
+                                                     int upper_bound);
 
 
 }
@@ -0,0 +1,294 @@
+#include "utilities/instance_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    constexpr size_t alignment = 8;
+
+    size_t padded(size_t bytes) {
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    /// Reads consecutive aligned arrays from a cache, checking that they are within the data
+    class CacheReader {
+        const char *position_;
+        const char *end_;
+    public:
+        CacheReader(const char *begin, const char *end) : position_(begin), end_(end) {}
+
+        /// The next \a count values, or nullptr if the data is too short
+        template<typename T>
+        const T *take(uint64_t count) {
+            const uint64_t bytes = count * sizeof(T);
+            if (count > static_cast<uint64_t>(end_ - position_) / sizeof(T) ||
+                padded(bytes) > static_cast<uint64_t>(end_ - position_)) {
+                return nullptr;
+            }
+            const T *result = reinterpret_cast<const T *>(position_);
+            position_ += padded(bytes);
+            return result;
+        }
+    };
+
+    /// True iff \a offsets are \a count + 1 values that start at 0, never decrease, and end at \a total
+    template<typename T>
+    bool valid_offsets(const T *offsets, uint64_t count, uint64_t total) {
+        if (offsets[0] != 0 || static_cast<uint64_t>(offsets[count]) != total) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            if (offsets[i + 1] < offsets[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// True iff all \a count values in \a ids are nodes, from 0 to \a nodes - 1
+    bool valid_nodes(const int32_t *ids, uint64_t count, int nodes) {
+        return all_of(ids, ids + count, [nodes](int32_t id) { return id >= 0 && id < nodes; });
+    }
+
+    /// Writes consecutive aligned arrays to a cache
+    class CacheWriter {
+        ofstream &out_;
+    public:
+        explicit CacheWriter(ofstream &out) : out_(out) {}
+
+        template<typename T>
+        void put(const T *data, size_t count) {
+            const size_t bytes = count * sizeof(T);
+            out_.write(reinterpret_cast<const char *>(data), bytes);
+            static const char zeros[alignment] = {};
+            out_.write(zeros, padded(bytes) - bytes);
+        }
+
+        template<typename T>
+        void put(const vector<T> &data) {
+            put(data.data(), data.size());
+        }
+    };
+}
+
+namespace hc {
+    bool is_instance_cache(const char *begin, const char *end) {
+        return end - begin >= static_cast<ptrdiff_t>(sizeof(InstanceCacheHeader)) &&
+               memcmp(begin, InstanceCacheHeader::expected_magic, sizeof(InstanceCacheHeader::expected_magic)) == 0;
+    }
+
+    Result<TSPInstance, TSPReadError> parse_instance_cache(const char *begin, const char *end) {
+        const auto wrong_format = [](const string &text) {
+            return Err(TSPReadError(TSPReadError::Kind::WrongFormat, text));
+        };
+        CacheReader in(begin, end);
+
+        const InstanceCacheHeader *header = in.take<InstanceCacheHeader>(1);
+        if (header == nullptr || !is_instance_cache(begin, end)) {
+            return wrong_format("Not an instance cache.");
+        }
+        if (header->byte_order != InstanceCacheHeader::expected_byte_order) {
+            return wrong_format("Instance cache was written on a machine with another byte order.");
+        }
+        if (header->version != InstanceCacheHeader::current_version) {
+            return wrong_format("Instance cache has version " + to_string(header->version) + ", expected version " +
+                                to_string(InstanceCacheHeader::current_version) + ". Regenerate the cache.");
+        }
+        if (header->edge_weight_type > static_cast<uint32_t>(EdgeWeightType::Explicit) ||
+            header->nodes > static_cast<uint64_t>(numeric_limits<int>::max())) {
+            return wrong_format("Instance cache header is corrupt.");
+        }
+        const auto type = static_cast<EdgeWeightType>(header->edge_weight_type);
+        const int nodes = static_cast<int>(header->nodes);
+
+        const char *name = in.take<char>(header->name_bytes);
+        const int32_t *xs = in.take<int32_t>(nodes);
+        const int32_t *ys = in.take<int32_t>(nodes);
+        if (name == nullptr || xs == nullptr || ys == nullptr) {
+            return wrong_format("Instance cache is truncated.");
+        }
+        vector<int> x_coordinates(xs, xs + nodes);
+        vector<int> y_coordinates(ys, ys + nodes);
+
+        const auto make_distances = [&]() -> optional<DistanceOracle> {
+            switch (type) {
+                case EdgeWeightType::Euc2D:
+                case EdgeWeightType::Ceil2D:
+                case EdgeWeightType::Att:
+                    return DistanceOracle(type, move(x_coordinates), move(y_coordinates), header->coordinate_scale);
+                case EdgeWeightType::Geo: {
+                    const double *latitudes = in.take<double>(nodes);
+                    const double *longitudes = in.take<double>(nodes);
+                    if (latitudes == nullptr || longitudes == nullptr) {
+                        return optional<DistanceOracle>();
+                    }
+                    return DistanceOracle::make_geo_from_radians(vector<double>(latitudes, latitudes + nodes),
+                                                                 vector<double>(longitudes, longitudes + nodes),
+                                                                 move(x_coordinates), move(y_coordinates));
+                }
+                case EdgeWeightType::Explicit: {
+                    const int32_t *lengths = in.take<int32_t>(static_cast<uint64_t>(nodes) * nodes);
+                    if (lengths == nullptr) {
+                        return optional<DistanceOracle>();
+                    }
+                    const size_t count = static_cast<size_t>(nodes) * nodes;
+                    const int32_t max_length = count == 0 ? 0 : *max_element(lengths, lengths + count);
+                    auto matrix = make_shared<const DistanceMatrix>(nodes, max_length, [&](int i, int j) {
+                        return lengths[static_cast<size_t>(i) * nodes + j];
+                    });
+                    return DistanceOracle::make_explicit(move(matrix), move(x_coordinates), move(y_coordinates));
+                }
+            }
+            return optional<DistanceOracle>();
+        };
+        optional<DistanceOracle> distances = make_distances();
+        if (!distances.has_value()) {
+            return wrong_format("Instance cache is truncated.");
+        }
+
+        const int32_t *candidate_offsets = in.take<int32_t>(static_cast<uint64_t>(nodes) + 1);
+        const int32_t *candidate_neighbours = in.take<int32_t>(header->candidate_neighbours);
+        const int32_t *candidate_edges = in.take<int32_t>(2 * header->candidate_neighbours);
+        if (candidate_offsets == nullptr || candidate_neighbours == nullptr || candidate_edges == nullptr) {
+            return wrong_format("Instance cache is truncated.");
+        }
+        if (!valid_offsets(candidate_offsets, nodes, header->candidate_neighbours) ||
+            !valid_nodes(candidate_neighbours, header->candidate_neighbours, nodes) ||
+            !valid_nodes(candidate_edges, 2 * header->candidate_neighbours, nodes)) {
+            return wrong_format("Instance cache is corrupt.");
+        }
+        vector<pair<int, int>> edges;
+        edges.reserve(header->candidate_neighbours);
+        for (uint64_t i = 0; i < header->candidate_neighbours; ++i) {
+            edges.emplace_back(candidate_edges[2 * i], candidate_edges[2 * i + 1]);
+        }
+
+        TSPInstance instance(string(name, header->name_bytes), move(distances.value()));
+        instance.preload_candidate_graph(CandidateGraph(
+                instance.distances(),
+                vector<int>(candidate_offsets, candidate_offsets + nodes + 1),
+                vector<int>(candidate_neighbours, candidate_neighbours + header->candidate_neighbours),
+                edges));
+
+        if (header->has_dominated_edges != 0) {
+            const uint64_t *from_offsets = in.take<uint64_t>(static_cast<uint64_t>(nodes) + 1);
+            const int32_t *keys = in.take<int32_t>(header->dominated_keys);
+            const uint64_t *edge_offsets = in.take<uint64_t>(header->dominated_keys + 1);
+            const int32_t *dominated = in.take<int32_t>(2 * header->dominated_edges);
+            if (from_offsets == nullptr || keys == nullptr || edge_offsets == nullptr || dominated == nullptr) {
+                return wrong_format("Instance cache is truncated.");
+            }
+            if (!valid_offsets(from_offsets, nodes, header->dominated_keys) ||
+                !valid_offsets(edge_offsets, header->dominated_keys, header->dominated_edges) ||
+                !valid_nodes(keys, header->dominated_keys, nodes) ||
+                !valid_nodes(dominated, 2 * header->dominated_edges, nodes)) {
+                return wrong_format("Instance cache is corrupt.");
+            }
+            instance.preload_dominated_edges(
+                    DominatedEdges::make_from_flat(nodes, from_offsets, keys, edge_offsets, dominated));
+        }
+
+        return Ok(move(instance));
+    }
+
+    bool write_instance_cache(const TSPInstance &instance, const string &file_name, bool with_dominated_edges) {
+        ofstream out(file_name, ios::binary | ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        CacheWriter writer(out);
+        const DistanceOracle &distances = instance.distances();
+        const CandidateGraph &candidates = instance.candidate_graph();
+        const int nodes = instance.locations();
+
+        // Flatten the dominated edges first, so that the header can be written in one go
+        vector<uint64_t> from_offsets;
+        vector<int32_t> keys;
+        vector<uint64_t> edge_offsets;
+        vector<int32_t> dominated;
+        if (with_dominated_edges) {
+            from_offsets.assign(static_cast<size_t>(nodes) + 1, 0);
+            edge_offsets.emplace_back(0);
+            instance.dominated_edges().for_each([&](int from, int to, const DominatedEdges::Range &edges) {
+                from_offsets[from + 1] += 1;
+                keys.emplace_back(to);
+                for (const auto &edge : edges) {
+                    dominated.emplace_back(edge.from());
+                    dominated.emplace_back(edge.to());
+                }
+                edge_offsets.emplace_back(dominated.size() / 2);
+            });
+            for (int from = 0; from < nodes; ++from) {
+                from_offsets[from + 1] += from_offsets[from];
+            }
+        }
+
+        InstanceCacheHeader header{};
+        memcpy(header.magic, InstanceCacheHeader::expected_magic, sizeof(header.magic));
+        header.byte_order = InstanceCacheHeader::expected_byte_order;
+        header.version = InstanceCacheHeader::current_version;
+        header.edge_weight_type = static_cast<uint32_t>(distances.type());
+        header.coordinate_scale = distances.coordinate_scale();
+        header.nodes = nodes;
+        header.name_bytes = instance.name().size();
+        header.candidate_neighbours = candidates.edges().size();
+        header.has_dominated_edges = with_dominated_edges ? 1 : 0;
+        header.dominated_keys = keys.size();
+        header.dominated_edges = dominated.size() / 2;
+        writer.put(&header, 1);
+
+        writer.put(instance.name().data(), instance.name().size());
+        writer.put(distances.xs());
+        writer.put(distances.ys());
+        if (distances.type() == EdgeWeightType::Geo) {
+            writer.put(distances.latitudes());
+            writer.put(distances.longitudes());
+        } else if (distances.type() == EdgeWeightType::Explicit) {
+            vector<int32_t> lengths;
+            lengths.reserve(static_cast<size_t>(nodes) * nodes);
+            for (int i = 0; i < nodes; ++i) {
+                for (int j = 0; j < nodes; ++j) {
+                    lengths.emplace_back(distances.length(i, j));
+                }
+            }
+            writer.put(lengths);
+        }
+
+        vector<int32_t> candidate_offsets;
+        vector<int32_t> candidate_neighbours;
+        candidate_offsets.reserve(static_cast<size_t>(nodes) + 1);
+        candidate_offsets.emplace_back(0);
+        for (int node = 0; node < nodes; ++node) {
+            const auto [neighbours_begin, neighbours_end] = candidates.neighbours(node);
+            candidate_neighbours.insert(candidate_neighbours.end(), neighbours_begin, neighbours_end);
+            candidate_offsets.emplace_back(candidate_neighbours.size());
+        }
+        vector<int32_t> candidate_edges;
+        candidate_edges.reserve(2 * candidates.edges().size());
+        for (const auto &edge : candidates.edges()) {
+            candidate_edges.emplace_back(edge.start_id());
+            candidate_edges.emplace_back(edge.end_id());
+        }
+        writer.put(candidate_offsets);
+        writer.put(candidate_neighbours);
+        writer.put(candidate_edges);
+
+        if (with_dominated_edges) {
+            writer.put(from_offsets);
+            writer.put(keys);
+            writer.put(edge_offsets);
+            writer.put(dominated);
+        }
+
+        out.close();
+        return !out.fail();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef HC_INSTANCE_CACHE_H
+#define HC_INSTANCE_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "extern/result.h"
+#include "utilities/tsp.h"
+
+namespace hc {
+    /**
+     * Binary cache of a preprocessed instance.
+     *
+     * The cache holds the distance data (coordinates and, for explicit instances, the lengths), the candidate
+     * graph, and optionally the dominated edges, so that none of them have to be recomputed. All data is stored
+     * in host byte order as arrays aligned to 8 bytes, so that a memory mapped cache can be read in place.
+     *
+     * Layout (each part padded to 8 bytes):
+     *   - InstanceCacheHeader
+     *   - name (name_bytes chars)
+     *   - xs, ys (nodes int32 each)
+     *   - for GEO: latitudes, longitudes in radians (nodes doubles each)
+     *   - for EXPLICIT: lengths (nodes * nodes int32)
+     *   - candidate graph: offsets (nodes + 1 int32), neighbours (candidate_neighbours int32),
+     *     edges (candidate_neighbours pairs of int32 start and end, ordered by length)
+     *   - if has_dominated_edges: from offsets (nodes + 1 uint64), keys (dominated_keys int32),
+     *     edge offsets (dominated_keys + 1 uint64), undirected edges (dominated_edges pairs of int32 from and to),
+     *     see \a DominatedEdges::make_from_flat
+     */
+    struct InstanceCacheHeader {
+        /// Increase when the layout changes, caches with other versions are rejected
+        static constexpr std::uint32_t current_version = 2;
+        static constexpr char expected_magic[8] = {'H', 'C', 'T', 'S', 'P', 'B', 'I', 'N'};
+        static constexpr std::uint32_t expected_byte_order = 0x01020304;
+
+        char magic[8];
+        std::uint32_t byte_order;
+        std::uint32_t version;
+        std::uint32_t edge_weight_type;
+        std::uint32_t coordinate_scale;
+        std::uint64_t nodes;
+        std::uint64_t name_bytes;
+        std::uint64_t candidate_neighbours;
+        std::uint64_t has_dominated_edges;
+        std::uint64_t dominated_keys;
+        std::uint64_t dominated_edges;
+    };
+
+    /// True iff the data in [begin, end) starts like an instance cache
+    bool is_instance_cache(const char *begin, const char *end);
+
+    /// Read an instance cache from the data in [begin, end), see \a InstanceCacheHeader for the layout
+    Result<TSPInstance, TSPReadError> parse_instance_cache(const char *begin, const char *end);
+
+    /**
+     * Write an instance cache for \a instance to \a file_name.
+     *
+     * @param with_dominated_edges When true, the dominated edges are computed (if needed) and stored
+     * @return True iff the file could be written
+     */
+    bool write_instance_cache(const TSPInstance &instance, const std::string &file_name, bool with_dominated_edges);
+}
+
+#endif //HC_INSTANCE_CACHE_H
@@ -0,0 +1,175 @@
+#ifndef HC_KD_TREE_H
+#define HC_KD_TREE_H
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace hc {
+    /**
+     * Simple immutable 2-d tree over integer points, used for nearest neighbour queries.
+     *
+     * The tree is implicit: the points are permuted so that the median of each range is the splitting point
+     * of that range, and the coordinates are stored in that order to keep queries cache friendly.
+     */
+    class KdTree {
+        std::vector<int> ids_;
+        std::vector<int> xs_;
+        std::vector<int> ys_;
+        /// The split axis for the node with its median at the index, true for x
+        std::vector<bool> split_x_;
+        /// Bounding box of all the points
+        int min_x_, min_y_, max_x_, max_y_;
+
+        void build(int from, int to) {
+            if (to - from <= 1) {
+                return;
+            }
+            const auto [min_x, max_x] = std::minmax_element(xs_.begin() + from, xs_.begin() + to);
+            const auto [min_y, max_y] = std::minmax_element(ys_.begin() + from, ys_.begin() + to);
+            const bool split_x = static_cast<long long>(*max_x) - *min_x >= static_cast<long long>(*max_y) - *min_y;
+            const int mid = from + (to - from) / 2;
+
+            std::vector<int> order(to - from);
+            std::iota(order.begin(), order.end(), from);
+            const std::vector<int> &coordinates = split_x ? xs_ : ys_;
+            std::nth_element(order.begin(), order.begin() + (mid - from), order.end(), [&](int a, int b) {
+                return coordinates[a] < coordinates[b];
+            });
+            permute(from, order);
+
+            split_x_[mid] = split_x;
+            build(from, mid);
+            build(mid + 1, to);
+        }
+
+        void permute(int from, const std::vector<int> &order) {
+            std::vector<int> ids, xs, ys;
+            ids.reserve(order.size());
+            xs.reserve(order.size());
+            ys.reserve(order.size());
+            for (int index : order) {
+                ids.emplace_back(ids_[index]);
+                xs.emplace_back(xs_[index]);
+                ys.emplace_back(ys_[index]);
+            }
+            std::copy(ids.begin(), ids.end(), ids_.begin() + from);
+            std::copy(xs.begin(), xs.end(), xs_.begin() + from);
+            std::copy(ys.begin(), ys.end(), ys_.begin() + from);
+        }
+
+        template<typename Accept, typename Region>
+        void nearest(int from, int to, int x, int y, int k,
+                     int min_x, int min_y, int max_x, int max_y,
+                     const Accept &accept, const Region &region,
+                     std::priority_queue<std::pair<long long, int>> &best) const {
+            if (from >= to || !region(min_x, min_y, max_x, max_y)) {
+                return;
+            }
+            const auto far_enough = [&](long long distance) {
+                return static_cast<int>(best.size()) == k && distance >= best.top().first;
+            };
+            if (far_enough(box_distance(x, y, min_x, min_y, max_x, max_y))) {
+                return;
+            }
+
+            const int mid = from + (to - from) / 2;
+            if (accept(ids_[mid])) {
+                const long long dx = static_cast<long long>(xs_[mid]) - x;
+                const long long dy = static_cast<long long>(ys_[mid]) - y;
+                const long long distance = dx * dx + dy * dy;
+                if (static_cast<int>(best.size()) < k) {
+                    best.emplace(distance, ids_[mid]);
+                } else if (distance < best.top().first) {
+                    best.pop();
+                    best.emplace(distance, ids_[mid]);
+                }
+            }
+            if (to - from == 1) {
+                return;
+            }
+
+            // Search the side of the split containing the query point first
+            if (split_x_[mid]) {
+                const int split = xs_[mid];
+                if (x <= split) {
+                    nearest(from, mid, x, y, k, min_x, min_y, split, max_y, accept, region, best);
+                    nearest(mid + 1, to, x, y, k, split, min_y, max_x, max_y, accept, region, best);
+                } else {
+                    nearest(mid + 1, to, x, y, k, split, min_y, max_x, max_y, accept, region, best);
+                    nearest(from, mid, x, y, k, min_x, min_y, split, max_y, accept, region, best);
+                }
+            } else {
+                const int split = ys_[mid];
+                if (y <= split) {
+                    nearest(from, mid, x, y, k, min_x, min_y, max_x, split, accept, region, best);
+                    nearest(mid + 1, to, x, y, k, min_x, split, max_x, max_y, accept, region, best);
+                } else {
+                    nearest(mid + 1, to, x, y, k, min_x, split, max_x, max_y, accept, region, best);
+                    nearest(from, mid, x, y, k, min_x, min_y, max_x, split, accept, region, best);
+                }
+            }
+        }
+
+        /// Squared distance from a point to a box
+        static long long box_distance(int x, int y, int min_x, int min_y, int max_x, int max_y) {
+            const long long dx = x < min_x ? static_cast<long long>(min_x) - x : (x > max_x ? static_cast<long long>(x) - max_x : 0);
+            const long long dy = y < min_y ? static_cast<long long>(min_y) - y : (y > max_y ? static_cast<long long>(y) - max_y : 0);
+            return dx * dx + dy * dy;
+        }
+
+    public:
+        /**
+         * @param xs The x coordinates of the points
+         * @param ys The y coordinates of the points, the identifier of a point is its index
+         */
+        KdTree(const std::vector<int> &xs, const std::vector<int> &ys)
+                : ids_(xs.size()), xs_(xs), ys_(ys), split_x_(xs.size(), true),
+                  min_x_(0), min_y_(0), max_x_(0), max_y_(0) {
+            assert(xs.size() == ys.size());
+            std::iota(ids_.begin(), ids_.end(), 0);
+            if (!ids_.empty()) {
+                const auto [min_x, max_x] = std::minmax_element(xs_.begin(), xs_.end());
+                const auto [min_y, max_y] = std::minmax_element(ys_.begin(), ys_.end());
+                min_x_ = *min_x;
+                min_y_ = *min_y;
+                max_x_ = *max_x;
+                max_y_ = *max_y;
+            }
+            build(0, ids_.size());
+        }
+
+        /**
+         * Find the \a k nearest points to (x, y) that are accepted.
+         *
+         * @param accept Predicate on point identifiers, only accepted points are considered
+         * @param region Predicate on boxes (min_x, min_y, max_x, max_y), used to skip parts of the tree that can not
+         *        contain accepted points. Must return true for any box that may contain an accepted point.
+         * @return The identifiers of up to \a k accepted points, ordered by distance to (x, y)
+         */
+        template<typename Accept, typename Region>
+        [[nodiscard]] std::vector<int> nearest(int x, int y, int k, const Accept &accept, const Region &region) const {
+            std::priority_queue<std::pair<long long, int>> best;
+            if (k > 0 && !ids_.empty()) {
+                nearest(0, ids_.size(), x, y, k, min_x_, min_y_, max_x_, max_y_, accept, region, best);
+            }
+            std::vector<int> result(best.size());
+            for (int i = static_cast<int>(best.size()) - 1; i >= 0; --i) {
+                result[i] = best.top().second;
+                best.pop();
+            }
+            return result;
+        }
+
+        /// Find the \a k nearest accepted points to (x, y), see \a nearest above.
+        template<typename Accept>
+        [[nodiscard]] std::vector<int> nearest(int x, int y, int k, const Accept &accept) const {
+            return nearest(x, y, k, accept, [](int, int, int, int) { return true; });
+        }
+    };
+}
+
+#endif //HC_KD_TREE_H
@@ -0,0 +1,54 @@
+#ifndef HC_LAZY_H
+#define HC_LAZY_H
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+namespace hc {
+    /**
+     * A value that is computed on first use, and then kept.
+     *
+     * The computation is guarded so that several threads (for example portfolio assets) can ask for the value
+     * concurrently, and it will still only be computed once. Copying a lazy value copies the computed value if
+     * there is one, otherwise the copy will compute its own value when needed.
+     */
+    template <typename T>
+    class Lazy {
+        mutable std::mutex mutex_;
+        mutable std::atomic<bool> computed_;
+        mutable std::optional<T> value_;
+    public:
+        Lazy() : computed_(false) {}
+
+        Lazy(const Lazy &other) : computed_(false) {
+            std::lock_guard<std::mutex> lock(other.mutex_);
+            if (other.computed_.load(std::memory_order_relaxed)) {
+                value_.emplace(*other.value_);
+                computed_.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        Lazy &operator=(const Lazy &) = delete;
+
+        /// The value, computed using \a compute if it has not been computed before
+        template<typename F>
+        const T &get(const F &compute) const {
+            if (!computed_.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!computed_.load(std::memory_order_relaxed)) {
+                    value_.emplace(compute());
+                    computed_.store(true, std::memory_order_release);
+                }
+            }
+            return *value_;
+        }
+
+        /// True iff the value has been computed
+        [[nodiscard]] bool has_value() const {
+            return computed_.load(std::memory_order_acquire);
+        }
+    };
+}
+
+#endif //HC_LAZY_H
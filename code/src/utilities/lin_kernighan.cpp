@@ -0,0 +1,395 @@
+#include "lin_kernighan.h"
+#include "graph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+
+using namespace std;
+
+namespace hc {
+    TwoLevelTour::TwoLevelTour(const vector<int> &tour)
+            : order_(), index_(tour.size()), segment_(tour.size()), begin_(), end_(), reversed_(), rank_(),
+              segments_(), max_segments_(0) {
+        build(tour);
+    }
+
+    void TwoLevelTour::build(const vector<int> &tour) {
+        const int n = static_cast<int>(tour.size());
+        const int segment_size = max(8, static_cast<int>(sqrt(static_cast<double>(n))));
+        order_ = tour;
+        begin_.clear();
+        end_.clear();
+        reversed_.clear();
+        rank_.clear();
+        segments_.clear();
+        for (int begin = 0; begin < n; begin += segment_size) {
+            const int segment = static_cast<int>(begin_.size());
+            begin_.emplace_back(begin);
+            end_.emplace_back(min(n, begin + segment_size));
+            reversed_.emplace_back(0);
+            rank_.emplace_back(segment);
+            segments_.emplace_back(segment);
+            for (int i = begin; i < end_.back(); ++i) {
+                index_[order_[i]] = i;
+                segment_[order_[i]] = segment;
+            }
+        }
+        // Each reversal splits at most two segments
+        max_segments_ = 2 * static_cast<int>(segments_.size()) + 8;
+    }
+
+    int TwoLevelTour::next(int node) const {
+        const int segment = segment_[node];
+        const int i = index_[node];
+        if (!reversed_[segment]) {
+            if (i + 1 < end_[segment]) {
+                return order_[i + 1];
+            }
+        } else if (i > begin_[segment]) {
+            return order_[i - 1];
+        }
+        const int rank = rank_[segment] + 1;
+        return first(segments_[rank == static_cast<int>(segments_.size()) ? 0 : rank]);
+    }
+
+    int TwoLevelTour::prev(int node) const {
+        const int segment = segment_[node];
+        const int i = index_[node];
+        if (!reversed_[segment]) {
+            if (i > begin_[segment]) {
+                return order_[i - 1];
+            }
+        } else if (i + 1 < end_[segment]) {
+            return order_[i + 1];
+        }
+        const int rank = rank_[segment];
+        return last(segments_[rank == 0 ? segments_.size() - 1 : rank - 1]);
+    }
+
+    void TwoLevelTour::split_before(int node) {
+        const int segment = segment_[node];
+        if (first(segment) == node) {
+            return;
+        }
+        const int i = index_[node];
+        const int added = static_cast<int>(begin_.size());
+        // The nodes from node on in tour order move to the added segment
+        if (!reversed_[segment]) {
+            begin_.emplace_back(i);
+            end_.emplace_back(end_[segment]);
+            end_[segment] = i;
+        } else {
+            begin_.emplace_back(begin_[segment]);
+            end_.emplace_back(i + 1);
+            begin_[segment] = i + 1;
+        }
+        reversed_.emplace_back(reversed_[segment]);
+        for (int j = begin_[added]; j < end_[added]; ++j) {
+            segment_[order_[j]] = added;
+        }
+        const int rank = rank_[segment] + 1;
+        segments_.insert(segments_.begin() + rank, added);
+        rank_.emplace_back(rank);
+        for (int r = rank + 1; r < static_cast<int>(segments_.size()); ++r) {
+            rank_[segments_[r]] = r;
+        }
+    }
+
+    void TwoLevelTour::reverse_segments(int from, int to) {
+        std::reverse(segments_.begin() + from, segments_.begin() + to + 1);
+        for (int r = from; r <= to; ++r) {
+            reversed_[segments_[r]] ^= 1;
+            rank_[segments_[r]] = r;
+        }
+    }
+
+    void TwoLevelTour::reverse(int from, int to) {
+        if (from == to) {
+            return;
+        }
+        if (segment_[from] == segment_[to] && offset(from) <= offset(to)) {
+            // The path is inside one segment
+            int i = min(index_[from], index_[to]);
+            int j = max(index_[from], index_[to]);
+            while (i < j) {
+                swap(order_[i], order_[j]);
+                index_[order_[i]] = i;
+                index_[order_[j]] = j;
+                ++i;
+                --j;
+            }
+            return;
+        }
+
+        split_before(from);
+        split_before(next(to));
+        const int first_rank = rank_[segment_[from]];
+        const int last_rank = rank_[segment_[to]];
+        if (first_rank <= last_rank) {
+            reverse_segments(first_rank, last_rank);
+        } else if (last_rank + 1 <= first_rank - 1) {
+            // The path wraps around the end of segments_, so reverse the rest of the tour instead
+            reverse_segments(last_rank + 1, first_rank - 1);
+        }
+        // Otherwise the path is the whole tour, and reversing it gives the same cycle
+
+        if (static_cast<int>(segments_.size()) > max_segments_) {
+            build(tour());
+        }
+    }
+
+    void TwoLevelTour::exchange_paths(int b1, int b2, int c1, int c2) {
+        const int a = prev(b1);
+        // Each reversal may reverse the rest of the tour instead, so the direction is checked after each of them
+        reverse(b1, c2);
+        if (next(a) == c2) {
+            reverse(c2, c1);
+        } else {
+            reverse(c1, c2);
+        }
+        if (next(c2) == b2) {
+            reverse(b2, b1);
+        } else {
+            reverse(b1, b2);
+        }
+    }
+
+    vector<int> TwoLevelTour::tour() const {
+        vector<int> result;
+        result.reserve(size());
+        int node = first(segments_[0]);
+        for (int i = 0; i < size(); ++i) {
+            result.emplace_back(node);
+            node = next(node);
+        }
+        return result;
+    }
+
+
+    namespace {
+        class LinKernighan {
+            const TSPInstance &instance_;
+            const CandidateGraph &candidates_;
+            const LinKernighanOptions &options_;
+            const chrono::steady_clock::time_point start_;
+            TwoLevelTour tour_;
+            /// The length of tour_
+            long long length_;
+            /// The end points of the edges changed by the current move
+            vector<int> touched_;
+            /// Nodes without their don't-look bit set, processed last in first out
+            vector<int> active_;
+            vector<char> is_active_;
+
+            [[nodiscard]] int length(int a, int b) const {
+                return instance_.length(a, b);
+            }
+
+            /// Replace the edges a-b and c-d by b-c and d-a, where the tour goes a, b, ..., d, c in some direction
+            void exchange(int a, int b, int d) {
+                if (tour_.next(a) == b) {
+                    tour_.reverse(b, d);
+                } else {
+                    tour_.reverse(d, b);
+                }
+            }
+
+            /**
+             * Extend the move that has removed the edge t1-t2 and made the tour shorter by \a gain before adding the
+             * edge t2-t1 back, where t2-t1 is an edge of the current tour.
+             *
+             * @return True if the tour was made shorter, otherwise the tour is left as it was
+             */
+            bool step(int level, int t1, int t2, long long gain) {
+                const bool forward = tour_.next(t1) == t2;
+                const int breadth = level <= 2 ? options_.breadth : 1;
+                int tried = 0;
+                const auto [begin, end] = candidates_.neighbours(t2);
+                for (const int *it = begin; it != end && tried < breadth; ++it) {
+                    const int t3 = *it;
+                    const long long added_gain = gain - length(t2, t3);
+                    if (added_gain <= 0) {
+                        break;
+                    }
+                    if (t3 == t1 || t3 == tour_.next(t2) || t3 == tour_.prev(t2)) {
+                        continue;
+                    }
+                    // Removing t3-t4 and adding t2-t3 and t4-t1 keeps a tour
+                    const int t4 = forward ? tour_.prev(t3) : tour_.next(t3);
+                    ++tried;
+                    const long long removed_gain = added_gain + length(t3, t4);
+                    exchange(t1, t2, t4);
+                    touched_.emplace_back(t3);
+                    touched_.emplace_back(t4);
+                    if (removed_gain - length(t4, t1) > 0) {
+                        length_ -= removed_gain - length(t4, t1);
+                        return true;
+                    }
+                    if (level < options_.max_depth && step(level + 1, t1, t4, removed_gain)) {
+                        return true;
+                    }
+                    exchange(t1, t4, t2);
+                    touched_.resize(touched_.size() - 2);
+                }
+                return false;
+            }
+
+            [[nodiscard]] bool out_of_time() const {
+                const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start_;
+                return options_.time_limit > 0 && elapsed.count() > options_.time_limit;
+            }
+
+            void activate(int node) {
+                if (!is_active_[node]) {
+                    is_active_[node] = 1;
+                    active_.emplace_back(node);
+                }
+            }
+
+            /// Make improving moves until none of the active nodes has one, or the time is up
+            int improve() {
+                int moves = 0;
+                int steps = 0;
+                while (!active_.empty()) {
+                    if ((++steps & 15) == 0 && out_of_time()) {
+                        break;
+                    }
+                    const int t1 = active_.back();
+                    active_.pop_back();
+                    is_active_[t1] = 0;
+                    for (const int t2 : {tour_.next(t1), tour_.prev(t1)}) {
+                        touched_.clear();
+                        if (step(1, t1, t2, length(t1, t2))) {
+                            ++moves;
+                            activate(t1);
+                            activate(t2);
+                            for (int node : touched_) {
+                                activate(node);
+                            }
+                            break;
+                        }
+                    }
+                }
+                return moves;
+            }
+
+            /// Exchange the paths of up to kick_length nodes after \a a1, returns false if the tour is too short
+            bool kick(int a1, mt19937 &rng) {
+                uniform_int_distribution<int> random_length(1, max(1, min(options_.kick_length, (tour_.size() - 2) / 2)));
+                // The tour is a1, b1...b2, c1...c2, d1, and becomes a1, c1...c2, b1...b2, d1
+                const int b1 = tour_.next(a1);
+                int b2 = b1;
+                for (int i = random_length(rng); i > 1; --i) {
+                    b2 = tour_.next(b2);
+                }
+                const int c1 = tour_.next(b2);
+                int c2 = c1;
+                for (int i = random_length(rng); i > 1; --i) {
+                    c2 = tour_.next(c2);
+                }
+                const int d1 = tour_.next(c2);
+                if (d1 == a1 || c1 == a1) {
+                    return false;
+                }
+                length_ += length(a1, c1) + length(c2, b1) + length(b2, d1)
+                           - length(a1, b1) - length(b2, c1) - length(c2, d1);
+                tour_.exchange_paths(b1, b2, c1, c2);
+                for (int node : {a1, b1, b2, c1, c2, d1}) {
+                    activate(node);
+                }
+                return true;
+            }
+
+        public:
+            LinKernighan(const TSPInstance &instance, const vector<int> &tour, const LinKernighanOptions &options)
+                    : instance_(instance), candidates_(instance.candidate_graph()), options_(options),
+                      start_(chrono::steady_clock::now()), tour_(tour), length_(tour_length(instance, tour)),
+                      touched_(), active_(), is_active_(instance.locations(), 0) {
+            }
+
+            /// Improve starting from all nodes, then kick the local optimum, keeping the shortest tour
+            int run() {
+                vector<int> best = tour_.tour();
+                for (auto it = best.rbegin(); it != best.rend(); ++it) {
+                    activate(*it);
+                }
+                int moves = improve();
+
+                best = tour_.tour();
+                long long best_length = length_;
+                mt19937 rng(4711);
+                uniform_int_distribution<int> random_node(0, tour_.size() - 1);
+                for (int kicks = 0; kicks < options_.kicks && tour_.size() >= 8 && !out_of_time(); ++kicks) {
+                    if (!kick(random_node(rng), rng)) {
+                        continue;
+                    }
+                    moves += improve();
+                    if (length_ < best_length) {
+                        best = tour_.tour();
+                        best_length = length_;
+                    } else if (length_ > best_length) {
+                        tour_ = TwoLevelTour(best);
+                        length_ = best_length;
+                        active_.clear();
+                        fill(is_active_.begin(), is_active_.end(), 0);
+                    }
+                }
+                return moves;
+            }
+
+            /// The shortest tour found
+            [[nodiscard]] vector<int> tour() const {
+                return tour_.tour();
+            }
+        };
+    }
+
+
+    int lin_kernighan(const TSPInstance &instance, vector<int> &tour, const LinKernighanOptions &options) {
+        if (tour.size() < 5) {
+            return 0;
+        }
+        LinKernighan search(instance, tour, options);
+        const int moves = search.run();
+        tour = search.tour();
+        return moves;
+    }
+
+
+    vector<int> heuristic_tour(const shared_ptr<const TSPInstance> &instance, const LinKernighanOptions &options) {
+        const int n = instance->locations();
+        vector<int> tour;
+        const auto circuit = christofides(instance, vector<LineSegment>(), [](const LineSegment &) { return true; });
+        if (circuit.has_value() && static_cast<int>(circuit->size()) == n) {
+            tour.reserve(n);
+            for (const auto &edge : circuit.value()) {
+                tour.emplace_back(edge.start_id());
+            }
+        } else {
+            tour.resize(n);
+            iota(tour.begin(), tour.end(), 0);
+        }
+
+        lin_kernighan(*instance, tour, options);
+
+        LocalSearchOptions or_opt;
+        or_opt.max_moves = numeric_limits<int>::max();
+        or_opt.time_limit = options.time_limit;
+        improve_tour(*instance, tour, [](int, int) { return true; }, or_opt);
+
+        return tour;
+    }
+
+
+    int tour_length(const TSPInstance &instance, const vector<int> &tour) {
+        int result = 0;
+        for (size_t i = 0; i < tour.size(); ++i) {
+            result += instance.length(tour[i], tour[i + 1 == tour.size() ? 0 : i + 1]);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef HC_LIN_KERNIGHAN_H
+#define HC_LIN_KERNIGHAN_H
+
+#include "tsp.h"
+
+#include <memory>
+#include <vector>
+
+
+namespace hc {
+    /**
+     * Tour as a two-level doubly-linked list, where the nodes are split into segments of about sqrt(n) nodes that
+     * can be traversed in either direction.
+     *
+     * Reversing a path splits the segments at its ends and reverses the order and direction of the segments in
+     * between, so it takes O(sqrt(n)) time. The segments are rebuilt when the splits have made too many of them.
+     */
+    class TwoLevelTour {
+        /// The nodes of each segment are a range in order_
+        std::vector<int> order_;
+        /// The position of each node in order_
+        std::vector<int> index_;
+        /// The segment of each node
+        std::vector<int> segment_;
+        /// The nodes of segment s are order_[begin_[s]] to order_[end_[s] - 1]
+        std::vector<int> begin_;
+        std::vector<int> end_;
+        /// True if segment s is traversed from end_[s] - 1 down to begin_[s]
+        std::vector<char> reversed_;
+        /// The position of each segment in segments_
+        std::vector<int> rank_;
+        /// The segments in tour order
+        std::vector<int> segments_;
+        /// The segments are rebuilt when there are more than this many
+        int max_segments_;
+
+        void build(const std::vector<int> &tour);
+
+        [[nodiscard]] int first(int segment) const {
+            return reversed_[segment] ? order_[end_[segment] - 1] : order_[begin_[segment]];
+        }
+
+        [[nodiscard]] int last(int segment) const {
+            return reversed_[segment] ? order_[begin_[segment]] : order_[end_[segment] - 1];
+        }
+
+        /// The position of \a node in its segment, in tour order
+        [[nodiscard]] int offset(int node) const {
+            const int segment = segment_[node];
+            return reversed_[segment] ? end_[segment] - 1 - index_[node] : index_[node] - begin_[segment];
+        }
+
+        /// Split the segment of \a node so that \a node is the first node of a segment
+        void split_before(int node);
+
+        /// Reverse the direction and order of the segments at positions \a from to \a to in segments_
+        void reverse_segments(int from, int to);
+
+    public:
+        /// Tour visiting \a tour in order, the last node followed by the first
+        explicit TwoLevelTour(const std::vector<int> &tour);
+
+        [[nodiscard]] int size() const {
+            return static_cast<int>(order_.size());
+        }
+
+        [[nodiscard]] int next(int node) const;
+
+        [[nodiscard]] int prev(int node) const;
+
+        /**
+         * Reverse the path from \a from to \a to, following next.
+         *
+         * When the path is longer than the rest of the tour, the rest of the tour may be reversed instead, which
+         * gives the same cycle traversed in the other direction.
+         */
+        void reverse(int from, int to);
+
+        /**
+         * Exchange the path from \a b1 to \a b2 with the path from \a c1 to \a c2 that follows it, so that
+         * a, b1...b2, c1...c2, d becomes a, c1...c2, b1...b2, d, possibly traversed in the other direction.
+         */
+        void exchange_paths(int b1, int b2, int c1, int c2);
+
+        /// The nodes in tour order, starting anywhere
+        [[nodiscard]] std::vector<int> tour() const;
+    };
+
+
+    /// Limits for the Lin-Kernighan search
+    struct LinKernighanOptions {
+        /// Largest number of exchanges in one move
+        int max_depth = 10;
+        /// Number of alternatives tried at the first two levels of a move, deeper levels only try the best one
+        int breadth = 5;
+        /// Number of random double-bridge kicks of a local optimum, each kept only if it leads to a shorter tour
+        int kicks = 100;
+        /// Largest number of nodes in each of the two paths exchanged by a kick
+        int kick_length = 50;
+        /// Time limit in milliseconds, 0 for no limit
+        double time_limit = 0;
+    };
+
+    /**
+     * Improve \a tour using Lin-Kernighan moves built from sequential 2-opt exchanges, with the candidate graph of
+     * \a instance as neighbour lists and don't-look bits for the nodes where no improving move was found.
+     *
+     * The local optimum is then kicked by exchanging two short adjacent paths and improved again, keeping the
+     * shortest tour found.
+     *
+     * @param tour The nodes in the order visited, the last node is followed by the first
+     * @return The number of improving moves made
+     */
+    int lin_kernighan(const TSPInstance &instance, std::vector<int> &tour,
+                      const LinKernighanOptions &options = LinKernighanOptions());
+
+    /**
+     * A good tour for \a instance, from the Christofides tour improved by Lin-Kernighan and Or-opt moves.
+     *
+     * @return The nodes in the order visited
+     */
+    std::vector<int> heuristic_tour(const std::shared_ptr<const TSPInstance> &instance,
+                                    const LinKernighanOptions &options = LinKernighanOptions());
+
+    /// The length of \a tour, including the edge from the last node back to the first
+    int tour_length(const TSPInstance &instance, const std::vector<int> &tour);
+}
+
+#endif //HC_LIN_KERNIGHAN_H
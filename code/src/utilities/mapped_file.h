@@ -0,0 +1,70 @@
+#ifndef HC_MAPPED_FILE_H
+#define HC_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hc {
+    /// A read-only memory mapping of a whole file, unmapped when destroyed.
+    class MappedFile {
+        int fd_;
+        void *data_;
+        std::size_t size_;
+    public:
+        explicit MappedFile(const std::string &file_name) : fd_(-1), data_(MAP_FAILED), size_(0) {
+            fd_ = open(file_name.c_str(), O_RDONLY);
+            if (fd_ < 0) {
+                return;
+            }
+            struct stat status{};
+            if (fstat(fd_, &status) != 0) {
+                close(fd_);
+                fd_ = -1;
+                return;
+            }
+            size_ = status.st_size;
+            if (size_ > 0) {
+                data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+                if (data_ != MAP_FAILED) {
+                    madvise(data_, size_, MADV_SEQUENTIAL);
+                }
+            }
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile() {
+            if (data_ != MAP_FAILED) {
+                munmap(data_, size_);
+            }
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+        }
+
+        /// True iff the file could be opened and mapped
+        [[nodiscard]] bool is_open() const {
+            return fd_ >= 0 && (size_ == 0 || data_ != MAP_FAILED);
+        }
+
+        [[nodiscard]] const char *begin() const {
+            return size_ == 0 ? nullptr : static_cast<const char *>(data_);
+        }
+
+        [[nodiscard]] const char *end() const {
+            return begin() + size_;
+        }
+
+        [[nodiscard]] std::size_t size() const {
+            return size_;
+        }
+    };
+}
+
+#endif //HC_MAPPED_FILE_H
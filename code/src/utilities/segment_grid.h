@@ -0,0 +1,157 @@
+#ifndef HC_SEGMENT_GRID_H
+#define HC_SEGMENT_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "utilities/geometry.h"
+
+namespace hc {
+    /**
+     * Uniform grid over bounding boxes, that can be added to one at a time.
+     *
+     * Each box is stored in all the cells it overlaps, as a linked list per cell, so finding the boxes overlapping a
+     * query box only looks at the cells of the query box. Boxes overlapping many cells are kept in a separate list
+     * that every query looks at instead, and a query overlapping more cells than there are boxes looks at all boxes.
+     *
+     * The boxes are identified by integers from 0 to the number of identifiers given, such as the nodes of a tour.
+     */
+    class SegmentGrid {
+        /// Boxes overlapping more cells than this are kept in large_
+        static constexpr int max_cells_per_box = 16;
+
+        int min_x_;
+        int min_y_;
+        int cell_size_;
+        int columns_;
+        int rows_;
+        /// The first entry of each cell, or -1 for none
+        std::vector<int> heads_;
+        /// The next entry in the same cell as each entry, or -1 for none
+        std::vector<int> next_;
+        /// The identifier of each entry
+        std::vector<int> entries_;
+        /// The identifiers of the boxes overlapping too many cells
+        std::vector<int> large_;
+        /// The identifiers added, in the order added
+        std::vector<int> ids_;
+        std::vector<BoundingBox> boxes_;
+        /// The query in which each identifier was last looked at, so that boxes in several cells are seen once
+        mutable std::vector<int> visited_;
+        mutable int query_;
+
+        [[nodiscard]] int column(int x) const {
+            return std::clamp((x - min_x_) / cell_size_, 0, columns_ - 1);
+        }
+
+        [[nodiscard]] int row(int y) const {
+            return std::clamp((y - min_y_) / cell_size_, 0, rows_ - 1);
+        }
+
+    public:
+        /**
+         * Empty grid over \a area, with about one cell per identifier.
+         *
+         * @param ids The number of identifiers, the boxes added are identified by 0 to ids - 1
+         */
+        SegmentGrid(const BoundingBox &area, int ids)
+                : min_x_(area.min_x()), min_y_(area.min_y()),
+                  boxes_(std::max(ids, 0), BoundingBox(0, 0, -1, -1)),
+                  visited_(std::max(ids, 0), 0), query_(0) {
+            const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(ids)))));
+            const long long extent = std::max(area.width(), area.height()) + 1LL;
+            cell_size_ = static_cast<int>(std::max(1LL, (extent + side - 1) / side));
+            columns_ = area.width() / cell_size_ + 1;
+            rows_ = area.height() / cell_size_ + 1;
+            heads_.assign(static_cast<size_t>(columns_) * rows_, -1);
+        }
+
+        /// Add \a box for \a id, each identifier should be added at most once
+        void insert(int id, const BoundingBox &box) {
+            ids_.emplace_back(id);
+            boxes_[id] = box;
+            const int from_column = column(box.min_x());
+            const int to_column = column(box.max_x());
+            const int from_row = row(box.min_y());
+            const int to_row = row(box.max_y());
+            if ((to_column - from_column + 1) * (to_row - from_row + 1) > max_cells_per_box) {
+                large_.emplace_back(id);
+                return;
+            }
+            for (int r = from_row; r <= to_row; ++r) {
+                for (int c = from_column; c <= to_column; ++c) {
+                    int &head = heads_[static_cast<size_t>(r) * columns_ + c];
+                    next_.emplace_back(head);
+                    entries_.emplace_back(id);
+                    head = static_cast<int>(entries_.size()) - 1;
+                }
+            }
+        }
+
+        /// The number of boxes added
+        [[nodiscard]] int size() const {
+            return static_cast<int>(ids_.size());
+        }
+
+        /**
+         * True if \a predicate is true for the identifier of some added box that overlaps \a box.
+         *
+         * The predicate is called at most once for each identifier, and not after it has returned true.
+         */
+        template<typename F>
+        bool any_of(const BoundingBox &box, F predicate) const {
+            if (query_ == std::numeric_limits<int>::max()) {
+                std::fill(visited_.begin(), visited_.end(), 0);
+                query_ = 0;
+            }
+            ++query_;
+
+            const int from_column = column(box.min_x());
+            const int to_column = column(box.max_x());
+            const int from_row = row(box.min_y());
+            const int to_row = row(box.max_y());
+            const long long cells = static_cast<long long>(to_column - from_column + 1) * (to_row - from_row + 1);
+            if (cells > static_cast<long long>(ids_.size())) {
+                for (const int id : ids_) {
+                    if (boxes_[id].intersects(box) && predicate(id)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            for (const int id : large_) {
+                if (boxes_[id].intersects(box) && predicate(id)) {
+                    return true;
+                }
+            }
+            for (int r = from_row; r <= to_row; ++r) {
+                for (int c = from_column; c <= to_column; ++c) {
+                    for (int entry = heads_[static_cast<size_t>(r) * columns_ + c]; entry != -1; entry = next_[entry]) {
+                        const int id = entries_[entry];
+                        if (visited_[id] != query_) {
+                            visited_[id] = query_;
+                            if (boxes_[id].intersects(box) && predicate(id)) {
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        /// Call \a visitor with the identifier of each added box that overlaps \a box
+        template<typename F>
+        void visit(const BoundingBox &box, F visitor) const {
+            (void) any_of(box, [&](int id) {
+                visitor(id);
+                return false;
+            });
+        }
+    };
+}
+
+#endif //HC_SEGMENT_GRID_H
@@ -2,16 +2,26 @@
 #define HC_SPATIAL_INDEX_H
 
 #include <algorithm>
+#include <climits>
 #include <deque>
 #include "utilities/geometry.h"
 
 #include <iostream>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace hc {
     /**
      * Simple immutable spatial index class.
      *
      * The spatial index is based on an R-tree, building the structure using a method inspired by the STR algorithm.
+     *
+     * After building, the tree is stored with the nodes in breadth-first order and the boxes of the nodes and of the
+     * elements as separate arrays of coordinates. The two children of a node are next to each other, and queries
+     * traverse the tree with a small fixed stack. The boxes of the elements in a leaf are tested four at a time
+     * with SSE2 where available.
      */
     template <typename E>
     class SpatialIndex {
@@ -80,17 +90,122 @@ namespace hc {
             }
         };
 
-        std::vector<Element> data_;
-        std::vector<Node> tree_;
+        /// Leaves have at most this many elements
+        static constexpr int bucket_size = 8;
+        /// Deeper trees than this can not be queried, which needs far more elements than fit in memory
+        static constexpr int max_depth = 64;
+
+        /// Coordinates of the boxes of the nodes in breadth-first order, the root first
+        std::vector<int> node_min_x_;
+        std::vector<int> node_min_y_;
+        std::vector<int> node_max_x_;
+        std::vector<int> node_max_y_;
+        /// The position of the first of the two children of each node, or -1 for leaves
+        std::vector<int> node_children_;
+        /// The elements of leaf i are from node_from_[i] to node_to_[i] - 1
+        std::vector<int> node_from_;
+        std::vector<int> node_to_;
+
+        /// Coordinates of the boxes of the elements, padded with empty boxes so that a whole bucket can always be read
+        std::vector<int> element_min_x_;
+        std::vector<int> element_min_y_;
+        std::vector<int> element_max_x_;
+        std::vector<int> element_max_y_;
+        std::vector<E> elements_;
+
+        SpatialIndex(std::vector<Element> data, const std::vector<Node> &tree) {
+            elements_.reserve(data.size());
+            for (Element &element : data) {
+                add_element_box(element.box_);
+                elements_.emplace_back(std::move(element.element_));
+            }
+            for (int i = 0; i < bucket_size; ++i) {
+                // Nothing overlaps a box with the minimum after the maximum
+                element_min_x_.emplace_back(INT_MAX);
+                element_min_y_.emplace_back(INT_MAX);
+                element_max_x_.emplace_back(INT_MIN);
+                element_max_y_.emplace_back(INT_MIN);
+            }
+            if (data.empty()) {
+                return;
+            }
+
+            // The positions in tree of the nodes in breadth-first order, and their depths
+            std::vector<int> order{static_cast<int>(tree.size()) - 1};
+            std::vector<int> depth{0};
+            order.reserve(tree.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                const Node &node = tree[order[i]];
+                node_min_x_.emplace_back(node.box().min_x());
+                node_min_y_.emplace_back(node.box().min_y());
+                node_max_x_.emplace_back(node.box().max_x());
+                node_max_y_.emplace_back(node.box().max_y());
+                if (node.leaf()) {
+                    node_children_.emplace_back(-1);
+                    node_from_.emplace_back(node.from());
+                    node_to_.emplace_back(node.to() + 1);
+                } else {
+                    node_children_.emplace_back(static_cast<int>(order.size()));
+                    node_from_.emplace_back(0);
+                    node_to_.emplace_back(0);
+                    order.emplace_back(node.left());
+                    order.emplace_back(node.right());
+                    depth.emplace_back(depth[i] + 1);
+                    depth.emplace_back(depth[i] + 1);
+                    assert(depth[i] + 1 < max_depth);
+                }
+            }
+        }
+
+        void add_element_box(const BoundingBox &box) {
+            element_min_x_.emplace_back(box.min_x());
+            element_min_y_.emplace_back(box.min_y());
+            element_max_x_.emplace_back(box.max_x());
+            element_max_y_.emplace_back(box.max_y());
+        }
+
+        [[nodiscard]] bool node_intersects(int node, const BoundingBox &box) const {
+            return !(box.max_x() < node_min_x_[node] || node_max_x_[node] < box.min_x() ||
+                     box.max_y() < node_min_y_[node] || node_max_y_[node] < box.min_y());
+        }
 
-        SpatialIndex(std::vector<Element> data, std::vector<Node> tree)
-                : data_(std::move(data)), tree_(std::move(tree))
-        {}
+        /// One bit for each of the bucket_size elements from \a from, set iff its box intersects \a box
+        [[nodiscard]] int intersecting_elements(int from, const BoundingBox &box) const {
+            int result = 0;
+#ifdef __SSE2__
+            const __m128i box_min_x = _mm_set1_epi32(box.min_x());
+            const __m128i box_min_y = _mm_set1_epi32(box.min_y());
+            const __m128i box_max_x = _mm_set1_epi32(box.max_x());
+            const __m128i box_max_y = _mm_set1_epi32(box.max_y());
+            for (int i = 0; i < bucket_size; i += 4) {
+                const auto load = [&](const std::vector<int> &values) {
+                    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(values.data() + from + i));
+                };
+                // The boxes are disjoint if one ends before the other begins along either axis
+                const __m128i disjoint = _mm_or_si128(
+                        _mm_or_si128(_mm_cmplt_epi32(box_max_x, load(element_min_x_)),
+                                     _mm_cmplt_epi32(load(element_max_x_), box_min_x)),
+                        _mm_or_si128(_mm_cmplt_epi32(box_max_y, load(element_min_y_)),
+                                     _mm_cmplt_epi32(load(element_max_y_), box_min_y)));
+                result |= (~_mm_movemask_ps(_mm_castsi128_ps(disjoint)) & 0xF) << i;
+            }
+#else
+            for (int i = 0; i < bucket_size; ++i) {
+                const int element = from + i;
+                const bool disjoint = box.max_x() < element_min_x_[element] || element_max_x_[element] < box.min_x() ||
+                                      box.max_y() < element_min_y_[element] || element_max_y_[element] < box.min_y();
+                result |= static_cast<int>(!disjoint) << i;
+            }
+#endif
+            return result;
+        }
 
     private:
 
         [[nodiscard]] static SpatialIndex<E> create(std::vector<SpatialIndex<E>::Element> elements) {
-            const int bucket_size = 8;
+            if (elements.empty()) {
+                return SpatialIndex<E>(std::move(elements), std::vector<Node>());
+            }
             const int buckets = ceil(static_cast<double>(elements.size()) / bucket_size);
 
             if (elements.size() <= bucket_size) {
@@ -98,23 +213,14 @@ namespace hc {
                 return SpatialIndex<E>(elements, tree);
             }
 
+            // Sorting by the centres of the boxes keeps boxes close to each other in the same leaves
             const auto x_comparator = [](const Element &a, const Element &b) {
-                const int a_width = a.box_.width();
-                const int b_width = b.box_.width();
-                if (a_width != b_width) {
-                    return a_width < b_width;
-                } else {
-                    return a.box_.max_x() < b.box_.max_x();
-                }
+                return static_cast<long long>(a.box_.min_x()) + a.box_.max_x() <
+                       static_cast<long long>(b.box_.min_x()) + b.box_.max_x();
             };
             const auto y_comparator = [](const Element &a, const Element &b) {
-                const int a_height = a.box_.height();
-                const int b_height = b.box_.height();
-                if (a_height != b_height) {
-                    return a_height < b_height;
-                } else {
-                    return a.box_.max_y() < b.box_.max_y();
-                }
+                return static_cast<long long>(a.box_.min_y()) + a.box_.max_y() <
+                       static_cast<long long>(b.box_.min_y()) + b.box_.max_y();
             };
 
 
@@ -165,8 +271,9 @@ namespace hc {
                     auto front = results.front(); results.pop_front();
                     results.emplace_back(front);
                 }
-                const auto& [level_left, node_left] = results.front(); results.pop_front();
-                const auto& [level_right, node_right] = results.front(); results.pop_front();
+                // Copy the nodes, since popping invalidates references into the queue
+                const auto [level_left, node_left] = results.front(); results.pop_front();
+                const auto [level_right, node_right] = results.front(); results.pop_front();
                 const int pos_left = tree.size();
                 const int pos_right = tree.size()+1;
                 tree.emplace_back(node_left);
@@ -202,72 +309,81 @@ namespace hc {
             return create(std::move(internal_elements));
         }
         
+        /// Call \a visitor with each element whose box intersects \a box, in the order of the leaves
         template<typename F>
         void visit(const BoundingBox& box, F visitor) const {
-            visit(box, visitor, tree_.size()-1);
-        }
-
-        std::vector<std::reference_wrapper<const E>> collect(const BoundingBox& box) const {
-            std::vector<std::reference_wrapper<const E>> result;
-            visit(box, [&](const E& element) { result.emplace_back(std::ref(element)); });
-            return result;
-        }
-    private:
-        template<typename F>
-        void visit(const BoundingBox& box, F visitor, int index) const {
-            if (index < 0 || index >= tree_.size()) {
+            if (node_children_.empty()) {
                 return;
             }
 
-            const Node &node = tree_[index];
-            if (node.box().intersects(box)) {
-                if (node.leaf()) {
-                    const int from = node.from();
-                    const int to = node.to();
-                    for (int i = from; i <= to; ++i) {
-                        if (data_[i].box_.intersects(box)) {
-                            visitor(data_[i].element_);
+            // A node is pushed before its sibling, so the stack holds at most one node per level
+            int stack[max_depth + 1];
+            int size = 0;
+            stack[size++] = 0;
+            while (size > 0) {
+                const int node = stack[--size];
+                if (!node_intersects(node, box)) {
+                    continue;
+                }
+                const int children = node_children_[node];
+                if (children >= 0) {
+                    // The left child is visited first
+                    stack[size++] = children + 1;
+                    stack[size++] = children;
+                } else {
+                    const int from = node_from_[node];
+                    const int count = node_to_[node] - from;
+                    const int intersecting = intersecting_elements(from, box) & ((1 << count) - 1);
+                    for (int i = 0; i < count; ++i) {
+                        if ((intersecting >> i) & 1) {
+                            visitor(elements_[from + i]);
                         }
                     }
-                } else { // node.internal()
-                    visit(box, visitor, tree_[index].left());
-                    visit(box, visitor, tree_[index].right());
                 }
             }
         }
 
-        [[nodiscard]] int left(int index) const {
-            return index * 2;
-        }
-
-        [[nodiscard]] int right(int index) const {
-            return (index * 2) + 1;
+        std::vector<std::reference_wrapper<const E>> collect(const BoundingBox& box) const {
+            std::vector<std::reference_wrapper<const E>> result;
+            visit(box, [&](const E& element) { result.emplace_back(std::ref(element)); });
+            return result;
         }
 
     public:
         void print(std::ostream& out) const {
-            print(out, tree_.size()-1, 0);
+            if (!node_children_.empty()) {
+                print(out, 0, 0);
+            }
         }
     private:
+        [[nodiscard]] BoundingBox node_box(int node) const {
+            return BoundingBox(node_min_x_[node], node_min_y_[node], node_max_x_[node], node_max_y_[node]);
+        }
+
+        [[nodiscard]] BoundingBox element_box(int element) const {
+            return BoundingBox(element_min_x_[element], element_min_y_[element],
+                               element_max_x_[element], element_max_y_[element]);
+        }
+
         void print(std::ostream& out, int pos, int tabs) const {
             for (int t = 0; t < tabs; ++t) {
                 out << "\t";
             }
-            if (tree_[pos].leaf()) {
-                out << "Leaf " << pos << " " << tree_[pos].box() << " [";
-                const int from = tree_[pos].from();
-                const int to = tree_[pos].to();
-                for (int element = from; element <= to; ++element) {
-                    out << data_[element].box_;
-                    if (element < to) {
+            if (node_children_[pos] < 0) {
+                out << "Leaf " << pos << " " << node_box(pos) << " [";
+                const int from = node_from_[pos];
+                const int to = node_to_[pos];
+                for (int element = from; element < to; ++element) {
+                    out << element_box(element);
+                    if (element < to - 1) {
                         out << ", ";
                     }
                 }
                 out << "]" << std::endl;
             } else {
-                out << "Node " << pos << " " << tree_[pos].box() << std::endl;
-                print(out, tree_[pos].left(),  tabs+1);
-                print(out, tree_[pos].right(), tabs+1);
+                out << "Node " << pos << " " << node_box(pos) << std::endl;
+                print(out, node_children_[pos], tabs+1);
+                print(out, node_children_[pos] + 1, tabs+1);
             }
         }
     };
@@ -1,24 +1,196 @@
 #include "utilities/tsp.h"
 #include "utilities/spatial_index.h"
+#include "utilities/mapped_file.h"
+#include "utilities/instance_cache.h"
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <set>
-#include <fstream>
+#include <thread>
 
 using namespace std;
 
 namespace {
-    void read_label_colon(istream &in, string &label, string &colon) {
-        in >> label;
-        if (label == "NODE_COORD_SECTION") {
-            colon = ":";
-        } else if (*label.rbegin() == ':') {
-            label.erase(label.size() - 1);
-            colon = ':';
-        } else {
-            in >> colon;
+    /**
+     * Locale-free tokenizer for TSPLib files held in memory.
+     *
+     * Numbers are parsed directly from the text. Decimal numbers with at most 15 significant digits and small
+     * exponents are converted exactly using a single multiplication or division, other numbers use strtod.
+     */
+    class TSPLibParser {
+        const char *position_;
+        const char *end_;
+
+        static bool is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
         }
-    }
+
+        static bool is_digit(char c) {
+            return '0' <= c && c <= '9';
+        }
+
+        void skip_space() {
+            while (position_ != end_ && is_space(*position_)) {
+                ++position_;
+            }
+        }
+
+    public:
+        TSPLibParser(const char *begin, const char *end) : position_(begin), end_(end) {}
+
+        /// True iff \a label starts a data section, such as NODE_COORD_SECTION
+        static bool is_section(const string &label) {
+            const string suffix = "_SECTION";
+            return label.size() > suffix.size() && label.compare(label.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        /// The next whitespace-separated word, or the empty string at the end of the text
+        string word() {
+            skip_space();
+            const char *start = position_;
+            while (position_ != end_ && !is_space(*position_)) {
+                ++position_;
+            }
+            return string(start, position_);
+        }
+
+        /// The rest of the current line, not including the line break
+        string rest_of_line() {
+            const char *start = position_;
+            while (position_ != end_ && *position_ != '\n') {
+                ++position_;
+            }
+            const char *line_end = position_;
+            if (line_end != start && *(line_end - 1) == '\r') {
+                --line_end;
+            }
+            if (position_ != end_) {
+                ++position_;
+            }
+            return string(start, line_end);
+        }
+
+        /// The first word of the rest of the current line, the rest of the line is skipped
+        string value() {
+            const string line = rest_of_line();
+            TSPLibParser line_parser(line.data(), line.data() + line.size());
+            return line_parser.word();
+        }
+
+        /// Read a label and its colon, which may be attached to the label or a separate word
+        void label_colon(string &label, string &colon) {
+            label = word();
+            if (is_section(label)) {
+                colon = ":";
+            } else if (!label.empty() && *label.rbegin() == ':') {
+                label.erase(label.size() - 1);
+                colon = ":";
+            } else {
+                colon = word();
+            }
+        }
+
+        /// Read an integer into \a value, returning false if the next word is not an integer
+        bool integer(long long &value) {
+            skip_space();
+            const char *p = position_;
+            const bool negative = p != end_ && *p == '-';
+            if (p != end_ && (*p == '-' || *p == '+')) {
+                ++p;
+            }
+            if (p == end_ || !is_digit(*p)) {
+                return false;
+            }
+            long long result = 0;
+            while (p != end_ && is_digit(*p)) {
+                result = result * 10 + (*p - '0');
+                ++p;
+            }
+            if (p != end_ && !is_space(*p)) {
+                return false;
+            }
+            position_ = p;
+            value = negative ? -result : result;
+            return true;
+        }
+
+        /// Read a decimal number, optionally with a fraction and an exponent, into \a value
+        bool number(double &value) {
+            static const double powers_of_ten[] = {
+                    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            skip_space();
+            const char *start = position_;
+            const char *p = start;
+            const bool negative = p != end_ && *p == '-';
+            if (p != end_ && (*p == '-' || *p == '+')) {
+                ++p;
+            }
+            uint64_t mantissa = 0;
+            int significant_digits = 0;
+            int exponent = 0;
+            bool any_digits = false;
+            for (; p != end_ && is_digit(*p); ++p) {
+                any_digits = true;
+                if (mantissa != 0 || *p != '0') {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    ++significant_digits;
+                }
+            }
+            if (p != end_ && *p == '.') {
+                for (++p; p != end_ && is_digit(*p); ++p) {
+                    any_digits = true;
+                    if (mantissa != 0 || *p != '0') {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        ++significant_digits;
+                    }
+                    --exponent;
+                }
+            }
+            if (!any_digits) {
+                return false;
+            }
+            if (p != end_ && (*p == 'e' || *p == 'E')) {
+                ++p;
+                const bool negative_exponent = p != end_ && *p == '-';
+                if (p != end_ && (*p == '-' || *p == '+')) {
+                    ++p;
+                }
+                if (p == end_ || !is_digit(*p)) {
+                    return false;
+                }
+                int explicit_exponent = 0;
+                for (; p != end_ && is_digit(*p); ++p) {
+                    explicit_exponent = min(explicit_exponent * 10 + (*p - '0'), 10000);
+                }
+                exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+            }
+            if (p != end_ && !is_space(*p)) {
+                return false;
+            }
+            position_ = p;
+
+            if (significant_digits <= 15 && -22 <= exponent && exponent <= 22) {
+                // Both the mantissa and the power of ten are exact doubles, so the result is correctly rounded
+                const double result = exponent < 0
+                                      ? static_cast<double>(mantissa) / powers_of_ten[-exponent]
+                                      : static_cast<double>(mantissa) * powers_of_ten[exponent];
+                value = negative ? -result : result;
+            } else {
+                value = strtod(string(start, p).c_str(), nullptr);
+            }
+            return true;
+        }
+    };
 }
 
 namespace hc {
@@ -31,46 +203,34 @@ namespace hc {
     }\
 } while(false)
 
-    Result<TSPInstance, TSPReadError> hc::TSPInstance::read_instance(const std::string &file_name) {
-        ifstream in(file_name);
-
-        if (!in.is_open()) {
-            return Err(TSPReadError(
-                    TSPReadError::Kind::NoFile,
-                    "Could not open file \"" + file_name + "\"."
-            ));
-        }
-        const auto &result = read_instance(in);
-
-        return result;
-    }
-
-    Result<TSPInstance, TSPReadError> TSPInstance::read_instance(istream &in) {
+    /// Parse a TSPLib instance from the text in [begin, end)
+    static Result<TSPInstance, TSPReadError> parse_instance(const char *begin, const char *end) {
         // The following code parses TSPLib files, mostly assuming that they are well-formed
+        TSPLibParser in(begin, end);
         string label, colon;
 
         string name;
         string comment;
         string type;
-        string edge_weight_type;
-        int dimension = -1;
+        EdgeWeightType edge_weight_type = EdgeWeightType::Euc2D;
+        string edge_weight_format = "FUNCTION";
+        long long dimension = -1;
 
         // Read all the front-matter
         while (true) {
-            read_label_colon(in, label, colon);
+            in.label_colon(label, colon);
             TSP_CHECK(colon, ":");
-            if (label == "NODE_COORD_SECTION") {
-                // Finish reading initial values, start reading the actual coordinates
+            if (TSPLibParser::is_section(label)) {
+                // Finish reading initial values, start reading the data sections
                 break;
             }
 
             if (label == "NAME") {
                 // NAME : a280
-                in >> name;
+                name = in.value();
             } else if (label == "COMMENT") {
                 // COMMENT : drilling problem (Ludwig)
-                string comment_line;
-                getline(in, comment_line);
+                const string comment_line = in.rest_of_line();
                 if (comment.empty()) {
                     comment = comment_line;
                 } else {
@@ -79,7 +239,7 @@ namespace hc {
                 }
             } else if (label == "TYPE") {
                 // TYPE : TSP
-                in >> type;
+                type = in.value();
                 if (type != "TSP") {
                     return Err(TSPReadError(
                             TSPReadError::Kind::WrongType,
@@ -88,16 +248,49 @@ namespace hc {
                 }
             } else if (label == "DIMENSION") {
                 // DIMENSION: 280
-                in >> dimension;
+                const string value = in.value();
+                TSPLibParser value_parser(value.data(), value.data() + value.size());
+                if (!value_parser.integer(dimension) || dimension < 0 || dimension > numeric_limits<int>::max()) {
+                    return Err(TSPReadError(
+                            TSPReadError::Kind::WrongFormat,
+                            "Expected a dimension after \"DIMENSION\"."
+                    ));
+                }
             } else if (label == "EDGE_WEIGHT_TYPE") {
                 // EDGE_WEIGHT_TYPE : EUC_2D
-                in >> edge_weight_type;
-                if (edge_weight_type != "EUC_2D") {
+                const string value = in.value();
+                if (value == "EUC_2D") {
+                    edge_weight_type = EdgeWeightType::Euc2D;
+                } else if (value == "CEIL_2D") {
+                    edge_weight_type = EdgeWeightType::Ceil2D;
+                } else if (value == "ATT") {
+                    edge_weight_type = EdgeWeightType::Att;
+                } else if (value == "GEO") {
+                    edge_weight_type = EdgeWeightType::Geo;
+                } else if (value == "EXPLICIT") {
+                    edge_weight_type = EdgeWeightType::Explicit;
+                } else {
                     return Err(TSPReadError(
                             TSPReadError::Kind::WrongDistanceMeasure,
-                            "Expected edge weight type EUC_2D type, instead got \"" + edge_weight_type + "\"."
+                            "Expected edge weight type EUC_2D, CEIL_2D, ATT, GEO, or EXPLICIT, instead got \"" +
+                            value + "\"."
                     ));
                 }
+            } else if (label == "EDGE_WEIGHT_FORMAT") {
+                // EDGE_WEIGHT_FORMAT : UPPER_ROW
+                edge_weight_format = in.value();
+            } else if (label == "NODE_COORD_TYPE") {
+                // NODE_COORD_TYPE : TWOD_COORDS
+                const string value = in.value();
+                if (value != "TWOD_COORDS" && value != "NO_COORDS") {
+                    return Err(TSPReadError(
+                            TSPReadError::Kind::WrongDistanceMeasure,
+                            "Expected node coordinate type TWOD_COORDS or NO_COORDS, instead got \"" + value + "\"."
+                    ));
+                }
+            } else if (label == "DISPLAY_DATA_TYPE") {
+                // DISPLAY_DATA_TYPE : TWOD_DISPLAY, only used for display so the value is not needed
+                (void) in.value();
             } else {
                 return Err(TSPReadError(
                         TSPReadError::Kind::WrongFormat,
@@ -106,65 +299,209 @@ namespace hc {
             }
         }
 
-        // Read all the coordinates.
-        //   1 288 149
-        vector<Point> points;
-        points.reserve(dimension);
-        bool no_scaling_needed = true;
-        vector<int> ids;
-        vector<double> xs;
-        vector<double> ys;
-        ids.reserve(dimension);
-        xs.reserve(dimension);
-        ys.reserve(dimension);
-        for (int i = 0; i < dimension; ++i) {
-            int id;
-            double x, y;
-            in >> id >> x >> y;
-            if (floor(x) != ceil(x) || floor(y) != ceil(y)) {
-                no_scaling_needed = false;
-            }
-            ids.emplace_back(id);
-            xs.emplace_back(x);
-            ys.emplace_back(y);
-        }
-        for (int i = 0; i < dimension; ++i) {
-            if (no_scaling_needed) {
-                points.emplace_back(Point(
-                        ids[i],
-                        xs[i],
-                        ys[i]
+        if (dimension < 0) {
+            return Err(TSPReadError(
+                    TSPReadError::Kind::WrongFormat,
+                    "Expected \"DIMENSION\" before \"" + label + "\"."
+            ));
+        }
+        const long long n = dimension;
+
+        // Position of the explicit length between i and j in the EDGE_WEIGHT_SECTION, or -1 if not given
+        function<long long(long long, long long)> weight_index;
+        long long weight_count = 0;
+        if (edge_weight_type == EdgeWeightType::Explicit) {
+            if (edge_weight_format == "FULL_MATRIX") {
+                weight_count = n * n;
+                weight_index = [n](long long i, long long j) { return i * n + j; };
+            } else if (edge_weight_format == "UPPER_ROW") {
+                weight_count = n * (n - 1) / 2;
+                weight_index = [n](long long i, long long j) {
+                    if (i == j) return -1LL;
+                    if (i > j) swap(i, j);
+                    return i * n - i * (i + 1) / 2 + (j - i - 1);
+                };
+            } else if (edge_weight_format == "LOWER_ROW") {
+                weight_count = n * (n - 1) / 2;
+                weight_index = [](long long i, long long j) {
+                    if (i == j) return -1LL;
+                    if (i < j) swap(i, j);
+                    return i * (i - 1) / 2 + j;
+                };
+            } else if (edge_weight_format == "UPPER_DIAG_ROW") {
+                weight_count = n * (n + 1) / 2;
+                weight_index = [n](long long i, long long j) {
+                    if (i > j) swap(i, j);
+                    return i * n - i * (i - 1) / 2 + (j - i);
+                };
+            } else if (edge_weight_format == "LOWER_DIAG_ROW") {
+                weight_count = n * (n + 1) / 2;
+                weight_index = [](long long i, long long j) {
+                    if (i < j) swap(i, j);
+                    return i * (i + 1) / 2 + j;
+                };
+            } else {
+                return Err(TSPReadError(
+                        TSPReadError::Kind::WrongDistanceMeasure,
+                        "Expected edge weight format FULL_MATRIX, UPPER_ROW, LOWER_ROW, UPPER_DIAG_ROW, or "
+                        "LOWER_DIAG_ROW, instead got \"" + edge_weight_format + "\"."
                 ));
+            }
+        }
 
+        // Coordinates are read directly into the coordinate arrays. They are kept as is while all are integers.
+        // When the first coordinate with a fraction is found, all coordinates are scaled by 10 (keeping one
+        // decimal), including those already read. Geographical coordinates are also kept exactly.
+        vector<int> xs;
+        vector<int> ys;
+        vector<double> latitudes;
+        vector<double> longitudes;
+        vector<int> weights;
+        bool scaled = false;
+        const auto store = [&](vector<int> &coordinates, double value) {
+            if (!scaled && floor(value) != ceil(value)) {
+                scaled = true;
+                for (int &x : xs) {
+                    x = approximate_as_int(x, 1);
+                }
+                for (int &y : ys) {
+                    y = approximate_as_int(y, 1);
+                }
+            }
+            coordinates.emplace_back(scaled ? approximate_as_int(value, 1) : static_cast<int>(value));
+        };
+
+        // Read the data sections until EOF (which may be left out)
+        while (!label.empty() && label != "EOF") {
+            if (label == "NODE_COORD_SECTION" || label == "DISPLAY_DATA_SECTION") {
+                //   1 288 149
+                if (!xs.empty()) {
+                    return Err(TSPReadError(
+                            TSPReadError::Kind::WrongFormat,
+                            "Coordinates given more than once, in \"" + label + "\"."
+                    ));
+                }
+                xs.reserve(n);
+                ys.reserve(n);
+                if (edge_weight_type == EdgeWeightType::Geo) {
+                    latitudes.reserve(n);
+                    longitudes.reserve(n);
+                }
+                for (long long i = 0; i < n; ++i) {
+                    long long id;
+                    double x, y;
+                    if (!in.integer(id) || !in.number(x) || !in.number(y)) {
+                        return Err(TSPReadError(
+                                TSPReadError::Kind::WrongFormat,
+                                "Could not read coordinates for node " + to_string(i + 1) + "."
+                        ));
+                    }
+                    store(xs, x);
+                    store(ys, y);
+                    if (edge_weight_type == EdgeWeightType::Geo) {
+                        latitudes.emplace_back(x);
+                        longitudes.emplace_back(y);
+                    }
+                }
+            } else if (label == "EDGE_WEIGHT_SECTION") {
+                //   0 280 305 329
+                weights.reserve(weight_count);
+                for (long long i = 0; i < weight_count; ++i) {
+                    long long weight;
+                    if (!in.integer(weight) || weight < 0 || weight > numeric_limits<int>::max()) {
+                        return Err(TSPReadError(
+                                TSPReadError::Kind::WrongFormat,
+                                "Could not read edge weight number " + to_string(i + 1) + "."
+                        ));
+                    }
+                    weights.emplace_back(weight);
+                }
+            } else if (TSPLibParser::is_section(label)) {
+                return Err(TSPReadError(
+                        TSPReadError::Kind::WrongFormat,
+                        "Unsupported section \"" + label + "\"."
+                ));
             } else {
-                points.emplace_back(Point(
-                        ids[i],
-                        approximate_as_int(xs[i], 1),
-                        approximate_as_int(ys[i], 1)
+                TSP_CHECK(label, "EOF");
+            }
+            label = in.word();
+        }
+
+        if (edge_weight_type != EdgeWeightType::Explicit || !xs.empty()) {
+            if (static_cast<long long>(xs.size()) != n) {
+                return Err(TSPReadError(
+                        TSPReadError::Kind::WrongFormat,
+                        "Expected coordinates for " + to_string(n) + " nodes."
                 ));
             }
+        }
 
+        switch (edge_weight_type) {
+            case EdgeWeightType::Euc2D:
+                return Ok(TSPInstance(name, DistanceOracle(move(xs), move(ys))));
+            case EdgeWeightType::Ceil2D:
+            case EdgeWeightType::Att:
+                return Ok(TSPInstance(name, DistanceOracle(edge_weight_type, move(xs), move(ys), scaled ? 10 : 1)));
+            case EdgeWeightType::Geo:
+                return Ok(TSPInstance(name, DistanceOracle::make_geo(latitudes, longitudes, move(xs), move(ys))));
+            case EdgeWeightType::Explicit:
+                break;
         }
 
-        // EOF
-        in >> label;
-        TSP_CHECK(label, "EOF");
+        if (static_cast<long long>(weights.size()) != weight_count) {
+            return Err(TSPReadError(
+                    TSPReadError::Kind::WrongFormat,
+                    "Expected " + to_string(weight_count) + " edge weights in \"EDGE_WEIGHT_SECTION\"."
+            ));
+        }
+        const auto length = [&](int i, int j) {
+            const long long index = weight_index(i, j);
+            return i == j || index < 0 ? 0 : weights[index];
+        };
+        int max_length = 0;
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                max_length = max(max_length, length(i, j));
+            }
+        }
+        auto matrix = make_shared<const DistanceMatrix>(static_cast<int>(n), max_length, length);
+        vector<int>().swap(weights);
 
-        const auto &result = Ok(TSPInstance(name, points));
-        return result;
+        return Ok(TSPInstance(name, DistanceOracle::make_explicit(move(matrix), move(xs), move(ys))));
     }
 
-    const BoundingBox &TSPInstance::bounds() const {
-        return bounds_;
+    Result<TSPInstance, TSPReadError> hc::TSPInstance::read_instance(const std::string &file_name) {
+        const MappedFile file(file_name);
+
+        if (!file.is_open()) {
+            return Err(TSPReadError(
+                    TSPReadError::Kind::NoFile,
+                    "Could not open file \"" + file_name + "\"."
+            ));
+        }
+
+        if (is_instance_cache(file.begin(), file.end())) {
+            return parse_instance_cache(file.begin(), file.end());
+        }
+        return parse_instance(file.begin(), file.end());
     }
 
-    const vector<std::vector<LineSegment>> &TSPInstance::lines() const {
-        return lines_;
+    Result<TSPInstance, TSPReadError> TSPInstance::read_instance(istream &in) {
+        const string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+        if (is_instance_cache(text.data(), text.data() + text.size())) {
+            return parse_instance_cache(text.data(), text.data() + text.size());
+        }
+        return parse_instance(text.data(), text.data() + text.size());
+    }
+
+    const BoundingBox &TSPInstance::bounds() const {
+        return bounds_;
     }
 
 #undef TSP_CHECK
 
-    DominatedEdges DominatedEdges::make_for_instance_spatial_index(const TSPInstance &instance) {
+    DominatedEdges DominatedEdges::make_for_instance_spatial_index(const TSPInstance &instance, int threads) {
         // Clock function used.
         auto now = [] { return std::chrono::steady_clock::now(); };
         const auto de_start = now();
@@ -190,41 +527,66 @@ namespace hc {
 //        std::cout << "Ran spatial index construction in " << si_duration.count()
 //                  << std::endl;
 
-        vector<vector<vector<Edge>>> result(instance.locations(), vector<vector<Edge>>(instance.locations(), vector<Edge>()));
-
-        for (int start1 = 0; start1 < instance.locations(); ++start1) {
-            for (int end1 = start1+1; end1 < instance.locations(); ++end1) {
-                const LineSegment &s1e1 = instance.line(start1, end1);
-                index.visit(
-                        s1e1.bounding_box(),
-                        [&](const pair<int, int>& other) {
-                            int start2 = other.first;
-                            int end2 = other.second;
-                            if (start2 <= start1 || start2 == end1 || end2 == start1 || end2 == end1) {
-                                // Only non-symmetric pairs with 4 different points should be checked
-                                return;
-                            }
-                            const LineSegment &s2e2 = instance.line(start2, end2);
-                            if (intersects(s1e1, s2e2)) {
-                                const LineSegment &s2e1 = instance.line(start2, end1);
-                                const LineSegment &s1e2 = instance.line(start1, end2);
-                                if (dominating_in_euclidean_tsp(s1e2, s2e1, s1e1, s2e2)) {
-                                    // Since s1e2 combined with s2e1 dominates s1e1 and s2e2, all combinations
-                                    // of edges in the latter two are incompatible.
-                                    result[start1][end1].emplace_back(Edge(start2, end2));
-                                    result[start1][end1].emplace_back(Edge(end2, start2));
-                                    result[end1][start1].emplace_back(Edge(start2, end2));
-                                    result[end1][start1].emplace_back(Edge(end2, start2));
-
-                                    result[start2][end2].emplace_back(Edge(start1, end1));
-                                    result[start2][end2].emplace_back(Edge(end1, start1));
-                                    result[end2][start2].emplace_back(Edge(start1, end1));
-                                    result[end2][start2].emplace_back(Edge(end1, start1));
+        // Each start node is handled by one worker, which records the dominating quadruples found for it in the
+        // order of the sequential loop. The quadruples are merged in order of start node afterwards, so that the
+        // result does not depend on the number of threads or on the scheduling.
+        const int nodes = instance.locations();
+        vector<vector<array<int, 4>>> found(nodes);
+        atomic<int> next_start(0);
+        const auto worker = [&]() {
+            // The segments with overlapping bounding boxes are collected and tested for intersection together
+            vector<pair<int, int>> others;
+            SegmentArrays other_segments;
+            vector<char> intersecting;
+            for (int start1 = next_start.fetch_add(1); start1 < nodes; start1 = next_start.fetch_add(1)) {
+                vector<array<int, 4>> &local = found[start1];
+                for (int end1 = start1+1; end1 < nodes; ++end1) {
+                    const LineSegment s1e1 = instance.line(start1, end1);
+                    others.clear();
+                    other_segments.clear();
+                    index.visit(
+                            s1e1.bounding_box(),
+                            [&](const pair<int, int>& other) {
+                                int start2 = other.first;
+                                int end2 = other.second;
+                                if (start2 <= start1 || start2 == end1 || end2 == start1 || end2 == end1) {
+                                    // Only non-symmetric pairs with 4 different points should be checked
+                                    return;
                                 }
+                                others.emplace_back(other);
+                                other_segments.push_back(instance.line(start2, end2));
+                            }
+                    );
+                    intersects_many(s1e1, other_segments, intersecting);
+                    for (size_t i = 0; i < others.size(); ++i) {
+                        if (intersecting[i]) {
+                            const auto [start2, end2] = others[i];
+                            const LineSegment s2e2 = instance.line(start2, end2);
+                            const LineSegment s2e1 = instance.line(start2, end1);
+                            const LineSegment s1e2 = instance.line(start1, end2);
+                            if (dominating_in_euclidean_tsp(s1e2, s2e1, s1e1, s2e2)) {
+                                // Since s1e2 combined with s2e1 dominates s1e1 and s2e2, all combinations
+                                // of edges in the latter two are incompatible.
+                                local.push_back({start1, end1, start2, end2});
                             }
                         }
-                );
+                    }
+                }
             }
+        };
+
+        if (threads <= 0) {
+            threads = static_cast<int>(thread::hardware_concurrency());
+        }
+        threads = max(1, min(threads, nodes));
+        vector<thread> workers;
+        workers.reserve(threads - 1);
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto &w : workers) {
+            w.join();
         }
 
         const auto de_end = now();
@@ -233,7 +595,7 @@ namespace hc {
 //        std::cout << "Ran dominated edges construction in " << de_duration.count()
 //                  << std::endl;
 
-        return DominatedEdges(std::move(result));
+        return from_incompatible_pairs(nodes, std::move(found));
     }
 
     DominatedEdges DominatedEdges::make_for_instance_all_vs_all(const TSPInstance &instance) {
@@ -246,44 +608,28 @@ namespace hc {
         // TODO: edges and checking if their corresponding non-crossing pair dominates them.
         // Fins for some initial testing though.
 
-        vector<vector<vector<Edge>>> result(instance.locations(), vector<vector<Edge>>(instance.locations(), vector<Edge>()));
+        vector<vector<array<int, 4>>> found(instance.locations());
 
         for (int start1 = 0; start1 < instance.locations(); ++start1) {
             for (int end1 = start1+1; end1 < instance.locations(); ++end1) {
-                const LineSegment& s1e1 = instance.line(start1, end1);
+                const LineSegment s1e1 = instance.line(start1, end1);
                 for (int start2 = start1+1; start2 < instance.locations(); ++start2) {
                     if (start2 != end1) { // Note: start2 != start1 by construction
                         for (int end2 = start2+1; end2 < instance.locations(); ++end2) {
                             if (end2 != end1) {// Note: end2 != start1 by construction
-                                const LineSegment& s2e2 = instance.line(start2, end2);
+                                const LineSegment s2e2 = instance.line(start2, end2);
 
-                                const LineSegment& s1e2 = instance.line(start1, end2);
-                                const LineSegment& s2e1 = instance.line(start2, end1);
+                                const LineSegment s1e2 = instance.line(start1, end2);
+                                const LineSegment s2e1 = instance.line(start2, end1);
 
                                 if (dominating_in_euclidean_tsp(s1e1, s2e2, s1e2, s2e1)) {
                                     // Since s1e1 combined with s2e2 dominates s1e2 and s2e1, all combinations
                                     // of edges in the latter two are incompatible
-                                    result[start1][end2].emplace_back(Edge(start2, end1));
-                                    result[start1][end2].emplace_back(Edge(end1, start2));
-                                    result[end2][start1].emplace_back(Edge(start2, end1));
-                                    result[end2][start1].emplace_back(Edge(end1, start2));
-
-                                    result[start2][end1].emplace_back(Edge(start1, end2));
-                                    result[start2][end1].emplace_back(Edge(end2, start1));
-                                    result[end1][start2].emplace_back(Edge(start1, end2));
-                                    result[end1][start2].emplace_back(Edge(end2, start1));
+                                    found[start1].push_back({start1, end2, start2, end1});
                                 } else if (dominating_in_euclidean_tsp(s1e2, s2e1, s1e1, s2e2)) {
                                     // Since s1e2 combined with s2e1 dominates s1e1 and s2e2, all combinations
                                     // of edges in the latter two are incompatible.
-                                    result[start1][end1].emplace_back(Edge(start2, end2));
-                                    result[start1][end1].emplace_back(Edge(end2, start2));
-                                    result[end1][start1].emplace_back(Edge(start2, end2));
-                                    result[end1][start1].emplace_back(Edge(end2, start2));
-
-                                    result[start2][end2].emplace_back(Edge(start1, end1));
-                                    result[start2][end2].emplace_back(Edge(end1, start1));
-                                    result[end2][start2].emplace_back(Edge(start1, end1));
-                                    result[end2][start2].emplace_back(Edge(end1, start1));
+                                    found[start1].push_back({start1, end1, start2, end2});
                                 }
                             }
                         }
@@ -292,12 +638,7 @@ namespace hc {
             }
         }
 
-        for (int i = 0; i < instance.locations(); ++i) {
-            for (int j = 0; j < instance.locations(); ++j) {
-                sort(result[i][j].begin(), result[i][j].end());
-                result[i][j].erase(unique(result[i][j].begin(), result[i][j].end()), result[i][j].end());
-            }
-        }
+        DominatedEdges result = from_incompatible_pairs(instance.locations(), std::move(found));
 
         const auto de_end = now();
         const std::chrono::duration<double, std::milli> de_duration =
@@ -307,6 +648,224 @@ namespace hc {
                   << std::endl;
 
 
-        return DominatedEdges(std::move(result));
+        return result;
+    }
+
+    DominatedEdges DominatedEdges::from_incompatible_pairs(int nodes, vector<vector<array<int, 4>>> pairs) {
+        // Bucket the pairs by the smaller node of each of their two edges, as entries {to, other from, other to}
+        // where the undirected edge from-to is one half of the pair and the dominated edge is the other half.
+        const auto canonical = [](int a, int b) {
+            return a < b ? make_pair(a, b) : make_pair(b, a);
+        };
+        vector<uint64_t> node_offsets(static_cast<size_t>(nodes) + 1, 0);
+        for (const auto &list : pairs) {
+            for (const auto &[a, b, c, d] : list) {
+                ++node_offsets[min(a, b) + 1];
+                ++node_offsets[min(c, d) + 1];
+            }
+        }
+        partial_sum(node_offsets.begin(), node_offsets.end(), node_offsets.begin());
+        vector<array<int, 3>> entries(node_offsets[nodes]);
+        {
+            vector<uint64_t> position(node_offsets.begin(), node_offsets.end() - 1);
+            for (auto &list : pairs) {
+                for (const auto &[a, b, c, d] : list) {
+                    const auto [first_from, first_to] = canonical(a, b);
+                    const auto [second_from, second_to] = canonical(c, d);
+                    entries[position[first_from]++] = {first_to, second_from, second_to};
+                    entries[position[second_from]++] = {second_to, first_from, first_to};
+                }
+                vector<array<int, 4>>().swap(list);
+            }
+        }
+
+        vector<uint64_t> from_offsets;
+        vector<int> keys;
+        vector<uint64_t> edge_offsets;
+        vector<Edge> edges;
+        from_offsets.reserve(static_cast<size_t>(nodes) + 1);
+        edges.reserve(entries.size());
+        from_offsets.emplace_back(0);
+
+        // Each row is packed as (to, dominated from, dominated to) with bits per node, and sorted so that it can be
+        // deduplicated as plain integers. Rows with at least one entry per count use a least significant digit radix
+        // sort with digits of at most 11 bits, shorter rows use std::sort, so that an almost empty row does not cost
+        // time proportional to the number of nodes.
+        int bits = 1;
+        while ((1 << bits) < nodes) {
+            ++bits;
+        }
+        const uint64_t mask = (uint64_t(1) << bits) - 1;
+        const auto pack = [&](int to, int dominated_from, int dominated_to) {
+            return (((static_cast<uint64_t>(to) << bits) | static_cast<uint64_t>(dominated_from)) << bits) |
+                   static_cast<uint64_t>(dominated_to);
+        };
+        const int passes = (3 * bits + 10) / 11;
+        const int digit_bits = (3 * bits + passes - 1) / passes;
+        const uint64_t digit_mask = (uint64_t(1) << digit_bits) - 1;
+        vector<uint64_t> row;
+        vector<uint64_t> buffer;
+        vector<uint64_t> counts(digit_mask + 2);
+        for (int from = 0; from < nodes; ++from) {
+            row.clear();
+            for (uint64_t i = node_offsets[from]; i < node_offsets[from + 1]; ++i) {
+                const auto [to, other_from, other_to] = entries[i];
+                row.emplace_back(pack(to, other_from, other_to));
+            }
+            if (row.size() <= digit_mask) {
+                sort(row.begin(), row.end());
+            } else {
+                buffer.resize(row.size());
+                for (int shift = 0; shift < 3 * bits; shift += digit_bits) {
+                    fill(counts.begin(), counts.end(), 0);
+                    for (const uint64_t value : row) {
+                        ++counts[((value >> shift) & digit_mask) + 1];
+                    }
+                    partial_sum(counts.begin(), counts.end(), counts.begin());
+                    for (const uint64_t value : row) {
+                        buffer[counts[(value >> shift) & digit_mask]++] = value;
+                    }
+                    row.swap(buffer);
+                }
+            }
+
+            for (size_t i = 0; i < row.size(); ++i) {
+                if (i > 0 && row[i] == row[i - 1]) {
+                    continue;
+                }
+                const int to = static_cast<int>(row[i] >> (2 * bits));
+                if (i == 0 || to != static_cast<int>(row[i - 1] >> (2 * bits))) {
+                    keys.emplace_back(to);
+                    edge_offsets.emplace_back(edges.size());
+                }
+                edges.emplace_back(Edge(static_cast<int>((row[i] >> bits) & mask), static_cast<int>(row[i] & mask)));
+            }
+            from_offsets.emplace_back(keys.size());
+        }
+        edge_offsets.emplace_back(edges.size());
+        edges.shrink_to_fit();
+
+        return DominatedEdges(std::move(from_offsets), std::move(keys), std::move(edge_offsets), std::move(edges));
+    }
+
+    vector<Edge> DominatedEdgesMemo::compute(const TSPInstance &instance, int from, int to) {
+        if (from == to) {
+            return {};
+        }
+        const int nodes = instance.locations();
+        const vector<int> &xs = instance.distances().xs();
+        const vector<int> &ys = instance.distances().ys();
+        const auto cross = [&](int o, int a, int b) {
+            return (static_cast<long long>(xs[a]) - xs[o]) * (static_cast<long long>(ys[b]) - ys[o]) -
+                   (static_cast<long long>(ys[a]) - ys[o]) * (static_cast<long long>(xs[b]) - xs[o]);
+        };
+
+        // Check the pair the same way as make_for_instance_spatial_index, with the edge with the smaller start
+        // as the first edge.
+        vector<Edge> result;
+        const auto check = [&](int start, int end) {
+            if (start > end) {
+                swap(start, end);
+            }
+            const bool edge_first = from < start;
+            const int start1 = edge_first ? from : start;
+            const int end1 = edge_first ? to : end;
+            const int start2 = edge_first ? start : from;
+            const int end2 = edge_first ? end : to;
+            const LineSegment s1e1 = instance.line(start1, end1);
+            const LineSegment s2e2 = instance.line(start2, end2);
+            if (intersects(s1e1, s2e2)) {
+                const LineSegment s2e1 = instance.line(start2, end1);
+                const LineSegment s1e2 = instance.line(start1, end2);
+                if (dominating_in_euclidean_tsp(s1e2, s2e1, s1e1, s2e2)) {
+                    result.emplace_back(Edge(start, end));
+                }
+            }
+        };
+
+        // A segment can only cross the edge if its ends are on different sides of the line through the edge,
+        // or if one of them is on the line.
+        vector<Orientation> sides;
+        orientations(Point(xs[from], ys[from]), Point(xs[to], ys[to]), xs, ys, sides);
+        vector<int> left;
+        vector<int> right;
+        vector<int> on_line;
+        for (int node = 0; node < nodes; ++node) {
+            if (node == from || node == to) {
+                continue;
+            }
+            // Counter-clockwise is a positive cross product
+            const Orientation side = sides[node];
+            (side == Orientation::CounterClockwise ? left : side == Orientation::Clockwise ? right : on_line)
+                    .emplace_back(node);
+        }
+
+        for (const int start : left) {
+            for (const int end : right) {
+                // The ends of the edge must also be on different sides of the line through the segment
+                const long long from_side = cross(start, end, from);
+                const long long to_side = cross(start, end, to);
+                if ((from_side > 0 && to_side > 0) || (from_side < 0 && to_side < 0)) {
+                    continue;
+                }
+                check(start, end);
+            }
+        }
+        for (size_t i = 0; i < on_line.size(); ++i) {
+            for (const int other : left) {
+                check(on_line[i], other);
+            }
+            for (const int other : right) {
+                check(on_line[i], other);
+            }
+            for (size_t j = i + 1; j < on_line.size(); ++j) {
+                check(on_line[i], on_line[j]);
+            }
+        }
+
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    DominatedEdges::DirectedRange DominatedEdgesMemo::dominated(const TSPInstance &instance, Edge edge) const {
+        const int from = min(edge.from(), edge.to());
+        const int to = max(edge.from(), edge.to());
+        const uint64_t key = static_cast<uint64_t>(from) * instance.locations() + to;
+        const auto range = [](const vector<Edge> &edges) {
+            return DominatedEdges::DirectedRange(DominatedEdges::Range(edges.data(), edges.data() + edges.size()));
+        };
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            const auto found = memo_.find(key);
+            if (found != memo_.end()) {
+                return range(found->second);
+            }
+        }
+
+        // Compute without holding the lock, if another thread was first its (identical) result is kept.
+        // References to the elements of an unordered map stay valid when it grows.
+        vector<Edge> computed = compute(instance, from, to);
+        lock_guard<mutex> lock(mutex_);
+        return range(memo_.emplace(key, std::move(computed)).first->second);
+    }
+
+    DominatedEdges DominatedEdges::make_from_flat(int nodes,
+                                                  const uint64_t *from_offsets,
+                                                  const int32_t *keys,
+                                                  const uint64_t *edge_offsets,
+                                                  const int32_t *edges) {
+        const uint64_t key_count = from_offsets[nodes];
+        const uint64_t edge_count = edge_offsets[key_count];
+        vector<Edge> flat_edges;
+        flat_edges.reserve(edge_count);
+        for (uint64_t edge = 0; edge < edge_count; ++edge) {
+            flat_edges.emplace_back(Edge(edges[2 * edge], edges[2 * edge + 1]));
+        }
+
+        return DominatedEdges(vector<uint64_t>(from_offsets, from_offsets + nodes + 1),
+                              vector<int>(keys, keys + key_count),
+                              vector<uint64_t>(edge_offsets, edge_offsets + key_count + 1),
+                              std::move(flat_edges));
     }
 }
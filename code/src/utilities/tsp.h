@@ -1,7 +1,14 @@
 #ifndef HC_TSP_H
 #define HC_TSP_H
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <ostream>
@@ -9,6 +16,9 @@
 
 #include "extern/result.h"
 #include "utilities/geometry.h"
+#include "utilities/distances.h"
+#include "utilities/candidate_graph.h"
+#include "utilities/lazy.h"
 
 namespace hc {
     struct TSPReadError {
@@ -88,71 +98,242 @@ namespace hc {
 
     class TSPInstance;
 
+    /**
+     * For each edge, the edges that can not be used together with it in an optimal tour.
+     *
+     * Domination is symmetric in the direction of the edges, so only undirected edges are stored, each as the
+     * edge from its smaller to its larger node. The edges are stored in compressed sparse row form. The
+     * undirected edges from a node that dominate some edges are listed by their end node, and the dominated
+     * undirected edges for all of them are stored in one flat array, sorted and without duplicates for each
+     * dominating edge. Lookups expand the undirected edges into both directions.
+     */
     class DominatedEdges {
-        /// Domainated edges indexed by dominated_[from][to]
-        const std::vector<std::vector<std::vector<Edge>>> dominated_;
-        
-        explicit DominatedEdges(std::vector<std::vector<std::vector<Edge>>> dominated) 
-                : dominated_(std::move(dominated)) {}
     public:
-        static DominatedEdges make_for_instance_spatial_index(const TSPInstance& instance);
+        /// Undirected edges (from < to) dominated by some edge, a contiguous range of the flat edge array
+        class Range {
+            const Edge *begin_;
+            const Edge *end_;
+        public:
+            Range(const Edge *begin, const Edge *end) : begin_(begin), end_(end) {}
+
+            [[nodiscard]] const Edge *begin() const {
+                return begin_;
+            }
+
+            [[nodiscard]] const Edge *end() const {
+                return end_;
+            }
+
+            [[nodiscard]] std::size_t size() const {
+                return end_ - begin_;
+            }
+
+            [[nodiscard]] bool empty() const {
+                return begin_ == end_;
+            }
+        };
+
+        /// The directed edges dominated by some edge, expanding each undirected edge a-b into a->b and b->a
+        class DirectedRange {
+            Range undirected_;
+        public:
+            class Iterator {
+                const Edge *edge_;
+                bool reversed_;
+            public:
+                Iterator(const Edge *edge, bool reversed) : edge_(edge), reversed_(reversed) {}
+
+                Edge operator*() const {
+                    return reversed_ ? Edge(edge_->to(), edge_->from()) : Edge(edge_->from(), edge_->to());
+                }
+
+                Iterator &operator++() {
+                    if (reversed_) {
+                        ++edge_;
+                    }
+                    reversed_ = !reversed_;
+                    return *this;
+                }
+
+                bool operator==(const Iterator &other) const {
+                    return edge_ == other.edge_ && reversed_ == other.reversed_;
+                }
+
+                bool operator!=(const Iterator &other) const {
+                    return !(*this == other);
+                }
+            };
+
+            explicit DirectedRange(Range undirected) : undirected_(undirected) {}
+
+            [[nodiscard]] Iterator begin() const {
+                return Iterator(undirected_.begin(), false);
+            }
+
+            [[nodiscard]] Iterator end() const {
+                return Iterator(undirected_.end(), false);
+            }
+
+            [[nodiscard]] std::size_t size() const {
+                return 2 * undirected_.size();
+            }
+
+            [[nodiscard]] bool empty() const {
+                return undirected_.empty();
+            }
+
+            /// The undirected edges, each stored once
+            [[nodiscard]] const Range &undirected() const {
+                return undirected_;
+            }
+        };
+
+    private:
+        /// The keys for edges from node i are keys_[from_offsets_[i]] to keys_[from_offsets_[i + 1] - 1]
+        std::vector<std::uint64_t> from_offsets_;
+        /// The end node (larger than the start node) of each edge that dominates some edges, sorted for each start node
+        std::vector<int> keys_;
+        /// The edges dominated by key k are edges_[edge_offsets_[k]] to edges_[edge_offsets_[k + 1] - 1]
+        std::vector<std::uint64_t> edge_offsets_;
+        std::vector<Edge> edges_;
+
+        DominatedEdges(std::vector<std::uint64_t> from_offsets,
+                       std::vector<int> keys,
+                       std::vector<std::uint64_t> edge_offsets,
+                       std::vector<Edge> edges)
+                : from_offsets_(std::move(from_offsets)), keys_(std::move(keys)),
+                  edge_offsets_(std::move(edge_offsets)), edges_(std::move(edges)) {}
+
+        /**
+         * Dominated edges from incompatible pairs of undirected edges.
+         *
+         * @param pairs Lists of quadruples {a, b, c, d}, each meaning that the edge a-b can not be used together
+         *        with the edge c-d. The lists are consumed.
+         */
+        static DominatedEdges from_incompatible_pairs(int nodes, std::vector<std::vector<std::array<int, 4>>> pairs);
+    public:
+        /**
+         * Dominated edges found by checking each edge against the crossing edges from a spatial index.
+         *
+         * @param threads The number of threads to use, 0 means one per hardware thread. The result is the same
+         *        for any number of threads.
+         */
+        static DominatedEdges make_for_instance_spatial_index(const TSPInstance& instance, int threads = 0);
         static DominatedEdges make_for_instance_all_vs_all(const TSPInstance& instance);
-        const std::vector<Edge>& dominated(Edge edge) {
-            return dominated_[edge.from()][edge.to()];
+
+        /**
+         * Dominated edges from a flat representation, for example when loaded from a file.
+         *
+         * @param nodes The number of nodes
+         * @param from_offsets The keys for edges from node i are keys[from_offsets[i]] to keys[from_offsets[i + 1] - 1]
+         * @param keys The end node of each undirected edge that dominates some edges
+         * @param edge_offsets The edges dominated by key k are edges[edge_offsets[k]] to edges[edge_offsets[k + 1] - 1]
+         * @param edges The dominated undirected edges as pairs of nodes, the smaller node first
+         */
+        static DominatedEdges make_from_flat(int nodes,
+                                             const std::uint64_t *from_offsets,
+                                             const std::int32_t *keys,
+                                             const std::uint64_t *edge_offsets,
+                                             const std::int32_t *edges);
+
+        /// The edges dominated by \a edge, in both directions
+        [[nodiscard]] DirectedRange dominated(Edge edge) const {
+            const int from = std::min(edge.from(), edge.to());
+            const int to = std::max(edge.from(), edge.to());
+            const auto keys_begin = keys_.begin() + from_offsets_[from];
+            const auto keys_end = keys_.begin() + from_offsets_[from + 1];
+            const auto key = std::lower_bound(keys_begin, keys_end, to);
+            if (key == keys_end || *key != to) {
+                return DirectedRange(Range(nullptr, nullptr));
+            }
+            const std::size_t index = key - keys_.begin();
+            return DirectedRange(Range(edges_.data() + edge_offsets_[index], edges_.data() + edge_offsets_[index + 1]));
+        }
+
+        /**
+         * Call \a f(from, to, dominated) for each undirected edge from-to (from < to) that dominates some edges,
+         * ordered by from and to. The dominated edges are undirected as well.
+         */
+        template<typename F>
+        void for_each(const F &f) const {
+            for (int from = 0; from + 1 < static_cast<int>(from_offsets_.size()); ++from) {
+                for (std::uint64_t key = from_offsets_[from]; key < from_offsets_[from + 1]; ++key) {
+                    f(from, keys_[key], Range(edges_.data() + edge_offsets_[key],
+                                              edges_.data() + edge_offsets_[key + 1]));
+                }
+            }
+        }
+
+        /// The number of bytes used by the dominated edges
+        [[nodiscard]] std::size_t memory_bytes() const {
+            return from_offsets_.capacity() * sizeof(std::uint64_t) + keys_.capacity() * sizeof(int) +
+                   edge_offsets_.capacity() * sizeof(std::uint64_t) + edges_.capacity() * sizeof(Edge);
         }
     };
 
 
+    /**
+     * Dominated edges computed for one edge at a time, the first time the edge is asked for.
+     *
+     * Gives the same edges as \a DominatedEdges::make_for_instance_spatial_index, but instead of a quadratic
+     * precomputation each edge is checked against all other edges when needed. The computed edges are kept, and
+     * the memo can be shared between threads.
+     */
+    class DominatedEdgesMemo {
+        mutable std::mutex mutex_;
+        /// Dominated undirected edges (from < to), indexed by from * nodes + to for the undirected edge from < to
+        mutable std::unordered_map<std::uint64_t, std::vector<Edge>> memo_;
+
+        /// The undirected edges (from < to) dominated by the undirected edge \a from - \a to, sorted
+        static std::vector<Edge> compute(const TSPInstance& instance, int from, int to);
+    public:
+        /// The edges dominated by \a edge, in both directions
+        DominatedEdges::DirectedRange dominated(const TSPInstance& instance, Edge edge) const;
+    };
+
     class TSPInstance {
         const std::string name_;
-        const std::vector<Point> locations_;
-        const std::vector<std::vector<LineSegment>> lines_;
-        const std::vector<LineSegment> lines_length_ordered_;
+        DistanceOracle distances_;
         const std::vector<int> max_costs_;
         const int max_cost_;
         const BoundingBox bounds_;
-        mutable std::optional<DominatedEdges> dominated_edges_;
-
-        static std::vector<std::vector<LineSegment>> compute_lines(const std::vector<Point>& locations) {
-            std::vector<std::vector<LineSegment>> result(locations.size(), std::vector<LineSegment>());
-
-            for (std::size_t i = 0; i < locations.size(); ++i) {
-                result[i].reserve(locations.size());
-                for (std::size_t j = 0; j < locations.size(); ++j) {
-                    result[i].emplace_back(LineSegment(locations[i], locations[j]));
-                }
-            }
-
-            return result;
-        }
+        Lazy<std::vector<LineSegment>> lines_length_ordered_;
+        Lazy<CandidateGraph> candidate_graph_;
+        Lazy<DominatedEdges> dominated_edges_;
+        std::shared_ptr<DominatedEdgesMemo> dominated_edges_memo_;
 
-        static std::vector<LineSegment> compute_lines_length_ordered(const std::vector<std::vector<LineSegment>>& line_segments) {
+        static std::vector<LineSegment> compute_lines_length_ordered(const DistanceOracle& distances) {
             std::vector<LineSegment> result;
+            result.reserve(static_cast<std::size_t>(distances.size()) * distances.size());
 
-            int size = 0;
-            for (const auto & lines : line_segments) {
-                size += lines.size();
-            }
-            result.reserve(size);
-
-            for (const auto & lines : line_segments) {
-                result.insert(result.end(), lines.begin(), lines.end());
+            for (int i = 0; i < distances.size(); ++i) {
+                for (int j = 0; j < distances.size(); ++j) {
+                    result.emplace_back(distances.line(i, j));
+                }
             }
 
-            std::sort(result.begin(), result.end(), [](LineSegment& a, LineSegment& b){
+            std::sort(result.begin(), result.end(), [](const LineSegment& a, const LineSegment& b){
                 return a.length() < b.length();
             });
 
             return result;
         }
 
-        static std::vector<int> compute_max_costs(const std::vector<std::vector<LineSegment>>& graph) {
+        static std::vector<int> compute_max_costs(const DistanceOracle& distances) {
+            // With an embedding, the location farthest away from any location is a corner of the convex hull
+            std::vector<int> candidates;
+            if (distances.has_embedding()) {
+                candidates = convex_hull(distances.xs(), distances.ys());
+            } else {
+                candidates.resize(distances.size());
+                std::iota(candidates.begin(), candidates.end(), 0);
+            }
             std::vector<int> result;
-            result.reserve(graph.size());
-            for (const auto &node_lines : graph) {
-                int max_cost = -1;
-                for (const auto &line : node_lines) {
-                    max_cost = std::max(max_cost, line.length());
+            result.reserve(distances.size());
+            for (int i = 0; i < distances.size(); ++i) {
+                int max_cost = 0;
+                for (int j : candidates) {
+                    max_cost = std::max(max_cost, distances.length(i, j));
                 }
                 result.emplace_back(max_cost);
             }
@@ -160,14 +341,19 @@ namespace hc {
             return result;
         }
     public:
-        TSPInstance(std::string name, std::vector<Point> locations)
+        TSPInstance(std::string name, DistanceOracle distances, int dense_limit = DistanceOracle::default_dense_limit)
                 : name_(std::move(name)),
-                  locations_(std::move(locations)),
-                  lines_(compute_lines(locations_)),
-                  lines_length_ordered_(compute_lines_length_ordered(lines_)),
-                  max_costs_(compute_max_costs(lines_)),
+                  distances_(std::move(distances)),
+                  max_costs_(compute_max_costs(distances_)),
                   max_cost_(*std::max_element(max_costs_.begin(), max_costs_.end())),
-                  bounds_(BoundingBox::from(locations_))
+                  bounds_(distances_.bounds()),
+                  dominated_edges_memo_(std::make_shared<DominatedEdgesMemo>())
+        {
+            store_dense_lengths(dense_limit);
+        }
+
+        TSPInstance(std::string name, const std::vector<Point>& locations)
+                : TSPInstance(std::move(name), DistanceOracle(locations))
         {
 //            assert(locations.size() > 0);
         }
@@ -196,37 +382,100 @@ namespace hc {
         }
 
         [[nodiscard]] int locations() const {
-            return locations_.size();
+            return distances_.size();
+        }
+
+        [[nodiscard]] Point location(int i) const {
+            return distances_.location(i);
+        }
+
+        [[nodiscard]] EdgeWeightType edge_weight_type() const {
+            return distances_.type();
+        }
+
+        /// True iff the locations are embedded in the plane, see \a DistanceOracle::has_embedding
+        [[nodiscard]] bool has_embedding() const {
+            return distances_.has_embedding();
         }
 
-        [[nodiscard]] const Point& location(int i) const {
-            return locations_[i];
+        /// The distance oracle for the instance, computing lengths and line segments on demand
+        [[nodiscard]] const DistanceOracle& distances() const {
+            return distances_;
         }
 
-        [[nodiscard]] const LineSegment& line(int i, int j) const {
-            return lines_.at(i).at(j);
+        /// Enable a shared cache of lengths with (at least) \a capacity entries, 0 disables the cache.
+        void cache_lengths(std::size_t capacity) const {
+            distances_.cache_lengths(capacity);
         }
 
-        const std::vector<std::vector<LineSegment>> &lines() const;
+        /**
+         * Store a dense length matrix when there are at most \a limit locations, else compute lengths on demand.
+         *
+         * Should be called before the instance is shared between threads.
+         */
+        void store_dense_lengths(int limit) const {
+            distances_.store_dense_lengths(limit, max_cost_);
+        }
+
+        [[nodiscard]] int length(int i, int j) const {
+            return distances_.length(i, j);
+        }
 
+        [[nodiscard]] LineSegment line(int i, int j) const {
+            return distances_.line(i, j);
+        }
+
+        /// All the lines in the instance ordered by length, computed on first use since it uses quadratic memory.
         const std::vector<LineSegment> &lines_length_ordered() const {
-            return lines_length_ordered_;
+            return lines_length_ordered_.get([&] { return compute_lines_length_ordered(distances_); });
         }
 
-        void compute_dominated_edges() const {
-            if (dominated_edges_.has_value()) {
-                return;
-            }
+        /**
+         * Sparse graph of the nearest and quadrant neighbours of each location, computed on first use.
+         *
+         * Uses O(nk) memory, and should be preferred to \a lines_length_ordered when a few short edges suffice.
+         */
+        [[nodiscard]] const CandidateGraph &candidate_graph() const {
+            return candidate_graph_.get([&] { return CandidateGraph(distances_); });
+        }
 
-            const DominatedEdges &dominated_edges = DominatedEdges::make_for_instance_spatial_index(*this);
-//            const DominatedEdges &dominated_edges = DominatedEdges::make_for_instance_all_vs_all(*this);
-            dominated_edges_.emplace(dominated_edges);
+        /// Use \a graph as the candidate graph, unless it has already been computed
+        void preload_candidate_graph(CandidateGraph graph) const {
+            (void) candidate_graph_.get([&] { return std::move(graph); });
         }
 
-        [[nodiscard]] DominatedEdges& dominated_edges() const {
-            compute_dominated_edges();
+        /// Use \a edges as the dominated edges, unless they have already been computed
+        void preload_dominated_edges(DominatedEdges edges) const {
+            (void) dominated_edges_.get([&] { return std::move(edges); });
+        }
+
+        /// True iff the dominated edges have been computed (or preloaded)
+        [[nodiscard]] bool has_dominated_edges() const {
+            return dominated_edges_.has_value();
+        }
+
+        void compute_dominated_edges() const {
+            (void) dominated_edges();
+        }
 
-            return dominated_edges_.value();
+        [[nodiscard]] const DominatedEdges& dominated_edges() const {
+            return dominated_edges_.get([&] {
+                return DominatedEdges::make_for_instance_spatial_index(*this);
+//                return DominatedEdges::make_for_instance_all_vs_all(*this);
+            });
+        }
+
+        /**
+         * The edges dominated by \a edge, in both directions.
+         *
+         * Uses the dominated edges if they have been computed (or preloaded). Otherwise only the dominated edges
+         * for \a edge are computed and kept, in a memo shared by all copies of the instance.
+         */
+        [[nodiscard]] DominatedEdges::DirectedRange dominated(Edge edge) const {
+            if (has_dominated_edges()) {
+                return dominated_edges().dominated(edge);
+            }
+            return dominated_edges_memo_->dominated(*this, edge);
         }
 
         const BoundingBox &bounds() const;
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <iostream>
+#include <random>
 
 #include "utilities/geometry.h"
 
@@ -133,4 +134,62 @@ TEST_CASE("Line segment intersection", "[LineSegment]") {
             }
         }
     }
+
+    SECTION("Large coordinates") {
+        // The cross products are far outside the range of an int
+        const Point a(0, 0);
+        const Point b(2000000, 1000000);
+        const Point c(1000000, 2000000);
+        REQUIRE(orientation(a, b, c) == Orientation::CounterClockwise);
+        REQUIRE(orientation(a, c, b) == Orientation::Clockwise);
+        REQUIRE(orientation(a, b, Point(4000000, 2000000)) == Orientation::Colinear);
+
+        REQUIRE(intersects(LineSegment(a, Point(3000000, 3000000)), LineSegment(b, c)));
+        REQUIRE(!intersects(LineSegment(a, Point(1000000, 1000000 - 1)), LineSegment(b, c)));
+    }
+}
+
+
+TEST_CASE("Batched intersection", "[LineSegment]") {
+    mt19937 rng(4711);
+    // Small coordinates give many colinear and touching segments, large ones would overflow with int products
+    for (const int range : {4, 1000, 100000000}) {
+        uniform_int_distribution<int> coordinate(0, range);
+        const auto random_point = [&]() {
+            return Point(coordinate(rng), coordinate(rng));
+        };
+
+        for (int round = 0; round < 50; ++round) {
+            SegmentArrays segments;
+            vector<LineSegment> expected;
+            const int size = round;
+            for (int i = 0; i < size; ++i) {
+                const LineSegment segment(random_point(), random_point(), 0);
+                segments.push_back(segment);
+                expected.emplace_back(segment);
+            }
+            REQUIRE(segments.size() == size);
+
+            const LineSegment segment(random_point(), random_point(), 0);
+            vector<char> result;
+            intersects_many(segment, segments, result);
+            REQUIRE(result.size() == static_cast<size_t>(size));
+            for (int i = 0; i < size; ++i) {
+                REQUIRE(static_cast<bool>(result[i]) == intersects(segment, expected[i]));
+            }
+
+            vector<int> xs;
+            vector<int> ys;
+            for (int i = 0; i < size; ++i) {
+                xs.emplace_back(expected[i].start().x());
+                ys.emplace_back(expected[i].start().y());
+            }
+            vector<Orientation> sides;
+            orientations(segment.start(), segment.end(), xs, ys, sides);
+            REQUIRE(sides.size() == static_cast<size_t>(size));
+            for (int i = 0; i < size; ++i) {
+                REQUIRE(sides[i] == orientation(segment.start(), segment.end(), expected[i].start()));
+            }
+        }
+    }
 }
@@ -2,6 +2,13 @@
 
 #include <vector>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <set>
 
 #include "utilities/tsp.h"
 #include "utilities/geometry.h"
@@ -38,13 +45,677 @@ TEST_CASE("Base MST OneTree and Hierholzer cases", "[Graph]") {
 //    }
 //
 //    SECTION("Hierholzer") {
+        // The complete graph has odd degrees, so use every edge twice for an Euler circuit
         vector<LineSegment> edges;
         for (const auto &edge : grid.lines_length_ordered()) {
-            if (edge.start_id() < edge.end_id()) {
+            if (edge.start_id() != edge.end_id()) {
                 edges.emplace_back(edge);
             }
         }
         const vector<int> &path = hierholzer_path(grid.locations(), edges);
-        REQUIRE(path.size() == edges.size());
+        REQUIRE(path.size() == edges.size() + 1);
+        REQUIRE(path.front() == path.back());
+        map<pair<int, int>, int> uses;
+        for (size_t i = 0; i + 1 < path.size(); ++i) {
+            ++uses[make_pair(min(path[i], path[i + 1]), max(path[i], path[i + 1]))];
+        }
+        REQUIRE(uses.size() == 6);
+        for (const auto &[edge, count] : uses) {
+            REQUIRE(count == 2);
+        }
 //    }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Candidate graph", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 100000);
+    vector<Point> points;
+    for (int id = 1; id <= 300; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+    const CandidateGraph &candidates = instance.candidate_graph();
+    const int nodes = instance.locations();
+
+    SECTION("Candidates include the nearest neighbours and are ordered by length") {
+        REQUIRE(candidates.size() == nodes);
+        REQUIRE(candidates.connected());
+        for (int node = 0; node < nodes; ++node) {
+            vector<int> lengths;
+            for (int other = 0; other < nodes; ++other) {
+                if (other != node) {
+                    lengths.emplace_back(instance.length(node, other));
+                }
+            }
+            sort(lengths.begin(), lengths.end());
+            const int kth_length = lengths[CandidateGraph::default_nearest - 1];
+
+            const auto [begin, end] = candidates.neighbours(node);
+            REQUIRE(end - begin == candidates.degree(node));
+            int near_count = 0;
+            for (const int *neighbour = begin; neighbour != end; ++neighbour) {
+                REQUIRE(*neighbour != node);
+                if (neighbour != begin) {
+                    REQUIRE(instance.length(node, *(neighbour - 1)) <= instance.length(node, *neighbour));
+                }
+                if (instance.length(node, *neighbour) < kth_length) {
+                    ++near_count;
+                }
+                // Symmetric
+                const auto [other_begin, other_end] = candidates.neighbours(*neighbour);
+                REQUIRE(find(other_begin, other_end, node) != other_end);
+            }
+            const int expected_near_count = count_if(lengths.begin(), lengths.end(), [&](int length) {
+                return length < kth_length;
+            });
+            REQUIRE(near_count == expected_near_count);
+        }
+
+        const auto &edges = candidates.edges();
+        for (size_t i = 1; i < edges.size(); ++i) {
+            REQUIRE(edges[i - 1].length() <= edges[i].length());
+        }
+    }
+
+    SECTION("Spanning trees from candidates are minimal") {
+        // Each edge once, in one direction
+        const auto all = [](const LineSegment &edge) { return edge.start_id() < edge.end_id(); };
+        const MST from_candidates = kruskal(instance, vector<LineSegment>(), all);
+        const MST from_all = kruskal(nodes, vector<LineSegment>(), instance.lines_length_ordered(), all);
+        REQUIRE(from_candidates.edges().size() == nodes - 1);
+        REQUIRE(from_candidates.size() == from_all.size());
+
+        const OneTree one_tree_from_candidates = kruskal_1_tree(instance, 0, vector<LineSegment>(), all);
+        const OneTree one_tree_from_all = kruskal_1_tree(nodes, 0, vector<LineSegment>(),
+                                                         instance.lines_length_ordered(), all);
+        REQUIRE(one_tree_from_candidates.size() == one_tree_from_all.size());
+    }
+
+    SECTION("Falls back to all edges when the filter disconnects the candidates") {
+        // Do not allow any candidate edges for node 1
+        const auto [begin, end] = candidates.neighbours(1);
+        const auto not_candidate = [&](const LineSegment &edge) {
+            if (edge.start_id() >= edge.end_id()) {
+                return false;
+            }
+            const int other = edge.start_id() == 1 ? edge.end_id() : (edge.end_id() == 1 ? edge.start_id() : -1);
+            return other == -1 || find(begin, end, other) == end;
+        };
+        const MST mst = kruskal(instance, vector<LineSegment>(), not_candidate);
+        REQUIRE(mst.edges().size() == nodes - 1);
+        REQUIRE(mst.edges_at(1).size() >= 1);
+
+        const OneTree one_tree = kruskal_1_tree(instance, 1, vector<LineSegment>(), not_candidate);
+        REQUIRE(one_tree.edges_at(1).size() == 2);
+    }
+
+    SECTION("Quadrant neighbours connect separate clusters") {
+        vector<Point> clustered;
+        int id = 1;
+        for (int cluster = 0; cluster < 2; ++cluster) {
+            for (int i = 0; i < 20; ++i) {
+                clustered.emplace_back(Point(id++, cluster * 1000000 + i % 5, i / 5));
+            }
+        }
+        TSPInstance clustered_instance("Clustered", clustered);
+        REQUIRE(clustered_instance.candidate_graph().connected());
+    }
+}
+
+
+TEST_CASE("Held-Karp bound", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 9; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+    const int nodes = instance.locations();
+    const auto &edges = instance.lines_length_ordered();
+    const AdjacencyGraph graph(nodes, edges);
+
+    // Optimal tour, and shortest tour using each edge, by enumerating all tours starting in node 0
+    vector<vector<int>> shortest_with(nodes, vector<int>(nodes, numeric_limits<int>::max()));
+    // The same for tours using the edge between node 1 and 2
+    vector<vector<int>> shortest_with_1_2(nodes, vector<int>(nodes, numeric_limits<int>::max()));
+    vector<int> tour(nodes);
+    iota(tour.begin(), tour.end(), 0);
+    int optimal = numeric_limits<int>::max();
+    do {
+        int length = 0;
+        for (int i = 0; i < nodes; ++i) {
+            length += instance.length(tour[i], tour[(i + 1) % nodes]);
+        }
+        optimal = min(optimal, length);
+        const int position_1 = static_cast<int>(find(tour.begin(), tour.end(), 1) - tour.begin());
+        const bool uses_1_2 = tour[(position_1 + 1) % nodes] == 2 || tour[(position_1 + nodes - 1) % nodes] == 2;
+        for (int i = 0; i < nodes; ++i) {
+            const int a = tour[i];
+            const int b = tour[(i + 1) % nodes];
+            shortest_with[a][b] = shortest_with[b][a] = min(shortest_with[a][b], length);
+            if (uses_1_2) {
+                shortest_with_1_2[a][b] = shortest_with_1_2[b][a] = min(shortest_with_1_2[a][b], length);
+            }
+        }
+    } while (next_permutation(tour.begin() + 1, tour.end()));
+
+    const OneTree plain = kruskal_1_tree(nodes, 0, vector<LineSegment>(), edges,
+                                         [](const LineSegment &) { return true; });
+    HeldKarpOptions options;
+    const auto held_karp = held_karp_1_tree(nodes, 0, vector<LineSegment>(), graph, optimal,
+                                            vector<double>(), options.iterations, options);
+    REQUIRE(held_karp.has_value());
+
+    SECTION("Bound") {
+        const auto single = held_karp_1_tree(nodes, 0, vector<LineSegment>(), graph, optimal,
+                                             vector<double>(), 1, options);
+        REQUIRE(single.has_value());
+        REQUIRE(single->bound == plain.size());
+
+        REQUIRE(plain.size() <= held_karp->bound);
+        REQUIRE(held_karp->bound <= optimal);
+        REQUIRE(held_karp->potentials.size() == nodes);
+
+        // Starting from the best potentials never gives a worse bound
+        const auto warm = held_karp_1_tree(nodes, 0, vector<LineSegment>(), graph, optimal,
+                                           held_karp->potentials, options.warm_iterations, options);
+        REQUIRE(warm.has_value());
+        REQUIRE(held_karp->bound <= warm->bound);
+        REQUIRE(warm->bound <= optimal);
+
+        // Without any edges at node 3 there is no 1-tree
+        vector<LineSegment> without_3;
+        copy_if(edges.begin(), edges.end(), back_inserter(without_3), [](const LineSegment &edge) {
+            return edge.start_id() != 3 && edge.end_id() != 3;
+        });
+        REQUIRE(!held_karp_1_tree(nodes, 0, vector<LineSegment>(), AdjacencyGraph(nodes, without_3), optimal,
+                                  vector<double>(), options.iterations, options).has_value());
+    }
+
+    SECTION("Reduced cost filtering") {
+        vector<LineSegment> candidates;
+        copy_if(edges.begin(), edges.end(), back_inserter(candidates), [](const LineSegment &edge) {
+            return edge.start_id() != edge.end_id();
+        });
+        for (const int upper_bound : {optimal, optimal + optimal / 20}) {
+            const auto excluded_plain = one_tree_excluded_edges(plain, vector<double>(), vector<LineSegment>(),
+                                                                candidates, upper_bound);
+            const auto excluded = one_tree_excluded_edges(held_karp->one_tree, held_karp->potentials,
+                                                          vector<LineSegment>(), candidates, upper_bound);
+            REQUIRE(excluded_plain.size() <= excluded.size());
+            for (const auto &edge : excluded) {
+                REQUIRE(shortest_with[edge.start_id()][edge.end_id()] > upper_bound);
+            }
+            for (const auto &edge : excluded_plain) {
+                REQUIRE(shortest_with[edge.start_id()][edge.end_id()] > upper_bound);
+            }
+        }
+        // With the optimal length as bound, only the edges of optimal tours remain
+        const auto excluded = one_tree_excluded_edges(held_karp->one_tree, held_karp->potentials,
+                                                      vector<LineSegment>(), candidates, optimal);
+        REQUIRE(!excluded.empty());
+
+        // A mandatory edge can not be replaced
+        const LineSegment mandatory = instance.line(1, 2);
+        const int upper_bound = optimal + optimal / 20;
+        const auto with_mandatory = held_karp_1_tree(nodes, 0, {mandatory}, graph,
+                                                     upper_bound, vector<double>(), options.iterations, options);
+        REQUIRE(with_mandatory.has_value());
+        for (const auto &edge : one_tree_excluded_edges(with_mandatory->one_tree, with_mandatory->potentials,
+                                                        {mandatory}, candidates, upper_bound)) {
+            REQUIRE(shortest_with_1_2[edge.start_id()][edge.end_id()] > upper_bound);
+        }
+    }
+}
+
+
+TEST_CASE("Path maxima", "[Graph]") {
+    mt19937 rng(4711);
+    const int nodes = 60;
+    vector<LineSegment> edges;
+    vector<double> weights;
+    // Two random trees, on the even and on the odd nodes
+    for (int node = 2; node < nodes; ++node) {
+        const int parent = uniform_int_distribution<int>(0, node / 2 - 1)(rng) * 2 + node % 2;
+        edges.emplace_back(Point(parent + 1, parent, 0), Point(node + 1, node, 0));
+        weights.emplace_back(uniform_int_distribution<int>(0, 1000)(rng));
+    }
+    const PathMaxima path_maxima(nodes, edges, weights);
+
+    // Depth first search for the maximum on the path from each node
+    for (int from = 0; from < nodes; ++from) {
+        vector<double> expected(nodes, -1);
+        vector<pair<int, double>> stack{{from, -numeric_limits<double>::infinity()}};
+        expected[from] = -numeric_limits<double>::infinity();
+        while (!stack.empty()) {
+            const auto [node, path_max] = stack.back();
+            stack.pop_back();
+            for (size_t i = 0; i < edges.size(); ++i) {
+                const int next = edges[i].start_id() == node ? edges[i].end_id()
+                                                             : (edges[i].end_id() == node ? edges[i].start_id() : -1);
+                if (next != -1 && expected[next] == -1) {
+                    expected[next] = max(path_max, weights[i]);
+                    stack.emplace_back(next, expected[next]);
+                }
+            }
+        }
+        for (int to = 0; to < nodes; ++to) {
+            const auto result = path_maxima.max_on_path(from, to);
+            if (from % 2 != to % 2) {
+                REQUIRE(!result.has_value());
+            } else {
+                REQUIRE(result.has_value());
+                REQUIRE(result.value() == expected[to]);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Incremental MST", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 40; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+    const int nodes = instance.locations();
+    const auto &edges = instance.lines_length_ordered();
+
+    for (const int excluded_node : {-1, 7}) {
+        vector<vector<bool>> allowed(nodes, vector<bool>(nodes, true));
+        const auto filter = [&](const LineSegment &edge) {
+            return allowed[edge.start_id()][edge.end_id()];
+        };
+        vector<LineSegment> mandatory;
+        UnionFind mandatory_sets(nodes);
+        IncrementalMST incremental;
+        uniform_int_distribution<int> node(0, nodes - 1);
+
+        for (int round = 0; round < 30; ++round) {
+            // Remove some edges, and make a tree edge or a random edge mandatory
+            for (int i = 0; i < 20; ++i) {
+                const int a = node(rng);
+                const int b = node(rng);
+                allowed[a][b] = allowed[b][a] = false;
+            }
+            const int a = node(rng);
+            const int b = node(rng);
+            if (a != b && a != excluded_node && b != excluded_node && allowed[a][b] &&
+                !mandatory_sets.same_set(a, b)) {
+                mandatory_sets.join(a, b);
+                mandatory.emplace_back(instance.line(a, b));
+            }
+
+            const MST &repaired = incremental.update(nodes, excluded_node, mandatory, edges, filter);
+            IncrementalMST fresh;
+            const MST &rebuilt = fresh.update(nodes, excluded_node, mandatory, edges, filter);
+            REQUIRE(repaired.size() == rebuilt.size());
+            REQUIRE(repaired.edges().size() == rebuilt.edges().size());
+            if (excluded_node == -1) {
+                REQUIRE(rebuilt.size() == kruskal(nodes, mandatory, edges, filter).size());
+            } else {
+                REQUIRE(repaired.edges_at(excluded_node).empty());
+            }
+            for (const auto &edge : mandatory) {
+                const auto &at_start = repaired.edges_at(edge.start_id());
+                REQUIRE(any_of(at_start.begin(), at_start.end(), [&](const LineSegment &tree_edge) {
+                    return tree_edge.id_not(edge.start_id()) == edge.end_id();
+                }));
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Prim 1-trees", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 60; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+    const int nodes = instance.locations();
+    const auto all = [](const LineSegment &) { return true; };
+
+    // A path of mandatory edges
+    const vector<LineSegment> mandatory{instance.line(3, 4), instance.line(4, 5), instance.line(10, 11)};
+
+    for (const auto *edges : {&instance.lines_length_ordered(), &instance.candidate_graph().edges()}) {
+        const AdjacencyGraph graph(nodes, *edges);
+        for (const int excluded_node : {0, 4, 11, nodes - 1}) {
+            const OneTree kruskal = kruskal_1_tree(nodes, excluded_node, mandatory, *edges, all);
+            for (const auto variant : {PrimVariant::Automatic, PrimVariant::Dense, PrimVariant::Heap}) {
+                const auto prim = prim_1_tree(graph, excluded_node, mandatory, vector<double>(), variant);
+                REQUIRE(prim.has_value());
+                REQUIRE(prim->size() == kruskal.size());
+                REQUIRE(prim->mst().edges().size() == nodes - 2);
+                REQUIRE(prim->extra_edges().first.id_not(excluded_node) !=
+                        prim->extra_edges().second.id_not(excluded_node));
+                for (const auto &edge : mandatory) {
+                    const auto &at_start = prim->edges_at(edge.start_id());
+                    REQUIRE(any_of(at_start.begin(), at_start.end(), [&](const LineSegment &tree_edge) {
+                        return tree_edge.id_not(edge.start_id()) == edge.end_id();
+                    }));
+                }
+            }
+        }
+    }
+
+    // Potentials only change which tree is minimal
+    vector<double> potentials(nodes);
+    for (auto &potential : potentials) {
+        potential = uniform_int_distribution<int>(-50, 50)(rng);
+    }
+    const AdjacencyGraph graph(nodes, instance.lines_length_ordered());
+    const auto dense = prim_1_tree(graph, 0, mandatory, potentials, PrimVariant::Dense);
+    const auto heap = prim_1_tree(graph, 0, mandatory, potentials, PrimVariant::Heap);
+    REQUIRE(dense.has_value());
+    REQUIRE(heap.has_value());
+    REQUIRE(dense->size() == heap->size());
+
+    // Disconnected
+    vector<LineSegment> without_7;
+    copy_if(instance.lines_length_ordered().begin(), instance.lines_length_ordered().end(),
+            back_inserter(without_7), [](const LineSegment &edge) {
+                return edge.start_id() != 7 && edge.end_id() != 7;
+            });
+    REQUIRE(!prim_1_tree(AdjacencyGraph(nodes, without_7), 0, mandatory, vector<double>(), PrimVariant::Dense));
+    REQUIRE(!prim_1_tree(AdjacencyGraph(nodes, without_7), 0, mandatory, vector<double>(), PrimVariant::Heap));
+}
+
+
+TEST_CASE("Sorting edges by length", "[Graph]") {
+    mt19937 rng(4711);
+    EdgeSorter sorter;
+    for (const int max_coordinate : {10, 1000, 100000}) {
+        uniform_int_distribution<int> coordinate(0, max_coordinate);
+        vector<LineSegment> edges;
+        for (int id = 1; id <= 500; ++id) {
+            edges.emplace_back(Point(id, coordinate(rng), coordinate(rng)),
+                               Point(id + 1, coordinate(rng), coordinate(rng)));
+        }
+        vector<LineSegment> expected(edges);
+        stable_sort(expected.begin(), expected.end(), [](const LineSegment &a, const LineSegment &b) {
+            return a.length() < b.length();
+        });
+
+        sorter.sort_by_length(edges);
+        REQUIRE(edges.size() == expected.size());
+        for (size_t i = 0; i < edges.size(); ++i) {
+            REQUIRE(edges[i].length() == expected[i].length());
+            REQUIRE(edges[i].start_id() == expected[i].start_id());
+        }
+    }
+}
+
+
+TEST_CASE("Minimum perfect matching", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 200; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+
+    const auto matching_length = [&](const vector<int> &nodes, const vector<LineSegment> &matches) {
+        vector<int> used(instance.locations(), 0);
+        int length = 0;
+        for (const auto &match : matches) {
+            ++used[match.start_id()];
+            ++used[match.end_id()];
+            length += match.length();
+        }
+        for (int node : nodes) {
+            REQUIRE(used[node] == 1);
+        }
+        REQUIRE(matches.size() * 2 == nodes.size());
+        return length;
+    };
+    const auto edges_between = [&](const vector<int> &nodes) {
+        vector<char> included(instance.locations(), 0);
+        for (int node : nodes) {
+            included[node] = 1;
+        }
+        vector<LineSegment> result;
+        for (const auto &edge : instance.candidate_graph().edges()) {
+            if (included[edge.start_id()] && included[edge.end_id()]) {
+                result.emplace_back(edge);
+            }
+        }
+        return result;
+    };
+
+    SECTION("Exact matching is minimal") {
+        for (const int size : {2, 4, 8, 12, 16}) {
+            vector<int> nodes(instance.locations());
+            iota(nodes.begin(), nodes.end(), 0);
+            shuffle(nodes.begin(), nodes.end(), rng);
+            nodes.resize(size);
+
+            // Shortest matching of each subset, matching the lowest node in the subset first
+            vector<int> shortest(1U << size, numeric_limits<int>::max());
+            shortest[0] = 0;
+            for (unsigned int set = 1; set < shortest.size(); ++set) {
+                if (__builtin_popcount(set) % 2 == 1) {
+                    continue;
+                }
+                const int first = __builtin_ctz(set);
+                for (int other = first + 1; other < size; ++other) {
+                    const unsigned int rest = set & ~(1U << first) & ~(1U << other);
+                    if ((set >> other & 1U) == 1 && shortest[rest] != numeric_limits<int>::max()) {
+                        shortest[set] = min(shortest[set],
+                                            shortest[rest] + instance.length(nodes[first], nodes[other]));
+                    }
+                }
+            }
+
+            const auto matches = min_perfect_matching(instance, nodes, edges_between(nodes));
+            REQUIRE(matching_length(nodes, matches) == shortest.back());
+        }
+    }
+
+    SECTION("Large sets are matched completely") {
+        vector<int> nodes(instance.locations());
+        iota(nodes.begin(), nodes.end(), 0);
+        const auto edges = edges_between(nodes);
+        const int exact = matching_length(nodes, min_perfect_matching(instance, nodes, edges, 200));
+        const int heuristic = matching_length(nodes, min_perfect_matching(instance, nodes, edges, 0));
+        REQUIRE(exact <= heuristic);
+        REQUIRE(heuristic <= 1.2 * exact);
+
+        // Without edges everything is matched over the remaining nodes
+        matching_length(nodes, min_perfect_matching(instance, nodes, vector<LineSegment>(), 0));
+    }
+}
+
+
+TEST_CASE("Tour improvement", "[Graph]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 200; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    TSPInstance instance("Random", points);
+    const int nodes = instance.locations();
+
+    vector<int> start(nodes);
+    iota(start.begin(), start.end(), 0);
+    shuffle(start.begin(), start.end(), rng);
+    const auto tour_length = [&](const vector<int> &tour) {
+        REQUIRE(tour.size() == static_cast<size_t>(nodes));
+        vector<int> sorted(tour);
+        sort(sorted.begin(), sorted.end());
+        for (int i = 0; i < nodes; ++i) {
+            REQUIRE(sorted[i] == i);
+        }
+        int length = 0;
+        for (int i = 0; i < nodes; ++i) {
+            length += instance.length(tour[i], tour[(i + 1) % nodes]);
+        }
+        return length;
+    };
+    const auto all = [](int, int) { return true; };
+    LocalSearchOptions unlimited;
+    unlimited.max_moves = numeric_limits<int>::max();
+    unlimited.time_limit = 0;
+
+    SECTION("Improves the tour") {
+        vector<int> tour(start);
+        const int moves = improve_tour(instance, tour, all, unlimited);
+        REQUIRE(moves > 0);
+        REQUIRE(tour_length(tour) < tour_length(start));
+        // At most 10% above the bound from the Held-Karp 1-tree
+        const AdjacencyGraph graph(nodes, instance.lines_length_ordered());
+        const auto bound = held_karp_1_tree(nodes, 0, vector<LineSegment>(), graph, tour_length(tour),
+                                            vector<double>(), 100, HeldKarpOptions());
+        REQUIRE(bound.has_value());
+        REQUIRE(tour_length(tour) <= 1.1 * bound->bound);
+
+        // Don't-look bits only approximate a local optimum, but improving again never makes the tour longer
+        vector<int> again(tour);
+        improve_tour(instance, again, all, unlimited);
+        REQUIRE(tour_length(again) <= tour_length(tour));
+    }
+
+    SECTION("Respects the move limit") {
+        vector<int> tour(start);
+        LocalSearchOptions options = unlimited;
+        options.max_moves = 5;
+        REQUIRE(improve_tour(instance, tour, all, options) == 5);
+        REQUIRE(tour_length(tour) < tour_length(start));
+    }
+
+    SECTION("Only adds allowed edges") {
+        // Edges from the start tour, and edges between nodes with ids of the same parity
+        set<pair<int, int>> start_edges;
+        for (int i = 0; i < nodes; ++i) {
+            const int a = start[i];
+            const int b = start[(i + 1) % nodes];
+            start_edges.emplace(min(a, b), max(a, b));
+        }
+        const auto allowed = [](int a, int b) { return (a - b) % 2 == 0; };
+        vector<int> tour(start);
+        REQUIRE(improve_tour(instance, tour, allowed, unlimited) > 0);
+        REQUIRE(tour_length(tour) < tour_length(start));
+        for (int i = 0; i < nodes; ++i) {
+            const int a = tour[i];
+            const int b = tour[(i + 1) % nodes];
+            REQUIRE((allowed(a, b) || start_edges.count(make_pair(min(a, b), max(a, b))) == 1));
+        }
+    }
+}
+
+
+TEST_CASE("Union-find", "[Graph]") {
+    mt19937 rng(4711);
+    const int n = 200;
+    uniform_int_distribution<int> element(0, n - 1);
+
+    // Naive sets as a label per element
+    vector<int> labels(n);
+    iota(labels.begin(), labels.end(), 0);
+    const auto naive_join = [&](vector<int> &naive, int a, int b) {
+        const int from = naive[b];
+        const int to = naive[a];
+        for (int &label : naive) {
+            if (label == from) {
+                label = to;
+            }
+        }
+    };
+    const auto require_same = [&](const vector<int> &naive, auto &sets) {
+        set<int> distinct(naive.begin(), naive.end());
+        REQUIRE(sets.set_count() == static_cast<int>(distinct.size()));
+        for (int a = 0; a < n; ++a) {
+            REQUIRE(sets.set_size(a) == count(naive.begin(), naive.end(), naive[a]));
+            const int b = element(rng);
+            REQUIRE(sets.same_set(a, b) == (naive[a] == naive[b]));
+        }
+    };
+
+    SECTION("Path halving") {
+        UnionFind sets(n);
+        for (int round = 0; round < 150; ++round) {
+            const int a = element(rng);
+            const int b = element(rng);
+            sets.join(a, b);
+            naive_join(labels, a, b);
+            require_same(labels, sets);
+        }
+        sets.reset(n);
+        REQUIRE(sets.set_count() == n);
+        REQUIRE(!sets.same_set(0, 1));
+    }
+
+    SECTION("Rollback") {
+        RollbackUnionFind sets(n);
+        vector<pair<int, vector<int>>> checkpoints;
+        for (int round = 0; round < 300; ++round) {
+            if (round % 7 == 0) {
+                checkpoints.emplace_back(sets.checkpoint(), labels);
+            }
+            if (round % 13 == 12) {
+                // Roll back to a random earlier checkpoint
+                uniform_int_distribution<size_t> position(0, checkpoints.size() - 1);
+                checkpoints.resize(position(rng) + 1);
+                sets.rollback(checkpoints.back().first);
+                labels = checkpoints.back().second;
+            } else {
+                const int a = element(rng);
+                const int b = element(rng);
+                REQUIRE(sets.join(a, b) == (labels[a] != labels[b]));
+                naive_join(labels, a, b);
+            }
+            require_same(labels, sets);
+        }
+        sets.rollback(0);
+        REQUIRE(sets.set_count() == n);
+    }
+}
+
+
+TEST_CASE("Union-find benchmark", "[.][benchmark]") {
+    // Kruskal-style joins over random edges, reported as a warning
+    mt19937 rng(4711);
+    const int n = 1000000;
+    uniform_int_distribution<int> element(0, n - 1);
+    vector<pair<int, int>> edges(4 * n);
+    for (auto &edge : edges) {
+        edge = make_pair(element(rng), element(rng));
+    }
+    const auto time = [&](auto &&run) {
+        const auto start = chrono::steady_clock::now();
+        const int joins = run();
+        const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        REQUIRE(joins > 0);
+        return elapsed.count();
+    };
+
+    const double path_halving = time([&] {
+        UnionFind sets(n);
+        int joins = 0;
+        for (const auto &[a, b] : edges) {
+            if (!sets.same_set(a, b)) {
+                sets.join(a, b);
+                ++joins;
+            }
+        }
+        return joins;
+    });
+    const double rollback = time([&] {
+        RollbackUnionFind sets(n);
+        int joins = 0;
+        for (const auto &[a, b] : edges) {
+            joins += sets.join(a, b) ? 1 : 0;
+        }
+        sets.rollback(0);
+        return joins;
+    });
+    WARN("UnionFind " << path_halving << " ms, RollbackUnionFind with rollback " << rollback << " ms");
+}
@@ -0,0 +1,147 @@
+#include "extern/catch2.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+
+#include "utilities/tsp.h"
+#include "utilities/geometry.h"
+#include "utilities/graph.h"
+#include "utilities/lin_kernighan.h"
+
+using namespace hc;
+using namespace std;
+
+
+TEST_CASE("Two-level tour", "[LinKernighan]") {
+    mt19937 rng(4711);
+    for (const int nodes : {5, 17, 100, 400}) {
+        vector<int> expected(nodes);
+        iota(expected.begin(), expected.end(), 0);
+        shuffle(expected.begin(), expected.end(), rng);
+        TwoLevelTour tour(expected);
+
+        uniform_int_distribution<int> random_node(0, nodes - 1);
+        for (int round = 0; round < 2000; ++round) {
+            // Reverse the path between two random nodes in an array copy of the tour, possibly wrapping around
+            expected = tour.tour();
+            const int from = random_node(rng);
+            const int to = random_node(rng);
+            const int from_position = static_cast<int>(find(expected.begin(), expected.end(), from) - expected.begin());
+            const int to_position = static_cast<int>(find(expected.begin(), expected.end(), to) - expected.begin());
+            const int path_length = (to_position - from_position + nodes) % nodes + 1;
+            for (int i = 0; i < path_length / 2; ++i) {
+                swap(expected[(from_position + i) % nodes], expected[(to_position - i + nodes) % nodes]);
+            }
+            tour.reverse(from, to);
+
+            // The same cycle, possibly traversed in the other direction
+            const bool same_direction = tour.next(expected[0]) == expected[1];
+            for (int i = 0; i < nodes; ++i) {
+                const int node = expected[i];
+                const int after = expected[(i + 1) % nodes];
+                const int before = expected[(i + nodes - 1) % nodes];
+                REQUIRE(tour.next(node) == (same_direction ? after : before));
+                REQUIRE(tour.prev(node) == (same_direction ? before : after));
+            }
+        }
+
+        const vector<int> result = tour.tour();
+        REQUIRE(result.size() == expected.size());
+        vector<int> sorted(result);
+        sort(sorted.begin(), sorted.end());
+        for (int i = 0; i < nodes; ++i) {
+            REQUIRE(sorted[i] == i);
+        }
+    }
+}
+
+
+TEST_CASE("Path exchange", "[LinKernighan]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    for (const int nodes : {8, 52, 280}) {
+        vector<Point> points;
+        for (int id = 1; id <= nodes; ++id) {
+            points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+        }
+        const TSPInstance instance("Random", points);
+        vector<int> start(nodes);
+        iota(start.begin(), start.end(), 0);
+        shuffle(start.begin(), start.end(), rng);
+        TwoLevelTour tour(start);
+        long long length = tour_length(instance, start);
+
+        uniform_int_distribution<int> random_node(0, nodes - 1);
+        uniform_int_distribution<int> random_length(1, (nodes - 2) / 2);
+        for (int round = 0; round < 1000; ++round) {
+            // a, b1...b2, c1...c2, d becomes a, c1...c2, b1...b2, d, as the kicks of Lin-Kernighan
+            const int a = random_node(rng);
+            const int b1 = tour.next(a);
+            int b2 = b1;
+            for (int i = random_length(rng); i > 1; --i) {
+                b2 = tour.next(b2);
+            }
+            const int c1 = tour.next(b2);
+            int c2 = c1;
+            for (int i = random_length(rng); i > 1; --i) {
+                c2 = tour.next(c2);
+            }
+            const int d = tour.next(c2);
+            length += instance.length(a, c1) + instance.length(c2, b1) + instance.length(b2, d)
+                      - instance.length(a, b1) - instance.length(b2, c1) - instance.length(c2, d);
+            tour.exchange_paths(b1, b2, c1, c2);
+
+            const bool same_direction = tour.next(a) == c1;
+            const auto after = [&](int node) { return same_direction ? tour.next(node) : tour.prev(node); };
+            REQUIRE(after(a) == c1);
+            REQUIRE(after(c2) == b1);
+            REQUIRE(after(b2) == d);
+            REQUIRE(tour_length(instance, tour.tour()) == length);
+        }
+    }
+}
+
+
+TEST_CASE("Lin-Kernighan", "[LinKernighan]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    vector<Point> points;
+    for (int id = 1; id <= 300; ++id) {
+        points.emplace_back(Point(id, coordinate(rng), coordinate(rng)));
+    }
+    const auto instance = make_shared<const TSPInstance>("Random", points);
+    const int nodes = instance->locations();
+
+    const auto require_tour = [&](const vector<int> &tour) {
+        vector<int> sorted(tour);
+        sort(sorted.begin(), sorted.end());
+        REQUIRE(sorted.size() == static_cast<size_t>(nodes));
+        for (int i = 0; i < nodes; ++i) {
+            REQUIRE(sorted[i] == i);
+        }
+    };
+
+    const AdjacencyGraph graph(nodes, instance->lines_length_ordered());
+    const auto bound = held_karp_1_tree(nodes, 0, vector<LineSegment>(), graph, instance->max_total_cost(),
+                                        vector<double>(), 200, HeldKarpOptions());
+    REQUIRE(bound.has_value());
+
+    SECTION("Improves a random tour") {
+        vector<int> tour(nodes);
+        iota(tour.begin(), tour.end(), 0);
+        shuffle(tour.begin(), tour.end(), rng);
+        const int start_length = tour_length(*instance, tour);
+        REQUIRE(lin_kernighan(*instance, tour) > 0);
+        require_tour(tour);
+        REQUIRE(tour_length(*instance, tour) < start_length);
+        REQUIRE(tour_length(*instance, tour) <= 1.1 * bound->bound);
+    }
+
+    SECTION("Heuristic tour") {
+        const vector<int> tour = heuristic_tour(instance);
+        require_tour(tour);
+        REQUIRE(tour_length(*instance, tour) <= 1.05 * bound->bound);
+    }
+}
@@ -2,9 +2,13 @@
 
 #include <vector>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <tuple>
 
 #include "utilities/geometry.h"
 #include "utilities/spatial_index.h"
+#include "utilities/segment_grid.h"
 
 #include "test_util.h"
 
@@ -33,4 +37,93 @@ TEST_CASE("Simple test cases", "[SpatialIndex]") {
     }
 
     REQUIRE(hits.size() == 16);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Random boxes", "[SpatialIndex]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    uniform_int_distribution<int> extent(0, 100);
+    for (const int box_count : {0, 1, 7, 8, 9, 100, 1000}) {
+        vector<BoundingBox> boxes;
+        for (int i = 0; i < box_count; ++i) {
+            const int x = coordinate(rng);
+            const int y = coordinate(rng);
+            boxes.emplace_back(BoundingBox(x, y, x + extent(rng), y + extent(rng)));
+        }
+        const SpatialIndex<BoundingBox> &index = SpatialIndex<BoundingBox>::create(boxes);
+
+        for (int query = 0; query < 100; ++query) {
+            const int x = coordinate(rng);
+            const int y = coordinate(rng);
+            const BoundingBox box(x, y, x + 2 * extent(rng), y + 2 * extent(rng));
+
+            vector<BoundingBox> expected;
+            for (const auto &other : boxes) {
+                if (other.intersects(box)) {
+                    expected.emplace_back(other);
+                }
+            }
+            vector<BoundingBox> found;
+            index.visit(box, [&](const BoundingBox &hit) { found.emplace_back(hit); });
+
+            const auto by_corners = [](const BoundingBox &a, const BoundingBox &b) {
+                return make_tuple(a.min_x(), a.min_y(), a.max_x(), a.max_y()) <
+                       make_tuple(b.min_x(), b.min_y(), b.max_x(), b.max_y());
+            };
+            sort(expected.begin(), expected.end(), by_corners);
+            sort(found.begin(), found.end(), by_corners);
+            REQUIRE(found == expected);
+        }
+    }
+}
+
+
+TEST_CASE("Segment grid", "[SpatialIndex]") {
+    mt19937 rng(4711);
+    uniform_int_distribution<int> coordinate(0, 1000);
+    uniform_int_distribution<int> offset(-60, 60);
+    const int segments = 300;
+
+    vector<BoundingBox> boxes;
+    for (int i = 0; i < segments; ++i) {
+        const Point start(i + 1, coordinate(rng), coordinate(rng));
+        // Mostly short segments as in a tour, with some long ones overlapping many cells
+        const Point end(i + 2, i % 20 == 0 ? coordinate(rng) : start.x() + offset(rng),
+                        i % 20 == 0 ? coordinate(rng) : start.y() + offset(rng));
+        boxes.emplace_back(LineSegment(start, end).bounding_box());
+    }
+
+    SegmentGrid grid(BoundingBox(0, 0, 1000, 1000), segments);
+    for (int i = 0; i < segments; ++i) {
+        grid.insert(i, boxes[i]);
+        REQUIRE(grid.size() == i + 1);
+
+        for (int query = 0; query < 10; ++query) {
+            const int x = coordinate(rng);
+            const int y = coordinate(rng);
+            const int size = query == 0 ? 1000 : offset(rng) + 60;
+            const BoundingBox box(x, y, x + size, y + size);
+
+            vector<int> expected;
+            for (int j = 0; j <= i; ++j) {
+                if (boxes[j].intersects(box)) {
+                    expected.emplace_back(j);
+                }
+            }
+            vector<int> found;
+            grid.visit(box, [&](int id) { found.emplace_back(id); });
+            sort(found.begin(), found.end());
+            REQUIRE(found == expected);
+
+            if (!expected.empty()) {
+                const int wanted = expected.back();
+                int calls = 0;
+                REQUIRE(grid.any_of(box, [&](int id) {
+                    ++calls;
+                    return id == wanted;
+                }));
+                REQUIRE(calls <= static_cast<int>(expected.size()));
+            }
+        }
+    }
+}
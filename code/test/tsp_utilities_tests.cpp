@@ -1,17 +1,36 @@
 #include "extern/catch2.h"
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <vector>
 #include <iostream>
 #include <sstream>
 
 #include "utilities/geometry.h"
 #include "utilities/tsp.h"
+#include "utilities/instance_cache.h"
 
 #include "test_util.h"
 
 using namespace hc;
 using namespace std;
 
+namespace {
+    vector<Edge> as_vector(const DominatedEdges::Range &edges) {
+        return vector<Edge>(edges.begin(), edges.end());
+    }
+
+    vector<Edge> as_vector(const DominatedEdges::DirectedRange &edges) {
+        vector<Edge> result;
+        for (const Edge edge : edges) {
+            result.emplace_back(edge);
+        }
+        return result;
+    }
+}
+
 
 TEST_CASE("dominating_in_euclidean_tsp", "[TSP]") {
     SECTION("Simplest base case") {
@@ -40,14 +59,14 @@ TEST_CASE("dominating_in_euclidean_tsp", "[TSP]") {
         TSPInstance instance("2-by-2 grid", {p11, p12, p21, p22});
 
         SECTION("Check dominated edges") {
-            DominatedEdges &dominated_edges = instance.dominated_edges();
+            const DominatedEdges &dominated_edges = instance.dominated_edges();
             REQUIRE(dominated_edges.dominated(Edge(0,1)).empty());
             REQUIRE(dominated_edges.dominated(Edge(1,3)).empty());
             REQUIRE(dominated_edges.dominated(Edge(3,2)).empty());
             REQUIRE(dominated_edges.dominated(Edge(2,0)).empty());
 
-            REQUIRE(dominated_edges.dominated(Edge(0,3)) == vector<Edge>{Edge(1,2), Edge(2,1)});
-            REQUIRE(dominated_edges.dominated(Edge(1,2)) == vector<Edge>{Edge(0,3), Edge(3,0)});
+            REQUIRE(as_vector(dominated_edges.dominated(Edge(0,3))) == vector<Edge>{Edge(1,2), Edge(2,1)});
+            REQUIRE(as_vector(dominated_edges.dominated(Edge(1,2))) == vector<Edge>{Edge(0,3), Edge(3,0)});
         }
     }
 
@@ -112,3 +131,403 @@ TEST_CASE("Read tsp", "[TSP]") {
     }
     REQUIRE(instance.name() == "berlin52truncated");
 }
+
+TEST_CASE("Read tsp coordinates", "[TSP]") {
+    SECTION("Coordinates are scaled when some coordinate has a fraction") {
+        const string scaled = "NAME : scaled\n"
+                              "TYPE : TSP\n"
+                              "DIMENSION : 4\n"
+                              "EDGE_WEIGHT_TYPE : EUC_2D\n"
+                              "NODE_COORD_SECTION\n"
+                              "  1 12 -3\r\n"
+                              "  2 6.91100e+02 8.5e1\n"
+                              "  3 334.5909245845 1.81920e+04\n"
+                              "  4 +7 0.25\n"
+                              "EOF\n";
+        istringstream in(scaled);
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+        REQUIRE(result.isOk());
+        const TSPInstance &instance = result.unwrap();
+        REQUIRE(instance.distances().xs() == vector<int>{120, 6911, 3345, 70});
+        REQUIRE(instance.distances().ys() == vector<int>{-30, 850, 181920, 2});
+    }
+
+    SECTION("Malformed coordinates are reported") {
+        const string malformed = "NAME : malformed\n"
+                                 "TYPE : TSP\n"
+                                 "DIMENSION : 2\n"
+                                 "EDGE_WEIGHT_TYPE : EUC_2D\n"
+                                 "NODE_COORD_SECTION\n"
+                                 "1 1 2\n"
+                                 "2 1,5 3\n"
+                                 "EOF\n";
+        istringstream in(malformed);
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+        REQUIRE(result.isErr());
+        REQUIRE(result.unwrapErr().kind == TSPReadError::Kind::WrongFormat);
+    }
+
+    SECTION("Missing files are reported") {
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(string("no-such-file.tsp"));
+        REQUIRE(result.isErr());
+        REQUIRE(result.unwrapErr().kind == TSPReadError::Kind::NoFile);
+    }
+}
+
+TEST_CASE("Read tsp edge weight types", "[TSP]") {
+    const auto read = [](const string &edge_weight_type, const string &data) {
+        istringstream in("NAME : types\n"
+                         "TYPE : TSP (with a remark)\n"
+                         "DIMENSION : 3\n"
+                         "EDGE_WEIGHT_TYPE : " + edge_weight_type + "\n" + data);
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+        if (result.isErr()) {
+            derr << result.unwrapErr().text << endl;
+        }
+        REQUIRE(result.isOk());
+        return result.unwrap();
+    };
+    const string coordinates = "NODE_COORD_SECTION\n"
+                               "1 0 0\n"
+                               "2 3 4\n"
+                               "3 10 1\n"
+                               "EOF\n";
+
+    SECTION("Euclidean distances are approximated with two decimals") {
+        const TSPInstance instance = read("EUC_2D", coordinates);
+        REQUIRE(instance.edge_weight_type() == EdgeWeightType::Euc2D);
+        REQUIRE(instance.has_embedding());
+        REQUIRE(instance.length(0, 1) == 500);
+        REQUIRE(instance.length(0, 2) == 1004);
+    }
+
+    SECTION("Ceiling distances are rounded up") {
+        const TSPInstance instance = read("CEIL_2D", coordinates);
+        REQUIRE(instance.has_embedding());
+        REQUIRE(instance.length(0, 1) == 5);
+        REQUIRE(instance.length(0, 2) == 11);
+        REQUIRE(instance.length(1, 2) == 8);
+    }
+
+    SECTION("Pseudo-Euclidean distances") {
+        const TSPInstance instance = read("ATT", coordinates);
+        REQUIRE(instance.has_embedding());
+        REQUIRE(instance.length(0, 1) == 2);
+        REQUIRE(instance.length(0, 2) == 4);
+    }
+
+    SECTION("Geographical distances") {
+        // The first two cities of ulysses16
+        const TSPInstance instance = read("GEO", "NODE_COORD_SECTION\n"
+                                                 "1 38.24 20.42\n"
+                                                 "2 39.57 26.15\n"
+                                                 "3 38.24 20.42\n");
+        REQUIRE(!instance.has_embedding());
+        REQUIRE(instance.length(0, 1) == 509);
+        REQUIRE(instance.length(1, 0) == 509);
+        // The TSPLib formula always adds one kilometer between different cities
+        REQUIRE(instance.length(0, 2) == 1);
+        REQUIRE(instance.length(0, 0) == 0);
+    }
+
+    SECTION("Explicit formats give the same lengths") {
+        const vector<string> formats = {
+                "EDGE_WEIGHT_FORMAT : FULL_MATRIX\nEDGE_WEIGHT_SECTION\n0 5 7\n5 0 9\n7 9 0\n",
+                "EDGE_WEIGHT_FORMAT : UPPER_ROW\nEDGE_WEIGHT_SECTION\n5 7\n9\n",
+                "EDGE_WEIGHT_FORMAT : LOWER_ROW\nEDGE_WEIGHT_SECTION\n5\n7 9\n",
+                "EDGE_WEIGHT_FORMAT : UPPER_DIAG_ROW\nEDGE_WEIGHT_SECTION\n0 5 7\n0 9\n0\n",
+                "EDGE_WEIGHT_FORMAT : LOWER_DIAG_ROW\nEDGE_WEIGHT_SECTION\n0\n5 0\n7 9 0\n",
+        };
+        for (const auto &format : formats) {
+            const TSPInstance instance = read("EXPLICIT", format + "DISPLAY_DATA_SECTION\n1 0 0\n2 1 0\n3 0 1\n");
+            REQUIRE(instance.edge_weight_type() == EdgeWeightType::Explicit);
+            REQUIRE(!instance.has_embedding());
+            const vector<vector<int>> expected = {{0, 5, 7}, {5, 0, 9}, {7, 9, 0}};
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    REQUIRE(instance.length(i, j) == expected[i][j]);
+                }
+            }
+            REQUIRE(instance.max_cost() == 9);
+        }
+    }
+
+    SECTION("Unsupported types are reported") {
+        istringstream in("NAME : types\nTYPE : TSP\nDIMENSION : 3\nEDGE_WEIGHT_TYPE : MAN_2D\n" + coordinates);
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+        REQUIRE(result.isErr());
+        REQUIRE(result.unwrapErr().kind == TSPReadError::Kind::WrongDistanceMeasure);
+    }
+}
+
+TEST_CASE("Distance oracle", "[TSP]") {
+    vector<Point> points;
+    for (int i = 0; i < 20; ++i) {
+        points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+    }
+    TSPInstance instance("Scattered", points);
+
+    SECTION("Lines are computed from the locations") {
+        for (int i = 0; i < instance.locations(); ++i) {
+            for (int j = 0; j < instance.locations(); ++j) {
+                const LineSegment expected(points[i], points[j]);
+                REQUIRE(instance.line(i, j) == expected);
+                REQUIRE(instance.line(i, j).length() == expected.length());
+                REQUIRE(instance.length(i, j) == expected.length());
+            }
+        }
+        REQUIRE(instance.lines_length_ordered().size() == points.size() * points.size());
+    }
+
+    SECTION("Dense lengths are the same as computed lengths") {
+        TSPInstance on_demand("Scattered", DistanceOracle(points), 0);
+        REQUIRE(on_demand.distances().dense_lengths() == nullptr);
+        REQUIRE(instance.distances().dense_lengths() != nullptr);
+        REQUIRE(instance.distances().dense_lengths()->narrow());
+        for (int i = 0; i < instance.locations(); ++i) {
+            for (int j = 0; j < instance.locations(); ++j) {
+                REQUIRE(instance.length(i, j) == on_demand.length(i, j));
+            }
+        }
+
+        vector<Point> far_points{Point(1, 0, 0), Point(2, 1000, 0), Point(3, 0, 1000)};
+        TSPInstance far("Far", far_points);
+        REQUIRE(far.max_cost() > 65535);
+        REQUIRE(!far.distances().dense_lengths()->narrow());
+        REQUIRE(far.length(1, 2) == LineSegment(far_points[1], far_points[2]).length());
+    }
+
+    SECTION("Cached lengths are the same as computed lengths") {
+        TSPInstance cached("Scattered", DistanceOracle(points), 0);
+        // Use a tiny cache to force collisions
+        cached.cache_lengths(8);
+        for (int round = 0; round < 2; ++round) {
+            for (int i = 0; i < cached.locations(); ++i) {
+                for (int j = 0; j < cached.locations(); ++j) {
+                    REQUIRE(cached.length(i, j) == instance.length(i, j));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Length cache", "[TSP]") {
+    // Far more nodes than keys that fit in 32 bits, with the fewest slots allowed
+    const int nodes = 200000;
+    LengthCache cache(1, nodes);
+    const auto pair_of = [](std::uint64_t key) {
+        std::uint64_t hi = 1;
+        while (hi * (hi + 1) / 2 <= key) {
+            ++hi;
+        }
+        return std::make_pair(static_cast<int>(hi), static_cast<int>(key - hi * (hi - 1) / 2));
+    };
+    for (const std::uint64_t key : {std::uint64_t(12345), std::uint64_t(1) << 31U, std::uint64_t(4000000000)}) {
+        // Pairs whose keys only differ above the lower 32 bits
+        const auto [a, b] = pair_of(key);
+        const auto [c, d] = pair_of(key + (std::uint64_t(1) << 32U));
+        REQUIRE(d < c);
+        REQUIRE(c < nodes);
+        cache.insert(a, b, 17);
+        cache.insert(c, d, 42);
+        REQUIRE(cache.find(c, d) == 42);
+        REQUIRE(cache.find(d, c) == 42);
+        REQUIRE((cache.find(a, b) == 17 || cache.find(a, b) == -1));
+        cache.insert(a, b, 17);
+        REQUIRE((cache.find(c, d) == 42 || cache.find(c, d) == -1));
+    }
+}
+
+TEST_CASE("Instance cache", "[TSP]") {
+    const string file_name = "instance_cache_test.hcbin";
+    const auto round_trip = [&](const TSPInstance &instance, bool with_dominated_edges) {
+        REQUIRE(write_instance_cache(instance, file_name, with_dominated_edges));
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(file_name);
+        std::remove(file_name.c_str());
+        if (result.isErr()) {
+            derr << result.unwrapErr().text << endl;
+        }
+        REQUIRE(result.isOk());
+        return result.unwrap();
+    };
+    const auto require_same_lengths = [](const TSPInstance &expected, const TSPInstance &actual) {
+        REQUIRE(actual.name() == expected.name());
+        REQUIRE(actual.locations() == expected.locations());
+        REQUIRE(actual.edge_weight_type() == expected.edge_weight_type());
+        for (int i = 0; i < expected.locations(); ++i) {
+            REQUIRE(actual.location(i) == expected.location(i));
+            for (int j = 0; j < expected.locations(); ++j) {
+                REQUIRE(actual.length(i, j) == expected.length(i, j));
+            }
+        }
+    };
+
+    SECTION("Coordinates, candidates, and dominated edges are kept") {
+        vector<Point> points;
+        for (int i = 0; i < 30; ++i) {
+            points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+        }
+        const TSPInstance instance("Scattered", points);
+        const TSPInstance cached = round_trip(instance, true);
+        require_same_lengths(instance, cached);
+
+        REQUIRE(cached.has_dominated_edges());
+        for (int from = 0; from < instance.locations(); ++from) {
+            for (int to = 0; to < instance.locations(); ++to) {
+                REQUIRE(as_vector(cached.dominated_edges().dominated(Edge(from, to))) ==
+                        as_vector(instance.dominated_edges().dominated(Edge(from, to))));
+            }
+        }
+
+        const CandidateGraph &expected = instance.candidate_graph();
+        const CandidateGraph &actual = cached.candidate_graph();
+        REQUIRE(actual.edges() == expected.edges());
+        for (int node = 0; node < instance.locations(); ++node) {
+            const auto [expected_begin, expected_end] = expected.neighbours(node);
+            const auto [actual_begin, actual_end] = actual.neighbours(node);
+            REQUIRE(vector<int>(actual_begin, actual_end) == vector<int>(expected_begin, expected_end));
+        }
+    }
+
+    SECTION("Explicit lengths are kept") {
+        istringstream in("NAME : explicit\nTYPE : TSP\nDIMENSION : 4\nEDGE_WEIGHT_TYPE : EXPLICIT\n"
+                         "EDGE_WEIGHT_FORMAT : UPPER_ROW\nEDGE_WEIGHT_SECTION\n3 70000 5\n4 6\n7\nEOF\n");
+        const TSPInstance instance = TSPInstance::read_instance(in).unwrap();
+        const TSPInstance cached = round_trip(instance, false);
+        require_same_lengths(instance, cached);
+        REQUIRE(!cached.has_dominated_edges());
+    }
+
+    SECTION("Other versions are rejected") {
+        vector<Point> points{Point(1, 0, 0), Point(2, 1, 0), Point(3, 0, 1)};
+        REQUIRE(write_instance_cache(TSPInstance("Small", points), file_name, false));
+        string data;
+        {
+            ifstream in(file_name, ios::binary);
+            data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        std::remove(file_name.c_str());
+        InstanceCacheHeader header{};
+        memcpy(&header, data.data(), sizeof(header));
+        header.version += 1;
+        memcpy(&data[0], &header, sizeof(header));
+        istringstream in(data);
+        const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+        REQUIRE(result.isErr());
+        REQUIRE(result.unwrapErr().kind == TSPReadError::Kind::WrongFormat);
+    }
+
+    SECTION("Corrupt offsets and nodes are rejected") {
+        vector<Point> points;
+        for (int i = 0; i < 12; ++i) {
+            points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+        }
+        REQUIRE(write_instance_cache(TSPInstance("Small", points), file_name, true));
+        string data;
+        {
+            ifstream in(file_name, ios::binary);
+            data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        std::remove(file_name.c_str());
+        InstanceCacheHeader header{};
+        memcpy(&header, data.data(), sizeof(header));
+        const size_t nodes = header.nodes;
+
+        // The positions of the arrays, each padded to 8 bytes
+        const auto padded = [](size_t bytes) { return (bytes + 7) / 8 * 8; };
+        const size_t candidate_offsets = sizeof(header) + padded(header.name_bytes) + 2 * padded(4 * nodes);
+        const size_t candidate_neighbours = candidate_offsets + padded(4 * (nodes + 1));
+        const size_t from_offsets = candidate_neighbours + padded(4 * header.candidate_neighbours) +
+                                    padded(8 * header.candidate_neighbours);
+
+        const auto require_corrupt = [&](size_t position, auto value) {
+            string corrupt = data;
+            memcpy(&corrupt[position], &value, sizeof(value));
+            istringstream in(corrupt);
+            const Result<TSPInstance, TSPReadError> &result = TSPInstance::read_instance(in);
+            REQUIRE(result.isErr());
+            REQUIRE(result.unwrapErr().kind == TSPReadError::Kind::WrongFormat);
+            REQUIRE(result.unwrapErr().text == "Instance cache is corrupt.");
+        };
+        require_corrupt(from_offsets + 8 * nodes, uint64_t(1000000));
+        require_corrupt(from_offsets + 8, uint64_t(1000000));
+        require_corrupt(candidate_offsets + 4 * nodes, int32_t(1000000));
+        require_corrupt(candidate_neighbours, int32_t(nodes));
+        require_corrupt(candidate_neighbours, int32_t(-1));
+
+        istringstream in(data);
+        REQUIRE(TSPInstance::read_instance(in).isOk());
+    }
+}
+
+TEST_CASE("Dominated edges with threads", "[TSP]") {
+    vector<Point> points;
+    for (int i = 0; i < 40; ++i) {
+        points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+    }
+    const TSPInstance instance("Scattered", points);
+    const DominatedEdges sequential = DominatedEdges::make_for_instance_spatial_index(instance, 1);
+
+    for (const int threads : {2, 3, 8}) {
+        const DominatedEdges parallel = DominatedEdges::make_for_instance_spatial_index(instance, threads);
+        for (int from = 0; from < instance.locations(); ++from) {
+            for (int to = 0; to < instance.locations(); ++to) {
+                REQUIRE(as_vector(parallel.dominated(Edge(from, to))) ==
+                        as_vector(sequential.dominated(Edge(from, to))));
+            }
+        }
+    }
+}
+
+TEST_CASE("Dominated edges storage", "[TSP]") {
+    vector<Point> points;
+    for (int i = 0; i < 25; ++i) {
+        points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+    }
+    const TSPInstance instance("Scattered", points);
+
+    for (const DominatedEdges &edges : {DominatedEdges::make_for_instance_spatial_index(instance, 1),
+                                        DominatedEdges::make_for_instance_all_vs_all(instance)}) {
+        int keys = 0;
+        edges.for_each([&](int from, int to, const DominatedEdges::Range &dominated) {
+            ++keys;
+            REQUIRE(from < to);
+            REQUIRE(!dominated.empty());
+            const vector<Edge> list = as_vector(dominated);
+            REQUIRE(is_sorted(list.begin(), list.end()));
+            REQUIRE(adjacent_find(list.begin(), list.end()) == list.end());
+
+            const vector<Edge> directed = as_vector(edges.dominated(Edge(from, to)));
+            REQUIRE(directed.size() == 2 * list.size());
+            REQUIRE(as_vector(edges.dominated(Edge(to, from))) == directed);
+            for (size_t i = 0; i < list.size(); ++i) {
+                REQUIRE(list[i].from() < list[i].to());
+                REQUIRE(directed[2 * i] == list[i]);
+                REQUIRE(directed[2 * i + 1] == Edge(list[i].to(), list[i].from()));
+
+                const vector<Edge> reverse = as_vector(edges.dominated(list[i]).undirected());
+                REQUIRE(binary_search(reverse.begin(), reverse.end(), Edge(from, to)));
+            }
+        });
+        REQUIRE(keys > 0);
+    }
+}
+
+TEST_CASE("Lazy dominated edges", "[TSP]") {
+    vector<Point> points;
+    for (int i = 0; i < 30; ++i) {
+        points.emplace_back(Point(i + 1, (i * 37) % 101, (i * 53) % 97));
+    }
+    const TSPInstance lazy("Scattered", points);
+    const TSPInstance eager("Scattered", points);
+    eager.compute_dominated_edges();
+
+    for (int round = 0; round < 2; ++round) {
+        for (int from = 0; from < lazy.locations(); ++from) {
+            for (int to = 0; to < lazy.locations(); ++to) {
+                REQUIRE(as_vector(lazy.dominated(Edge(from, to))) == as_vector(eager.dominated(Edge(from, to))));
+            }
+        }
+    }
+    REQUIRE(!lazy.has_dominated_edges());
+}